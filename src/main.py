@@ -20,6 +20,11 @@ from modules.CS_optimized import CS, use_cs_module  # Módulo de simulación de
 from modules.sensitivity_analysis import SensitivityAnalyzer, create_sensitivity_wrapper
 from modules.advanced_cfd import AdvancedCFD, create_advanced_cfd_simulator
 from modules.validation_module import ValidationModule, create_validation_module
+from modules.grid_stream import stream_hub  # Streaming en vivo hacia la WebApp
+from modules.shared_grid import SharedGridWriter, STATUS_FINISHED, STATUS_FAILED
+from modules.tile_pyramid import TilePyramidWriter  # Teselas multirresolución para el visor web
+from modules.evolution_store import EvolutionWriter  # Series temporales por paso para la WebApp
+from modules.time_stepping import AdaptiveTimeStepper  # Subpasos estables de transporte (CFL/difusión)
 import traci
 import threading
 from utils.logger import setup_logger
@@ -32,6 +37,10 @@ from ui.control_panel import ControlPanel
 # Configurar el sistema de logging centralizado
 logger = setup_logger('simulation', 'simulation.log')
 
+# Ejecutables de SUMO (se pueden sobrescribir con config['sumo_binary'])
+SUMO_GUI_BINARY = r"C:\Program Files (x86)\Eclipse\Sumo\bin\sumo-gui.exe"
+SUMO_BINARY = os.path.join(os.environ['SUMO_HOME'], 'bin', 'sumo') if 'SUMO_HOME' in os.environ else 'sumo'
+
 def estimate_simulation_time(config):
     """
     Estima el tiempo aproximado que tomará la simulación en minutos.
@@ -74,13 +83,19 @@ def run_simulation(config):
         - Integración total con la WebApp Flask para visualización y análisis científico.
     """
     logger.info("Starting SUMO...")
+    headless = config.get('headless', False)
     
     try:
-        # Iniciar SUMO con la interfaz gráfica
-        traci.start([r"C:\Program Files (x86)\Eclipse\Sumo\bin\sumo-gui.exe", "-c", config['sumo_config']])
+        # Iniciar SUMO: con interfaz gráfica desde la GUI, sin ella en los trabajadores de la WebApp.
+        # Cada trabajador usa su propio puerto TraCI para no colisionar con otras simulaciones.
+        sumo_binary = config.get('sumo_binary') or (SUMO_BINARY if headless else SUMO_GUI_BINARY)
+        traci.start([sumo_binary, "-c", config['sumo_config']],
+                    port=config.get('traci_port'), label=config.get('traci_label', 'default'))
         logger.info(f"SUMO started with config: {config['sumo_config']}")
     except Exception as e:
         logger.error(f"Error starting SUMO: {e}")
+        if headless:
+            raise
         messagebox.showerror("Error", f"Error al iniciar SUMO: {str(e)}")
         return
         
@@ -92,6 +107,15 @@ def run_simulation(config):
     init_time = time.time() - start_time
     logger.info(f"CS initialized in {init_time:.3f}s")
 
+    # Memoria compartida con la WebApp (si la simulación se lanzó desde un proceso trabajador)
+    shared_writer = None
+    if config.get('shared_memory'):
+        try:
+            shared_writer = SharedGridWriter.attach(config['shared_memory'])
+            logger.info(f"Publishing grids to shared memory segment {shared_writer.name}")
+        except Exception as e:
+            logger.error(f"Error attaching to shared memory: {e}")
+
     # Log if using C module or not
     if use_cs_module:
         logger.info("Simulation running with C optimized module.")
@@ -141,6 +165,42 @@ def run_simulation(config):
         # --- NUEVO: Guardar evolución temporal de cada especie para análisis web ---
         species_evolution = {sp: [] for sp in species_list}
         steps_evolution = []
+        # Almacén indexado de métricas por paso (la WebApp lo consulta mientras se escribe)
+        evolution_writer = EvolutionWriter('evolution', species_list,
+                                           flush_every=config['parameters']['update_interval'])
+
+        # Pirámides de teselas por especie (se actualizan de forma incremental en cada intervalo)
+        # Con el motor de bocanadas el visor evalúa las teselas bajo demanda (ver puffs/latest.npz)
+        puff_backend = getattr(simulation, 'puff_pool', None) is not None
+        tile_writers = {}
+        if config.get('export_tiles', not puff_backend):
+            tile_writers = {sp: TilePyramidWriter('tiles', sp) for sp in species_list}
+
+        # Paso de SUMO y controlador del subpaso de transporte: se elige en cada paso el mayor
+        # subpaso estable según el viento, la difusión y el tamaño de celda
+        step_length = traci.simulation.getDeltaT()
+        diffusion_coeff = float(config.get('diffusion_coeff', 2.0))
+        time_stepper = AdaptiveTimeStepper(cfl_max=float(config.get('cfl_max', 0.9)))
+        # Motor lagrangiano de bocanadas: las mallas solo se rasterizan cada raster_interval pasos
+        raster_interval = max(1, int(config.get('puff_raster_interval', config['parameters']['update_interval'])))
+
+        if puff_backend:
+            os.makedirs('puffs', exist_ok=True)
+
+        # Receptores (puntos de interés): se evalúan en cada paso sin necesidad de la malla completa
+        receptors = config.get('receptors') or []
+        receptor_log = None
+        if receptors:
+            receptor_names = [r.get('name', f'r{k}') if isinstance(r, dict) else f'r{k}' for k, r in enumerate(receptors)]
+            receptor_xy = np.array([(r['x'], r['y']) if isinstance(r, dict) else r[:2] for r in receptors], dtype=np.float64)
+            receptor_log = open('receptors.csv', 'w')
+            columns = [f'{name}_{sp}' for name in receptor_names for sp in species_list]
+            # Con el índice de cañones se añade la concentración de calle (OSPM) de cada receptor
+            canyons = getattr(simulation, 'canyon_index', None) is not None
+            if canyons:
+                logger.info(f"Street canyons: {simulation.canyon_index.n_canyons} canyon segments")
+                columns += [f'{name}_{sp}_canyon' for name in receptor_names for sp in species_list]
+            receptor_log.write('step,' + ','.join(columns) + '\n')
 
         while step < config['parameters']['total_steps'] and traci.simulation.getMinExpectedNumber() > 0 and not stop_event.is_set():
             t_step_start = time.perf_counter()
@@ -148,29 +208,48 @@ def run_simulation(config):
 
             # --- Actualización CFD vectorizada y multiespecie con C puro ---
             with update_lock:
+                # Meteorología variable: viento del paso y reconstrucciones solo al cambiar de intervalo
+                if getattr(simulation, 'meteorology', None) is not None:
+                    simulation.update_meteorology(traci.simulation.getTime())
                 wind_field = config.get('wind_field', None)  # Campo de viento espacialmente variable
                 diffusion_field = config.get('diffusion_field', None)  # Campo de difusión variable
                 try:
+                    if puff_backend:
+                        simulation.update_puffs(dt=step_length, wind_field=wind_field)
                     # Se fuerza el uso del método C vectorizado multiespecie
-                    if hasattr(simulation, 'update_pollution_vectorized_multi'):
+                    elif hasattr(simulation, 'update_pollution_vectorized_multi'):
                         simulation.update_pollution_vectorized_multi(
-                            dt=1.0,
-                            diffusion_coeff=2.0,
+                            dt=step_length,
+                            diffusion_coeff=diffusion_coeff,
                             wind_field=wind_field,
                             diffusion_field=diffusion_field,
-                            use_c_module=True  # Forzar C siempre
+                            use_c_module=True,  # Forzar C siempre
+                            time_stepper=time_stepper
                         )
                     else:
-                        simulation.update(use_vectorized=True, dt=1.0, diffusion_coeff=2.0, z_layers=1)
+                        simulation.update(use_vectorized=True, dt=step_length, diffusion_coeff=diffusion_coeff, z_layers=1)
                 except Exception as e:
                     logger.error(f"Error en actualización C vectorizada: {e}")
                     # Fallback solo si es absolutamente necesario
-                    simulation.update(use_vectorized=True, dt=1.0, diffusion_coeff=2.0, z_layers=1)
+                    simulation.update(use_vectorized=True, dt=step_length, diffusion_coeff=diffusion_coeff, z_layers=1)
+                grids_fresh = not puff_backend or step % raster_interval == 0
+                if puff_backend and grids_fresh:
+                    simulation.rasterize_puffs()
+                if receptor_log is not None:
+                    values = simulation.sample_receptors(receptor_xy[:, 0], receptor_xy[:, 1])
+                    row = [values[sp][k] for k in range(len(receptor_xy)) for sp in species_list]
+                    if canyons:
+                        simulation.update_canyon_sources()
+                        street = simulation.sample_canyons(receptor_xy[:, 0], receptor_xy[:, 1])
+                        row += [street[sp][k] for k in range(len(receptor_xy)) for sp in species_list]
+                    receptor_log.write(f"{step}," + ','.join(f'{v:.6e}' for v in row) + '\n')
+                if puff_backend and step % config['parameters']['update_interval'] == 0:
+                    simulation.lazy_field().save(os.path.join('puffs', 'latest.npz'))
                 timing_data_shared['update_time'] = time.perf_counter() - t_step_start
                 timing_data_shared['step'] = step
 
                 # Visualizar solo la primera especie (ejemplo: NOx)
-                if hasattr(simulation, 'pollution_grids'):
+                if hasattr(simulation, 'pollution_grids') and grids_fresh:
                     simulation.pollution_grid = simulation.pollution_grids[species_list[0]]
 
                     # Guardar evolución temporal (media por paso) de cada especie
@@ -179,12 +258,22 @@ def run_simulation(config):
                         if grid is not None:
                             mean_val = float(np.mean(grid))
                             species_evolution[sp].append(mean_val)
+                            # Publicar la malla a los clientes web conectados (no-op si no hay)
+                            stream_hub.publish(sp, step, grid)
                     steps_evolution.append(step)
+                    evolution_writer.append(step, simulation.pollution_grids)
+                    if shared_writer is not None:
+                        shared_writer.publish(step, simulation.pollution_grids)
 
                 # Visualización asíncrona o por lotes para no ralentizar
                 if step % max(1, config['parameters']['update_interval']//2) == 0:
                     simulation.visualize()
 
+                if tile_writers and step % config['parameters']['update_interval'] == 0:
+                    for sp, writer in tile_writers.items():
+                        if sp in simulation.pollution_grids:
+                            writer.write(simulation.pollution_grids[sp], step)
+
                 if recorder and (step % config['parameters']['update_interval'] == 0):
                     try:
                         recorder.capture_frame()
@@ -202,15 +291,26 @@ def run_simulation(config):
                 avg_update_time = sum(update_times) / len(update_times)
                 max_update_time = max(update_times)
                 logger.info(f"Rendimiento: {avg_update_time*1000:.2f}ms/actualización (max: {max_update_time*1000:.2f}ms)")
+                logger.debug(f"Transporte: {time_stepper.summary()}")
                 update_times = []
             step += 1
             final_step = step
 
         detailed_log.close()
+        evolution_writer.close()
+        if receptor_log is not None:
+            receptor_log.close()
+        if puff_backend:
+            simulation.lazy_field().save(os.path.join('puffs', 'latest.npz'))
         stop_event.set()
+        if shared_writer is not None:
+            shared_writer.set_status(STATUS_FINISHED)
         logger.info(f"Simulation finished after {step} steps")
+        logger.info(f"Transporte adaptativo: {time_stepper.summary()}")
         # Exportar todas las especies a VTK y CSV
         try:
+            if puff_backend:
+                simulation.rasterize_puffs()
             if hasattr(simulation, 'export_to_vtk_multi'):
                 simulation.export_to_vtk_multi(filename_prefix="pollution_grid", step=final_step)
                 logger.info(f"Exported all species to VTK")
@@ -219,6 +319,8 @@ def run_simulation(config):
                 for species, grid in simulation.pollution_grids.items():
                     np.savetxt(f"pollution_grid_{species}_{final_step}.csv", grid, delimiter=",", fmt="%.6e")
                     logger.info(f"Exported {species} to CSV")
+                    if species in tile_writers:
+                        tile_writers[species].write(grid, final_step)
             # Guardar evolución temporal para análisis web (JSON y CSV)
             if steps_evolution and species_evolution:
                 import json
@@ -285,6 +387,11 @@ def run_simulation(config):
     sim_thread.join()
     vis_thread.join()
 
+    if shared_writer is not None:
+        if shared_writer.status != STATUS_FINISHED:
+            shared_writer.set_status(STATUS_FAILED)
+        shared_writer.close()
+
     # Recuperar species_list y final_step del hilo de simulación
     # (como no se puede devolver de un hilo, se almacena en variables globales)
     # Solución: definir variables fuera y modificarlas dentro del hilo, o usar un objeto compartido
@@ -336,6 +443,9 @@ def run_simulation(config):
     except Exception as e:
         logger.error(f"Error running timing analysis: {e}")
 
+    if headless:
+        return
+
     # Show control panel after simulation finishes
     try:
         import tkinter as tk
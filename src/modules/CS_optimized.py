@@ -13,7 +13,22 @@ import sys
 import os
 import time
 import scipy.ndimage
-from typing import Dict, Tuple, List, Any, Optional
+from typing import Dict, Tuple, List, Any, Optional, Sequence, Set
+
+from modules.time_stepping import max_wind_components
+from modules.puff_engine import STABILITY_SIGMA_A, LazyPuffField, PuffPool
+from modules.street_canyon import build_canyon_index, sumo_inputs
+from modules.obstacles import build_obstacle_mask, pack_mask
+from modules.emission_model import EmissionModel, deposit_point_sources
+from modules.sumo_emissions import SumoEmissionSource
+from modules.chemistry import J_NO2, ChemistryOperator
+from modules.deposition import DepositionOperator
+from modules.meteorology import MetBuckets, MetSeries
+from modules.dead_tiles import decay_py, dilate, live_tiles, mark_points, reach, snap_floor, tile_shape
+from modules.fast_forward import geometric_advance, spectral_advance
+from modules.gaussian_plume import emission_rates, gaussian_plumes_py, plume_rises
+from modules.vertical_layers import (gaussian_layers_py, layer_heights, vertical_diffusivity,
+                                     vertical_exchange_py)
 
 # Asegúrate de que el directorio actual es el de 'modules'
 module_path = os.path.join(os.path.dirname(__file__))
@@ -34,10 +49,145 @@ except ImportError:
         use_cs_module = False
         # print("Usando módulo C original (spam) para cálculos de contaminación")
     except ImportError:
-        # print("¡ADVERTENCIA! No se pudo cargar ningún módulo C. El rendimiento será muy lento.")
+        # print("¡ADVERTENCIA! No se pudo cargar ningún módulo C. Se usará la versión NumPy vectorizada.")
         use_cs_module = False
 
 
+def advect_semi_lagrangian(grid: np.ndarray, wind_field: np.ndarray, dt: float,
+                           cell_width: float, cell_height: float, conservative: bool = False,
+                           obstacles: Optional[np.ndarray] = None) -> np.ndarray:
+    """
+    Versión NumPy de cs_module.advect_wind_field (mismo esquema y fronteras abiertas).
+    obstacles es la máscara booleana de edificios [ny, nx] (desempaquetada) o None.
+
+    Returns:
+        Nueva malla advectada
+    """
+    ny, nx = grid.shape
+    ii, jj = np.meshgrid(np.arange(ny, dtype=np.float64), np.arange(nx, dtype=np.float64), indexing='ij')
+    shift_y = wind_field[..., 1] * (dt / cell_height)
+    shift_x = wind_field[..., 0] * (dt / cell_width)
+    open_ = None if obstacles is None else (~obstacles).astype(np.float64)
+    if not conservative:
+        # Retroceso: valor interpolado en el punto de partida (fuera del dominio, aire limpio)
+        coords = [ii - shift_y, jj - shift_x]
+        if open_ is None:
+            return scipy.ndimage.map_coordinates(grid, coords, order=1, mode='grid-constant', cval=0.0)
+        # Esquinas dentro de edificios excluidas y pesos renormalizados
+        acc = scipy.ndimage.map_coordinates(grid * open_, coords, order=1, mode='grid-constant', cval=0.0)
+        norm = scipy.ndimage.map_coordinates(open_, coords, order=1, mode='grid-constant', cval=1.0)
+        with np.errstate(divide='ignore', invalid='ignore'):
+            return open_ * np.where(norm > 0, acc / norm, 0.0)
+    # Variante directa: cada celda reparte su masa entre los vecinos del punto de llegada
+    y, x = ii + shift_y, jj + shift_x
+    i0, j0 = np.floor(y).astype(np.intp), np.floor(x).astype(np.intp)
+    wy, wx = y - i0, x - j0
+    corners = []
+    norm = np.zeros((ny, nx))
+    for di, dj, w in ((0, 0, (1 - wy) * (1 - wx)), (0, 1, (1 - wy) * wx),
+                      (1, 0, wy * (1 - wx)), (1, 1, wy * wx)):
+        ti, tj = i0 + di, j0 + dj
+        inside = (ti >= 0) & (ti < ny) & (tj >= 0) & (tj < nx)
+        if open_ is not None:
+            w = w * np.where(inside, open_[np.clip(ti, 0, ny - 1), np.clip(tj, 0, nx - 1)], 1.0)
+        norm += w
+        corners.append((ti, tj, w, inside))
+    out = np.zeros(ny * nx)
+    if open_ is not None:
+        # Si las cuatro esquinas son edificio, la masa se queda en su celda
+        stuck = norm <= 0
+        out[stuck.ravel()] += grid[stuck]
+        norm = np.where(stuck, 1.0, norm)
+    for ti, tj, w, inside in corners:
+        np.add.at(out, ti[inside] * nx + tj[inside], (w / norm * grid)[inside])
+    return out.reshape(ny, nx)
+
+
+def _flux_sweep(q: np.ndarray, axis: int, c: float, open_: Optional[np.ndarray] = None) -> np.ndarray:
+    """Barrido 1D de advect_flux_form a lo largo de axis con Courant c (|c| <= 1)."""
+    a = np.moveaxis(q, axis, -1)
+    o = None if open_ is None else np.moveaxis(open_, axis, -1)
+    if c < 0:
+        a = a[..., ::-1]
+        o = None if o is None else o[..., ::-1]
+    ac = abs(c)
+    n = a.shape[-1]
+    # Dos celdas fantasma de aire limpio aguas arriba y gradiente nulo aguas abajo
+    zeros = np.zeros(a.shape[:-1] + (2,))
+    p = np.concatenate([zeros, a, a[..., -1:]], axis=-1)
+    qm1, q0, q1 = p[..., 0:n + 1], p[..., 1:n + 2], p[..., 2:n + 3]
+    d0, d1 = q0 - qm1, q1 - q0
+    prod = d0 * d1
+    with np.errstate(divide='ignore', invalid='ignore'):
+        slope = np.where(prod > 0, 2.0 * prod / (d0 + d1), 0.0)
+    flux = ac * (q0 + 0.5 * (1.0 - ac) * slope)
+    if o is not None:
+        # Sin flujo por las caras con un edificio a cualquiera de los lados
+        ones = np.ones(o.shape[:-1] + (1,))
+        po = np.concatenate([ones, o, ones], axis=-1)
+        flux = flux * po[..., :-1] * po[..., 1:]
+    out = a - (flux[..., 1:] - flux[..., :-1])
+    if c < 0:
+        out = out[..., ::-1]
+    return np.moveaxis(out, -1, axis)
+
+
+def advect_flux_form(grid: np.ndarray, wind_speed: float, wind_direction: float, dt: float,
+                     cell_width: float, cell_height: float,
+                     obstacles: Optional[np.ndarray] = None) -> Tuple[np.ndarray, int]:
+    """
+    Versión NumPy de cs_module.advect_grid: advección conservativa en forma de flujo con
+    limitador de van Leer, separación x/y alternada y subpasos si el Courant supera 1.
+    obstacles es la máscara booleana de edificios (paredes sin flujo) o None.
+
+    Returns:
+        (malla advectada, número de subpasos)
+    """
+    cx = wind_speed * math.cos(wind_direction) * dt / cell_width
+    cy = wind_speed * math.sin(wind_direction) * dt / cell_height
+    substeps = max(1, math.ceil(max(abs(cx), abs(cy))))
+    cx, cy = cx / substeps, cy / substeps
+    q = np.asarray(grid, dtype=np.float64)
+    open_ = None if obstacles is None else (~obstacles).astype(np.float64)
+    for k in range(substeps):
+        if k % 2 == 0:
+            q = _flux_sweep(_flux_sweep(q, 1, cx, open_), 0, cy, open_)
+        else:
+            q = _flux_sweep(_flux_sweep(q, 0, cy, open_), 1, cx, open_)
+    return q, substeps
+
+
+def diffuse_explicit(grid: np.ndarray, diffusion_coeff, dt: float,
+                     cell_width: float, cell_height: float,
+                     obstacles: Optional[np.ndarray] = None) -> np.ndarray:
+    """
+    Versión NumPy de cs_module.diffuse_grid (laplaciano de 5 puntos, flujo nulo en los
+    bordes y en las fachadas de obstacles, subpasos si el número de difusión supera 0.5).
+    diffusion_coeff puede ser un escalar o un campo [ny, nx].
+
+    Returns:
+        Nueva malla difundida
+    """
+    rx = np.asarray(diffusion_coeff, dtype=np.float64) * dt / cell_width ** 2
+    ry = np.asarray(diffusion_coeff, dtype=np.float64) * dt / cell_height ** 2
+    substeps = max(1, math.ceil(float(np.max(rx + ry)) / 0.5))
+    rx, ry = rx / substeps, ry / substeps
+    q = np.array(grid, dtype=np.float64)
+    if obstacles is not None:
+        o = (~obstacles).astype(np.float64)
+        po = np.pad(o, 1, mode='edge')
+        for _ in range(substeps):
+            p = np.pad(q, 1, mode='edge')
+            lap_x = po[1:-1, :-2] * (p[1:-1, :-2] - q) + po[1:-1, 2:] * (p[1:-1, 2:] - q)
+            lap_y = po[:-2, 1:-1] * (p[:-2, 1:-1] - q) + po[2:, 1:-1] * (p[2:, 1:-1] - q)
+            q = q + o * (rx * lap_x + ry * lap_y)
+        return q
+    for _ in range(substeps):
+        p = np.pad(q, 1, mode='edge')
+        q = q + rx * (p[1:-1, :-2] - 2.0 * q + p[1:-1, 2:]) + ry * (p[:-2, 1:-1] - 2.0 * q + p[2:, 1:-1])
+    return q
+
+
 class CS:
     """
     Núcleo CFD multiespecie optimizado para simulación de contaminación urbana.
@@ -85,13 +235,119 @@ class CS:
         
         # Soporte para múltiples especies contaminantes
         self.species_list = config.get('species_list', ['NOx'])
-        self.pollution_grids = {species: np.zeros((config['grid_resolution'], config['grid_resolution'])) for species in self.species_list}
+        # Las mallas de especies son vistas de un único array [S, ny, nx] para depositar todas de una vez
+        self.species_grids = np.zeros((len(self.species_list), config['grid_resolution'], config['grid_resolution']))
+        self.pollution_grids = {species: self.species_grids[s] for s, species in enumerate(self.species_list)}
+        # Los valores por debajo de config['value_floor'] pasan a cero exacto (sin subnormales) y
+        # las teselas de la pila que quedan a cero se saltan en decaimiento y difusión
+        self.value_floor = float(config.get('value_floor', 1e-12))
+        self.tiles = np.ones(tile_shape(self.species_grids.shape), dtype=np.uint8)
+
+        # Emisiones por clase de vehículo (config['emission_tables']: ruta .npz o 'default');
+        # sin tablas se mantiene la tasa única de calculate_emission_rate
+        self.emission_model = None
+        if config.get('emission_tables'):
+            self.emission_model = EmissionModel.from_config(config['emission_tables'], self.species_list)
+        # Emisiones calculadas por el propio SUMO (config['emission_source'] == 'sumo'), leídas
+        # con suscripciones TraCI agrupadas; tienen prioridad sobre las tablas
+        self.sumo_emissions = None
+        if config.get('emission_source') == 'sumo':
+            self.sumo_emissions = SumoEmissionSource(self.species_list)
+
+        # Química por celda tras el transporte (config['chemistry']); cada celda representa
+        # una columna de altura de mezcla config['mixing_height'] (m)
+        self.chemistry = self._make_chemistry(config)
+
+        # Eliminación física por especie (deposición seca, lavado húmedo y sedimentación) con
+        # temperature, humidity, deposition_rate y precipitation de la configuración
+        self.removal = DepositionOperator.from_config(config, self.species_list)
+
+        # Motor lagrangiano de bocanadas (config['dispersion_backend'] == 'puff')
+        self.puff_pool = None
+        if config.get('dispersion_backend') == 'puff':
+            self.puff_pool = PuffPool(self.species_list, (self.x_min, self.x_max, self.y_min, self.y_max),
+                                      capacity=int(config.get('puff_capacity', 200000)),
+                                      max_puffs=int(config.get('max_puffs', 50000)),
+                                      stability_class=self.stability_class)
+            # Evaluación bajo demanda (receptores y teselas) sin rasterizar la malla completa
+            self.puff_field = LazyPuffField(self.species_list, (self.x_min, self.x_max, self.y_min, self.y_max),
+                                            self.pollution_grid.shape)
+            self.puff_step = 0
+
+        # Edificios como obstáculos (config['building_obstacles']): máscara booleana y empaquetada
+        # en bits para los núcleos C (sin depósito en su interior, fachadas sin flujo)
+        self.obstacle_mask = None
+        self.obstacles = None
+        if config.get('building_obstacles'):
+            _, poly_file = sumo_inputs(config.get('sumo_config'))
+            self.obstacle_mask = build_obstacle_mask(config.get('poly_file', poly_file),
+                                                     (self.x_min, self.x_max, self.y_min, self.y_max),
+                                                     self.pollution_grid.shape, config.get('geometry_cache'))
+            if self.obstacle_mask is not None:
+                self.obstacles = pack_mask(self.obstacle_mask)
+
+        # Cañones urbanos (config['street_canyons']): índice a partir de la red y los edificios de SUMO
+        self.canyon_index = None
+        self.canyon_sources = None
+        if config.get('street_canyons'):
+            net_file, poly_file = sumo_inputs(config.get('sumo_config'))
+            self.canyon_index = build_canyon_index(config.get('net_file', net_file), config.get('poly_file', poly_file),
+                                                   (self.x_min, self.x_max, self.y_min, self.y_max),
+                                                   self.pollution_grid.shape,
+                                                   cache_dir=config.get('geometry_cache'),
+                                                   min_aspect=float(config.get('canyon_min_aspect', 0.3)))
         
+        # Meteorología variable (config['meteorology']: fichero .csv/.nc o 'synthetic'),
+        # interpolada con update_meteorology en el instante config['met_start'] + tiempo de SUMO
+        self.meteorology = MetSeries.from_config(config)
+        self.met_buckets = MetBuckets(config.get('met_quantum'))
+        self.update_meteorology(0.0)
+
         # Registro de inicio
         # print(f"Inicializado simulador de contaminación con resolución {config['grid_resolution']}x{config['grid_resolution']}")
         # print(f"Área: ({self.x_min}, {self.y_min}) - ({self.x_max}, {self.y_max})")
         # print(f"Viento: {self.wind_speed} m/s, dirección {config['wind_direction']}°, estabilidad {self.stability_class}")
 
+    def _make_chemistry(self, config: Dict[str, Any]) -> Optional[ChemistryOperator]:
+        """Operador de química de config['chemistry'] (None si no está activada)."""
+        if not config.get('chemistry'):
+            return None
+        cell_width, cell_height = self.cell_size()
+        return ChemistryOperator(self.species_list,
+                                 cell_width * cell_height * float(config.get('mixing_height', 100.0)),
+                                 background=config.get('chemistry_background'),
+                                 j_no2=float(config.get('j_no2', J_NO2)))
+
+    def update_meteorology(self, sim_time: float) -> Set[str]:
+        """
+        Aplica la meteorología interpolada en el instante sim_time (s de SUMO). El viento se
+        actualiza en cada llamada; la clase de estabilidad, las tasas de deposición y la
+        química solo se reconstruyen cuando su parámetro cambia de intervalo (MetBuckets).
+
+        Returns:
+            Parámetros cuyo valor representativo ha cambiado
+        """
+        if self.meteorology is None:
+            return set()
+        state = self.meteorology.at(float(self.config.get('met_start', 0.0)) + sim_time)
+        self.wind_speed = state.get('wind_speed', self.wind_speed)
+        if 'wind_direction' in state:
+            self.wind_direction = math.radians(state['wind_direction'])
+        changed = self.met_buckets.update(state)
+        held = self.met_buckets.held
+        if 'stability_class' in changed:
+            self.stability_class = held['stability_class']
+            if self.puff_pool is not None:
+                self.puff_pool.sigma_a = STABILITY_SIGMA_A.get(self.stability_class, 0.10)
+        met_config = dict(self.config, **{name: held[name] for name in
+                                          ('temperature', 'humidity', 'precipitation', 'mixing_height', 'j_no2')
+                                          if name in held})
+        if changed & {'temperature', 'humidity', 'precipitation', 'mixing_height'}:
+            self.removal = DepositionOperator.from_config(met_config, self.species_list)
+        if self.chemistry is not None and changed & {'j_no2', 'mixing_height'}:
+            self.chemistry = self._make_chemistry(met_config)
+        return changed
+
     def calculate_dispersion_coefficients(self, distance: float) -> Tuple[float, float]:
         """
         Calcula los coeficientes de dispersión según la distancia y la clase de estabilidad.
@@ -153,13 +409,17 @@ class CS:
         # Aplicar el factor de emisión global
         return base_emission * speed_factor * self.emission_factor
 
-    def update(self, use_vectorized=False, **kwargs):
+    def update(self, use_vectorized=False, dt=1.0, **kwargs):
         """
         Actualiza la cuadrícula de contaminación considerando todos los vehículos.
         Si use_vectorized=True, usa el método CFD vectorizado profesional.
+
+        Args:
+            use_vectorized: Usar update_pollution_vectorized (recibe dt y kwargs)
+            dt: Duración del paso de SUMO (s); fija la deposición del paso
         """
         if use_vectorized:
-            self.update_pollution_vectorized(**kwargs)
+            self.update_pollution_vectorized(dt=dt, **kwargs)
             return {'total_update_time': 0}  # Puedes medir el tiempo si lo deseas
 
         # ...existing code (fallback a C o Python clásico)...
@@ -176,8 +436,10 @@ class CS:
         timing_data = {}
         timing_data['time_getting_vehicle_data'] = end_vehicle_data - start_vehicle_data
 
+        # Fracción que sobrevive a la deposición durante el paso de SUMO (especie principal)
+        decay = float(self.removal.keep(dt)[0])
         if not vehicles:
-            self.pollution_grid *= 0.99
+            self.decay_grid(self.pollution_grid, decay)
             timing_data['total_update_time'] = time.perf_counter() - start_total
             return timing_data
 
@@ -193,7 +455,10 @@ class CS:
                     self.stability_class,
                     self.x_min, self.x_max,
                     self.y_min, self.y_max,
-                    self.config['grid_resolution']
+                    self.config['grid_resolution'],
+                    self.obstacles,
+                    decay,
+                    self.value_floor
                 )
                 elapsed_c_call = time.perf_counter() - start_c_call
                 timing_data['time_in_c_call'] = elapsed_c_call
@@ -204,9 +469,21 @@ class CS:
                 # print(f"Error al ejecutar update_pollution_multiple: {e}")
                 # print("Fallback a la implementación original...")
                 pass
-            
-            # Decaimiento natural de la contaminación (factor de limpieza)
-            self.pollution_grid *= 0.99
+
+        # Eliminación física de la contaminación (deposición del paso)
+        self.decay_grid(self.pollution_grid, decay)
+
+        if not use_cs_module and 'spam' not in sys.modules:
+            # Sin módulos C: las plumas de todos los vehículos en lotes vectorizados
+            start_update_calls = time.perf_counter()
+            data = np.array(vehicle_data, dtype=np.float64).reshape(-1, 3)
+            gaussian_plumes_py(self.pollution_grid, data[:, 0], data[:, 1],
+                               emission_rates(data[:, 2], self.emission_factor), plume_rises(data[:, 2]),
+                               self.wind_speed, self.wind_direction, self.stability_class,
+                               (self.x_min, self.x_max, self.y_min, self.y_max), self.obstacle_mask)
+            timing_data['time_in_update_calls'] = time.perf_counter() - start_update_calls
+            timing_data['total_update_time'] = time.perf_counter() - start_total
+            return timing_data
 
         start_update_calls = time.perf_counter()
         for vehicle in vehicles:
@@ -233,7 +510,8 @@ class CS:
                         self.wind_speed,
                         self.wind_direction,
                         self.x_min, self.x_max, self.y_min, self.y_max,
-                        self.config['grid_resolution']
+                        self.config['grid_resolution'],
+                        self.obstacles
                     )
                     elapsed = time.perf_counter() - start_time
                     timing_data.setdefault('time_per_vehicle', []).append(elapsed)
@@ -268,64 +546,23 @@ class CS:
         timing_data['total_update_time'] = time.perf_counter() - start_total
         return timing_data
 
-    def _update_pollution_py(self, i_min: int, i_max: int, j_min: int, j_max: int, 
-                           x: float, y: float, emission_rate: float, plume_height: float):
+    def _update_pollution_py(self, i_min: int, i_max: int, j_min: int, j_max: int,
+                             x: float, y: float, emission_rate: float, plume_height: float):
         """
-        Implementación en Python puro del cálculo de contaminación (respaldo).
-        Este método se usa si los módulos C no están disponibles o fallan.
-        
+        Implementación NumPy del cálculo de contaminación de un vehículo (respaldo).
+        Este método se usa si un módulo C falla con un vehículo concreto; la ventana se evalúa
+        entera con gaussian_plumes_py.
+
         Args:
             i_min, i_max, j_min, j_max: Límites de la ventana de cálculo
             x, y: Posición del vehículo emisor
             emission_rate: Tasa de emisión
             plume_height: Altura de la pluma
         """
-        # Calcular tamaño de celda
-        cell_width = (self.x_max - self.x_min) / self.config['grid_resolution']
-        cell_height = (self.y_max - self.y_min) / self.config['grid_resolution']
-        two_pi = 2.0 * math.pi
-        
-        # Para cada celda en la ventana de cálculo
-        for i in range(i_min, i_max):
-            for j in range(j_min, j_max):
-                # Calcular coordenadas del centro de la celda
-                receptor_x = self.x_min + (j + 0.5) * cell_width
-                receptor_y = self.y_min + (i + 0.5) * cell_height
-                
-                # Calcular distancia al vehículo
-                dx = receptor_x - x
-                dy = receptor_y - y
-                distance_squared = dx * dx + dy * dy
-                
-                # Omitir cálculos para puntos muy cercanos (< 1m)
-                if distance_squared < 1.0:
-                    continue
-                
-                distance = math.sqrt(distance_squared)
-                
-                # Omitir cálculos para puntos muy lejanos (> 300m)
-                if distance > 300.0:
-                    continue
-                
-                # Calcular ángulo entre dirección del viento y dirección al receptor
-                wind_dir_to_rec = math.atan2(dy, dx)
-                angle_diff = abs(wind_dir_to_rec - self.wind_direction)
-                if angle_diff > math.pi:
-                    angle_diff = two_pi - angle_diff
-                
-                # Calcular coeficientes de dispersión
-                sigma_y, sigma_z = self.calculate_dispersion_coefficients(distance)
-                
-                # Calcular componentes de la ecuación gaussiana
-                lateral_dispersion = math.exp(-0.5 * (angle_diff / sigma_y) ** 2)
-                vertical_dispersion = math.exp(-0.5 * (plume_height / sigma_z) ** 2) * 2.0
-                
-                # Calcular concentración usando modelo gaussiano
-                concentration = (emission_rate / (two_pi * self.wind_speed * sigma_y * sigma_z)) * \
-                                lateral_dispersion * vertical_dispersion
-                
-                # Añadir contribución a la celda
-                self.pollution_grid[i, j] += concentration
+        gaussian_plumes_py(self.pollution_grid, x, y, emission_rate, plume_height, self.wind_speed,
+                           self.wind_direction, self.stability_class,
+                           (self.x_min, self.x_max, self.y_min, self.y_max), self.obstacle_mask,
+                           windows=(i_min, i_max, j_min, j_max))
 
     def visualize(self):
         """
@@ -387,18 +624,22 @@ class CS:
         Actualiza la malla de contaminación usando advección-difusión vectorizada (CFD simplificado).
         - Añade emisiones de vehículos como fuentes puntuales.
         - Aplica difusión y advección física explícita.
-        - Preparado para 3D (z_layers>1).
+        - Con z_layers>1 usa la pila de capas pollution_grid_3d [L, ny, nx] (alturas de
+          layer_heights_for) con transporte horizontal por capa e intercambio vertical Kz.
         - Permite campos de viento variables (wind_field).
         """
         grid_res = self.config['grid_resolution']
         if z_layers > 1:
-            if not hasattr(self, 'pollution_grid_3d'):
-                self.pollution_grid_3d = np.zeros((grid_res, grid_res, z_layers))
+            if getattr(self, 'pollution_grid_3d', None) is None or self.pollution_grid_3d.shape[0] != z_layers:
+                self.pollution_grid_3d = np.zeros((z_layers, grid_res, grid_res))
             grid = self.pollution_grid_3d
+            # Cada capa es una vista contigua: los núcleos la modifican sin copias
+            layers = list(grid)
         else:
             grid = self.pollution_grid
+            layers = [grid]
 
-        # 1. Añadir emisiones de vehículos
+        # 1. Añadir emisiones de vehículos (en la capa más baja)
         vehicles = traci.vehicle.getIDList()
         for veh in vehicles:
             x, y = traci.vehicle.getPosition(veh)
@@ -407,103 +648,440 @@ class CS:
             # Mapear a celda
             i = int((y - self.y_min) / (self.y_max - self.y_min) * grid_res)
             j = int((x - self.x_min) / (self.x_max - self.x_min) * grid_res)
-            if 0 <= i < grid_res and 0 <= j < grid_res:
-                if z_layers > 1:
-                    grid[i, j, 0] += emission * dt  # fuente en la capa más baja
-                else:
-                    grid[i, j] += emission * dt
+            if 0 <= i < grid_res and 0 <= j < grid_res and not self.is_obstacle(i, j):
+                layers[0][i, j] += emission * dt
 
-        # 2. Difusión (Laplaciano)
-        if z_layers > 1:
-            for z in range(z_layers):
-                grid[:, :, z] += diffusion_coeff * scipy.ndimage.laplace(grid[:, :, z]) * dt
-        else:
-            grid += diffusion_coeff * scipy.ndimage.laplace(grid) * dt
+        # 2. Difusión (Laplaciano, D en m²/s)
+        for layer in layers:
+            self.diffuse(layer, diffusion_coeff, dt)
 
         # 3. Advección (viento)
-        if wind_field is None:
-            # Viento uniforme
-            vx = self.wind_speed * np.cos(self.wind_direction)
-            vy = self.wind_speed * np.sin(self.wind_direction)
-            if z_layers > 1:
-                for z in range(z_layers):
-                    grid[:, :, z] = np.roll(grid[:, :, z], int(vy * dt), axis=0)
-                    grid[:, :, z] = np.roll(grid[:, :, z], int(vx * dt), axis=1)
+        for layer in layers:
+            if wind_field is None:
+                # Viento uniforme: advección conservativa en forma de flujo (sub-celda, salida libre)
+                self.advect_uniform(layer, dt)
             else:
-                # CORRECCIÓN: np.roll devuelve una copia, hay que asignar el resultado a self.pollution_grid
-                grid[...] = np.roll(grid, int(vy * dt), axis=0)
-                grid[...] = np.roll(grid, int(vx * dt), axis=1)
-        else:
-            # Campo de viento variable (no implementado en detalle aquí)
-            pass
+                # Campo de viento variable: retroceso semi-lagrangiano
+                self.advect_wind_field(layer, wind_field, dt)
 
-        # 4. Decaimiento natural
-        grid *= 0.995
+        # 4. Intercambio vertical entre capas
+        if z_layers > 1:
+            self.vertical_exchange(grid, self.layer_heights_for(z_layers), dt)
+
+        # 5. Eliminación física (deposición, lavado y sedimentación de la especie principal)
+        self.decay_grid(grid, self.removal.keep(dt)[0])
         if z_layers > 1:
             self.pollution_grid_3d = grid
         else:
             self.pollution_grid = grid
 
-    def update_pollution_vectorized_multi(self, dt=1.0, diffusion_coeff=2.0, wind_field=None, diffusion_field=None, use_c_module=True):
+    def layer_heights_for(self, z_layers: int) -> np.ndarray:
+        """
+        Alturas de los centros de capa (m): config['layer_heights'] si tiene z_layers valores
+        o capas uniformes de config['layer_thickness'] (3 m, una planta) desde el suelo.
+        """
+        heights = self.config.get('layer_heights')
+        if heights is not None and len(heights) == z_layers:
+            return np.asarray(heights, dtype=np.float64)
+        return layer_heights(z_layers, float(self.config.get('layer_thickness', 3.0)))
+
+    def vertical_exchange(self, grids: np.ndarray, heights: np.ndarray, dt: float, use_c_module: bool = True):
+        """
+        Difusión turbulenta entre las capas de grids [L, ny, nx] (in situ) con
+        config['vertical_diffusivity'] (m²/s) o el valor típico de la clase de estabilidad.
+        """
+        kz = self.config.get('vertical_diffusivity')
+        kz = vertical_diffusivity(self.stability_class, self.wind_speed) if kz is None else float(kz)
+        heights = np.ascontiguousarray(heights, dtype=np.float64)
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'vertical_exchange') \
+                and grids.dtype == np.float64 and grids.flags.c_contiguous:
+            cs_module.vertical_exchange(grids, heights, kz, dt)
+        else:
+            vertical_exchange_py(grids, heights, kz, dt)
+
+    def plume_layers(self, heights: Sequence[float], species: Optional[str] = None,
+                     use_c_module: bool = True) -> np.ndarray:
+        """
+        Concentración gaussiana de los vehículos activos a varias alturas de receptor
+        (exposición en fachadas y balcones) en una sola pasada por celda.
+
+        Args:
+            heights: Alturas de receptor en m (0 = suelo, igual que update_pollution)
+            species: Especie cuya emisión se usa (por defecto la primera)
+            use_c_module: Usar el núcleo C si está disponible
+
+        Returns:
+            Array [L, ny, nx] con la concentración a cada altura
+        """
+        heights = np.ascontiguousarray(heights, dtype=np.float64)
+        grid_res = self.config['grid_resolution']
+        grids = np.zeros((len(heights), grid_res, grid_res))
+        positions, rates, speed = self.vehicle_emissions(with_speed=True)
+        if not len(positions):
+            return grids
+        s = 0 if species is None else self.species_list.index(species)
+        # Altura efectiva de emisión de cada vehículo: la misma que en update (plume_rises)
+        sources = np.column_stack((positions, rates[:, s], plume_rises(speed)))
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'update_pollution_layers'):
+            cs_module.update_pollution_layers(grids, sources, heights, self.wind_speed, self.wind_direction,
+                                              self.stability_class, self.x_min, self.x_max,
+                                              self.y_min, self.y_max, self.obstacles)
+        else:
+            gaussian_layers_py(grids, sources, heights, self.wind_speed, self.wind_direction, self.stability_class,
+                               (self.x_min, self.x_max, self.y_min, self.y_max), self.obstacle_mask)
+        return grids
+
+    def cell_size(self) -> Tuple[float, float]:
+        """Ancho y alto de celda de la malla en metros."""
+        grid_res = self.config['grid_resolution']
+        return (self.x_max - self.x_min) / grid_res, (self.y_max - self.y_min) / grid_res
+
+    def vehicle_emissions(self, with_speed: bool = False) -> Tuple[np.ndarray, ...]:
+        """
+        Posiciones [n, 2] (m) y emisión [n, S] de cada especie de los vehículos activos. Con
+        la fuente 'sumo' se usan las emisiones de SUMO; con tablas de emisión se interpola por
+        clase, velocidad y aceleración; sin ninguna, todas las especies reciben la tasa única
+        de calculate_emission_rate. Con with_speed se añade la velocidad [n] (m/s).
+        """
+        if self.sumo_emissions is not None:
+            return self.sumo_emissions.collect(traci, with_speed)
+        vehicles = traci.vehicle.getIDList()
+        n_species = len(self.species_list)
+        if not vehicles:
+            empty = np.zeros((0, 2)), np.zeros((0, n_species))
+            return empty + (np.zeros(0),) if with_speed else empty
+        positions = np.array([traci.vehicle.getPosition(veh) for veh in vehicles], dtype=np.float64)
+        speed = np.array([traci.vehicle.getSpeed(veh) for veh in vehicles], dtype=np.float64)
+        if self.emission_model is None:
+            rates = 0.1 * np.where(speed > 20, 1 + 0.05 * (speed - 20), 1.0) * self.emission_factor
+            rates = np.repeat(rates[:, None], n_species, axis=1)
+        else:
+            accel = np.array([traci.vehicle.getAcceleration(veh) for veh in vehicles], dtype=np.float64)
+            rates = self.emission_model.rates(vehicles, speed, accel, traci.vehicle.getVehicleClass)
+        return (positions, rates, speed) if with_speed else (positions, rates)
+
+    def species_stack(self) -> np.ndarray:
+        """
+        Array [S, ny, nx] del que son vistas las mallas de especies. Si alguna malla se ha
+        sustituido por otro array, se reconstruye la pila y se vuelven a enlazar las vistas.
+        """
+        stack = self.species_grids
+        if not all(self.pollution_grids.get(sp) is not None and self.pollution_grids[sp].base is stack
+                   and np.may_share_memory(self.pollution_grids[sp], stack[s])
+                   for s, sp in enumerate(self.species_list)):
+            stack = self.species_grids = np.stack([self.pollution_grids[sp] for sp in self.species_list])
+            self.pollution_grids.update({sp: stack[s] for s, sp in enumerate(self.species_list)})
+            # Contenido nuevo: ninguna tesela se puede dar por muerta
+            self.tiles[...] = 1
+        return stack
+
+    def deposit_emissions(self, positions: np.ndarray, rates: np.ndarray, dt: float, use_c_module: bool = True,
+                          grids: Optional[np.ndarray] = None):
+        """
+        Suma rates * dt en la celda de cada vehículo de todas las mallas de especies (sin
+        edificios), o de la pila grids [S, ny, nx] indicada.
+        """
+        if not len(positions):
+            return
+        x = np.ascontiguousarray(positions[:, 0])
+        y = np.ascontiguousarray(positions[:, 1])
+        if grids is None:
+            grids = self.species_stack()
+            mark_points(self.tiles, x, y, (self.x_min, self.x_max, self.y_min, self.y_max), grids.shape)
+        rates = np.ascontiguousarray(rates, dtype=np.float64)
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'deposit_point_sources'):
+            cs_module.deposit_point_sources(grids, x, y, rates, dt, self.x_min, self.x_max,
+                                            self.y_min, self.y_max, self.obstacles)
+        else:
+            deposit_point_sources(grids, x, y, rates, dt, (self.x_min, self.x_max, self.y_min, self.y_max),
+                                  self.obstacle_mask)
+
+    def is_obstacle(self, i: int, j: int) -> bool:
+        """True si la celda (i, j) está dentro de un edificio."""
+        return self.obstacle_mask is not None and bool(self.obstacle_mask[i, j])
+
+    def diffuse(self, grid: np.ndarray, diffusion_coeff: float, dt: float,
+                diffusion_field: Optional[np.ndarray] = None, use_c_module: bool = True,
+                tiles: Optional[np.ndarray] = None):
+        """
+        Difusión explícita in situ de una malla 2D (D en m²/s, flujo nulo en los bordes y en
+        las fachadas de los edificios). Con coeficiente uniforme usa el núcleo C si está
+        disponible, que con tiles (teselas vivas, ver dead_tiles) salta las zonas a cero.
+        """
+        cell_width, cell_height = self.cell_size()
+        if diffusion_field is None and use_c_module and 'cs_module' in sys.modules \
+                and hasattr(cs_module, 'diffuse_grid'):
+            cs_module.diffuse_grid(grid, diffusion_coeff, dt, cell_width, cell_height, self.obstacles, tiles)
+        else:
+            coeff = diffusion_coeff if diffusion_field is None else diffusion_field
+            grid[...] = diffuse_explicit(grid, coeff, dt, cell_width, cell_height, self.obstacle_mask)
+
+    def advect_uniform(self, grid: np.ndarray, dt: float, use_c_module: bool = True) -> int:
+        """
+        Advecciona una malla 2D in situ con el viento uniforme configurado.
+
+        Esquema conservativo en forma de flujo (upwind de 2º orden con limitador de van Leer)
+        con frontera de salida libre; el núcleo C subdivide el paso si el número de
+        Courant supera 1 y la versión NumPy hace lo mismo.
+
+        Returns:
+            Número de subpasos empleados
+        """
+        cell_width, cell_height = self.cell_size()
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'advect_grid'):
+            return cs_module.advect_grid(grid, self.wind_speed, self.wind_direction, dt, cell_width, cell_height,
+                                         self.obstacles)
+        result, substeps = advect_flux_form(grid, self.wind_speed, self.wind_direction, dt,
+                                            cell_width, cell_height, self.obstacle_mask)
+        grid[...] = result
+        return substeps
+
+    def advect_wind_field(self, grid: np.ndarray, wind_field: np.ndarray, dt: float,
+                          conservative: bool = False, use_c_module: bool = True):
+        """
+        Advecciona una malla 2D in situ con un campo de viento espacialmente variable.
+
+        Usa el núcleo C (retroceso semi-lagrangiano bilineal, paralelizado con OpenMP) si
+        está disponible y, si no, la versión NumPy equivalente. Las velocidades están en m/s
+        y se convierten a celdas por paso con el tamaño de celda del dominio.
+
+        Args:
+            grid: Malla [ny, nx] (float64, C-contigua)
+            wind_field: Campo de viento [ny, nx, 2] con (vx, vy) en m/s
+            dt: Paso temporal en segundos
+            conservative: Variante directa que conserva la masa (salvo la que sale del dominio)
+            use_c_module: Si False, fuerza la versión NumPy
+        """
+        cell_width, cell_height = self.cell_size()
+        wind_field = np.ascontiguousarray(wind_field, dtype=np.float64)
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'advect_wind_field'):
+            cs_module.advect_wind_field(grid, wind_field, dt, cell_width, cell_height, int(conservative),
+                                        self.obstacles)
+        else:
+            grid[...] = advect_semi_lagrangian(grid, wind_field, dt, cell_width, cell_height, conservative,
+                                               self.obstacle_mask)
+
+    def update_pollution_vectorized_multi(self, dt=1.0, diffusion_coeff=2.0, wind_field=None, diffusion_field=None,
+                                          use_c_module=True, time_stepper=None):
         """
         Actualiza todas las mallas de especies usando advección-difusión vectorizada y C puro si está disponible.
         Permite campos de viento y difusión variables (hooks para meteorología avanzada).
         Args:
-            dt (float): Paso temporal de integración.
-            diffusion_coeff (float): Coeficiente de difusión global.
+            dt (float): Paso temporal de integración (duración del paso de SUMO, s).
+            diffusion_coeff (float): Coeficiente de difusión global (m²/s).
             wind_field (np.ndarray): Campo de viento espacialmente variable (opcional).
             diffusion_field (np.ndarray): Campo de difusión espacialmente variable (opcional).
             use_c_module (bool): Si True, fuerza el uso del módulo C para máxima velocidad.
+            time_stepper (AdaptiveTimeStepper): Si se indica, el transporte se subdivide en el
+                mayor subpaso estable (CFL y número de difusión) y las mallas en reposo no se transportan.
+        Returns:
+            TransportPlan usado en este paso (o None sin controlador)
         """
-        grid_res = self.config['grid_resolution']
-        vehicles = traci.vehicle.getIDList()
+        plan = None
+        if time_stepper is not None:
+            cell_width, cell_height = self.cell_size()
+            max_u, max_v = max_wind_components(self.wind_speed, self.wind_direction, wind_field)
+            max_d = float(np.max(diffusion_field)) if diffusion_field is not None else diffusion_coeff
+            plan = time_stepper.plan(dt, max_u, max_v, max_d, cell_width, cell_height)
+        # 1. Añadir emisiones de vehículos (todas las especies en una pasada)
+        positions, rates = self.vehicle_emissions()
+        self.deposit_emissions(positions, rates, dt, use_c_module=use_c_module)
+        # Teselas vivas tras las emisiones; el transporte de cada especie las dilata según las
+        # celdas que puede avanzar la masa y la eliminación final marca las que quedan a cero
+        self.species_stack()
+        emitted = self.tiles.copy()
         for species in self.species_list:
             grid = self.pollution_grids[species]
-            # 1. Añadir emisiones de vehículos (puedes personalizar por especie)
-            for veh in vehicles:
-                x, y = traci.vehicle.getPosition(veh)
-                speed = traci.vehicle.getSpeed(veh)
-                emission = self.calculate_emission_rate(speed)  # Personaliza por especie si lo deseas
-                i = int((y - self.y_min) / (self.y_max - self.y_min) * grid_res)
-                j = int((x - self.x_min) / (self.x_max - self.x_min) * grid_res)
-                if 0 <= i < grid_res and 0 <= j < grid_res:
-                    grid[i, j] += emission * dt
-            # 2. Difusión
-            if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'diffuse_grid'):
-                # Difusión ultra-rápida en C
-                cs_module.diffuse_grid(grid, diffusion_coeff, dt)
-            elif diffusion_field is not None:
-                # Difusión espacialmente variable (hook para futuro)
-                grid += diffusion_field * scipy.ndimage.laplace(grid) * dt
+            tiles = emitted.copy()
+            # 2-3. Transporte (difusión + advección), subdividido según el controlador
+            if plan is None:
+                substeps, sub_dt, advect, diffuse = 1, dt, True, True
+            elif time_stepper.is_quiescent(grid):
+                substeps, sub_dt, advect, diffuse = 0, dt, False, False
             else:
-                grid += diffusion_coeff * scipy.ndimage.laplace(grid) * dt
-            # 3. Advección
-            if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'advect_grid'):
-                # Advección ultra-rápida en C
-                cs_module.advect_grid(grid, self.wind_speed, self.wind_direction, dt)
-            elif wind_field is not None:
-                # Advección espacialmente variable (hook para futuro)
-                for i in range(grid_res):
-                    for j in range(grid_res):
-                        vx, vy = wind_field[i, j]
-                        ii = (i + int(vy * dt)) % grid_res
-                        jj = (j + int(vx * dt)) % grid_res
-                        grid[ii, jj] += grid[i, j] * 0.01  # Pequeña fracción advectada
-            else:
-                vx = self.wind_speed * np.cos(self.wind_direction)
-                vy = self.wind_speed * np.sin(self.wind_direction)
-                grid[...] = np.roll(grid, int(vy * dt), axis=0)
-                grid[...] = np.roll(grid, int(vx * dt), axis=1)
-            # 4. Decaimiento
-            grid *= 0.995
+                substeps, sub_dt, advect, diffuse = plan.substeps, plan.sub_dt, plan.advect, plan.diffuse
+            for _ in range(substeps):
+                if diffuse:
+                    self.diffuse(grid, diffusion_coeff, sub_dt, diffusion_field, use_c_module=use_c_module,
+                                 tiles=tiles)
+                    dilate(tiles, reach(self.diffusion_cells(diffusion_coeff, diffusion_field, sub_dt)))
+                if not advect:
+                    continue
+                if wind_field is not None:
+                    # Advección espacialmente variable (retroceso semi-lagrangiano)
+                    self.advect_wind_field(grid, wind_field, sub_dt, use_c_module=use_c_module)
+                else:
+                    # Viento uniforme: advección conservativa en forma de flujo (C si está disponible)
+                    self.advect_uniform(grid, sub_dt, use_c_module=use_c_module)
+                dilate(tiles, reach(self.advection_cells(wind_field, sub_dt)))
             self.pollution_grids[species] = grid
+            self.tiles |= tiles
+        # 4-5. Química por celda (separada del transporte) y eliminación física en la misma pasada,
+        # con el umbral de valores y los indicadores de teselas
+        self.removal.apply(self.species_stack(), dt, self.chemistry, use_c_module=use_c_module,
+                           floor=self.value_floor, tiles=self.tiles)
+        return plan
+
+    def diffusion_cells(self, diffusion_coeff: float, diffusion_field: Optional[np.ndarray], dt: float) -> int:
+        """Celdas que avanza la difusión explícita en dt (un subpaso estable por celda)."""
+        cell_width, cell_height = self.cell_size()
+        d = float(np.max(diffusion_field)) if diffusion_field is not None else diffusion_coeff
+        return max(1, math.ceil(2.0 * d * dt * (1.0 / cell_width ** 2 + 1.0 / cell_height ** 2)))
+
+    def advection_cells(self, wind_field: Optional[np.ndarray], dt: float) -> int:
+        """Celdas que avanza la advección en dt, más la que añade la interpolación."""
+        cell_width, cell_height = self.cell_size()
+        max_u, max_v = max_wind_components(self.wind_speed, self.wind_direction, wind_field)
+        return math.ceil(max(abs(max_u) * dt / cell_width, abs(max_v) * dt / cell_height)) + 1
+
+    def decay_grid(self, grid: np.ndarray, keep: float, use_c_module: bool = True):
+        """Multiplica una malla (2D o pila de capas) por keep in situ con el umbral de valores."""
+        grids = grid.reshape((-1,) + grid.shape[-2:])
+        keep = np.full(len(grids), keep)
+        if use_c_module and 'cs_module' in sys.modules and hasattr(cs_module, 'decay_grids') \
+                and grids.flags.c_contiguous and np.shares_memory(grids, grid):
+            cs_module.decay_grids(grids, keep, self.value_floor)
+        else:
+            decay_py(grids, keep, self.value_floor)
+            if not np.shares_memory(grids, grid):
+                grid[...] = grids.reshape(grid.shape)
+
+    def fast_forward(self, n_steps: int, dt: float = 1.0, diffusion_coeff: float = 2.0, transport: bool = True,
+                     use_c_module: bool = True) -> str:
+        """
+        Avanza la pila de especies n_steps pasos de dt en forma cerrada manteniendo fijo el
+        tráfico actual (las mismas emisiones en cada paso, o ninguna), para periodos tranquilos
+        en los que pasos completos no aportan nada.
+
+        Sin transporte equivale a n_steps llamadas a update_pollution_vectorized_multi sin
+        viento ni difusión (serie geométrica exacta). Con transporte integra de forma
+        exponencial la difusión y el viento uniforme configurados (ver fast_forward.py); la
+        frontera es abierta y la solución es la del problema continuo, no la del esquema
+        explícito. La química no es lineal y los edificios impiden la diagonalización
+        espectral: en esos casos se avanza paso a paso.
+
+        Returns:
+            Método empleado: 'geometric', 'spectral' o 'stepped'
+        """
+        if n_steps <= 0:
+            return 'geometric'
+        positions, rates = self.vehicle_emissions()
+        stack = self.species_stack()
+        if self.chemistry is not None or (transport and self.obstacle_mask is not None):
+            for _ in range(n_steps):
+                if transport:
+                    self.update_pollution_vectorized_multi(dt, diffusion_coeff, use_c_module=use_c_module)
+                    continue
+                self.deposit_emissions(positions, rates, dt, use_c_module=use_c_module)
+                self.removal.apply(self.species_stack(), dt, self.chemistry, use_c_module=use_c_module,
+                                   floor=self.value_floor, tiles=self.tiles)
+            return 'stepped'
+        sources = np.zeros_like(stack)
+        if transport:
+            # Emisión por segundo; la eliminación es continua con la tasa del operador
+            self.deposit_emissions(positions, rates, 1.0, use_c_module=use_c_module, grids=sources)
+            cell_width, cell_height = self.cell_size()
+            stack[...] = spectral_advance(stack, sources, self.removal.rate, n_steps * dt, diffusion_coeff,
+                                          self.wind_speed * math.cos(self.wind_direction),
+                                          self.wind_speed * math.sin(self.wind_direction),
+                                          cell_width, cell_height)
+            method = 'spectral'
+        else:
+            self.deposit_emissions(positions, rates, dt, use_c_module=use_c_module, grids=sources)
+            geometric_advance(stack, self.removal.keep(dt), sources, n_steps)
+            method = 'geometric'
+        snap_floor(stack, self.value_floor)
+        self.tiles[...] = live_tiles(stack)
+        return method
+
+    def fast_forward_gaussian(self, n_steps: int, dt: float = 1.0):
+        """
+        Equivale a n_steps llamadas a update(dt=dt) con el tráfico actual fijo: la malla decae
+        keep(dt)^N y la huella de la pluma gaussiana de un paso se suma como serie geométrica.
+        """
+        if n_steps <= 0:
+            return
+        grid = self.pollution_grid
+        self.pollution_grid = np.zeros_like(grid)
+        try:
+            self.update(dt=dt)
+            footprint = self.pollution_grid
+        finally:
+            self.pollution_grid = grid
+        decay = self.removal.keep(dt)[:1]
+        geometric_advance(grid[None], decay, footprint[None], n_steps, decay_first=True)
+        snap_floor(grid, self.value_floor)
+
+    def update_puffs(self, dt=1.0, wind_field=None, decay=None):
+        """
+        Avanza un paso el motor lagrangiano: cada vehículo emite una bocanada con la masa de
+        cada especie, las bocanadas se desplazan, se descartan las que salen del dominio y,
+        si hay demasiadas, se fusionan las antiguas. La malla no se toca (ver rasterize_puffs).
+        La masa pierde lo que elimina la deposición del paso (o el factor decay si se indica).
+
+        Returns:
+            Número de bocanadas activas
+        """
+        pool = self.puff_pool
+        positions, rates = self.vehicle_emissions()
+        if len(positions):
+            pool.emit(positions[:, 0], positions[:, 1], rates * dt)
+        pool.advect(dt, self.wind_speed, self.wind_direction, wind_field)
+        pool.decay(self.removal.keep(dt) if decay is None else decay)
+        pool.cull()
+        pool.merge()
+        self.puff_step += 1
+        return pool.count
+
+    def lazy_field(self) -> LazyPuffField:
+        """Campo de bocanadas del paso actual para evaluar receptores o teselas bajo demanda."""
+        if self.puff_field.step != self.puff_step:
+            self.puff_field.update_from_pool(self.puff_pool, self.puff_step)
+        return self.puff_field
+
+    def sample_receptors(self, xs, ys) -> Dict[str, np.ndarray]:
+        """
+        Concentración de cada especie en los receptores (xs, ys) [m]. Con el motor de
+        bocanadas se evalúa directamente en los puntos; con el euleriano se lee la celda.
+        """
+        if self.puff_pool is not None:
+            return self.lazy_field().sample(xs, ys)
+        ny, nx = self.pollution_grid.shape
+        j = np.clip(((np.atleast_1d(xs) - self.x_min) / (self.x_max - self.x_min) * nx).astype(int), 0, nx - 1)
+        i = np.clip(((np.atleast_1d(ys) - self.y_min) / (self.y_max - self.y_min) * ny).astype(int), 0, ny - 1)
+        return {sp: grid[i, j] for sp, grid in self.pollution_grids.items()}
+
+    def rasterize_puffs(self):
+        """Rasteriza las bocanadas sobre las mallas de especies (solo cuando se necesitan)."""
+        grid_res = self.config['grid_resolution']
+        self.pollution_grids.update(self.puff_pool.rasterize((grid_res, grid_res)))
+        self.pollution_grid = self.pollution_grids[self.species_list[0]]
+
+    def update_canyon_sources(self):
+        """Emisión lineal de cada tramo de cañón a partir de los vehículos que circulan por él."""
+        positions, rates = self.vehicle_emissions()
+        if not len(positions):
+            self.canyon_sources = np.zeros((len(self.canyon_index.length), len(self.species_list)))
+            return
+        self.canyon_sources = self.canyon_index.line_sources(positions[:, 0], positions[:, 1], rates)
+
+    def sample_canyons(self, xs, ys) -> Dict[str, np.ndarray]:
+        """
+        Incremento de concentración de calle (OSPM) de cada especie en los receptores; 0 en
+        los que no están en un cañón.
+        """
+        if self.canyon_index is None or self.canyon_sources is None:
+            return {sp: np.zeros(len(np.atleast_1d(xs))) for sp in self.species_list}
+        values = self.canyon_index.concentration(xs, ys, self.canyon_sources, self.wind_speed,
+                                                 self.wind_direction, float(self.config.get('traffic_turbulence', 0.25)))
+        return {sp: values[:, s] for s, sp in enumerate(self.species_list)}
 
     def export_to_vtk(self, filename='pollution_grid.vtk', z_layers=1):
         """
         Exporta la malla de contaminación a formato VTK para visualización 3D (Paraview, Blender).
         """
         grid_res = self.config['grid_resolution']
-        if z_layers > 1 and hasattr(self, 'pollution_grid_3d'):
+        if z_layers > 1 and getattr(self, 'pollution_grid_3d', None) is not None:
             grid = self.pollution_grid_3d
         else:
             grid = self.pollution_grid
@@ -522,7 +1100,7 @@ class CS:
                 for z in range(z_layers):
                     for i in range(grid_res):
                         for j in range(grid_res):
-                            f.write(f'{grid[i,j,z]:.6e}\n')
+                            f.write(f'{grid[z,i,j]:.6e}\n')
             else:
                 for i in range(grid_res):
                     for j in range(grid_res):
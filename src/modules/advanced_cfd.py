@@ -77,6 +77,9 @@ from typing import Dict, Tuple, List, Optional, Any
 import numba
 from numba import jit
 import warnings
+
+from modules.chemistry import ChemistryOperator
+
 warnings.filterwarnings('ignore')
 
 
@@ -240,6 +243,11 @@ class AdvancedCFD:
         self.concentrations = {}
         for species in self.species_list:
             self.concentrations[species] = np.zeros((self.nx, self.ny, self.nz))
+        # Operador de química NO/NO2/O3 y aerosol secundario (config['chemistry'])
+        self.chemistry = None
+        if config.get('chemistry'):
+            self.chemistry = ChemistryOperator(self.species_list, 1.0,
+                                               background=config.get('chemistry_background'))
         
         # Propiedades físicas
         self.rho = 1.225  # Densidad del aire (kg/m³)
@@ -545,8 +553,8 @@ class AdvancedCFD:
                     emission_per_volume = source['emission_rate'][species] / cell_volume
                     C_new[i, j, k] += self.dt * emission_per_volume
             
-            # Aplicar reacciones químicas simples
-            if species == 'NOx':
+            # Aplicar reacciones químicas simples (sin operador de química)
+            if self.chemistry is None and species == 'NOx':
                 # Fotólisis simple: NOx -> NO2 + O
                 decay_rate = 1e-5  # 1/s
                 C_new *= (1 - decay_rate * self.dt)
@@ -556,6 +564,13 @@ class AdvancedCFD:
             C_new[-1, :, :] = C_new[-2, :, :]  # Gradiente cero en salida
             
             self.concentrations[species] = C_new
+
+        # Química por celda separada del transporte (concentraciones en g/m³: volumen unidad)
+        if self.chemistry is not None:
+            stack = np.stack([self.concentrations[sp] for sp in self.species_list])
+            self.chemistry.step(stack.reshape(len(self.species_list), -1, self.nz), self.dt)
+            for s, species in enumerate(self.species_list):
+                self.concentrations[species] = stack[s]
     
     def time_step(self):
         """
@@ -0,0 +1,156 @@
+"""
+Módulo de Química Atmosférica por Celda (separada del transporte)
+
+Operador de química para las mallas multiespecie, aplicado después del transporte en cada
+paso (operator splitting):
+    - Equilibrio fotoestacionario NO/NO2/O3 (NO2 + hv -> NO + O3, NO + O3 -> NO2), resuelto
+      con Euler implícito en forma cerrada (cuadrática por celda), estable con cualquier dt
+    - Aerosol secundario de primer orden: NO2 (o NOx) -> nitrato y SO2 -> sulfato, que se
+      suman a las especies de partículas presentes (PM2.5, PM10...)
+
+Las mallas guardan masa por celda (g) en exceso sobre el fondo; para la cinética se pasan a
+ppb con el volumen de celda (área * altura de mezcla) y la masa molar, y se suma el fondo
+(típicamente O3 regional). El núcleo C chemistry_step recorre las celdas en paralelo con el
+mismo número de operaciones para cualquier valor; chemistry_py es la versión NumPy equivalente.
+"""
+
+import os
+import sys
+from typing import Dict, Optional, Sequence
+
+import numpy as np
+
+from modules.dead_tiles import decay_py
+
+module_path = os.path.dirname(__file__)
+if module_path not in sys.path:
+    sys.path.append(module_path)
+try:
+    import cs_module
+except ImportError:
+    cs_module = None
+
+# Masas molares (g/mol); NOx se expresa como NO2
+MOLAR_MASS = {'NO': 30.0, 'NO2': 46.0, 'NOX': 46.0, 'O3': 48.0, 'SO2': 64.0}
+PM_SPECIES = ('PM', 'PMX', 'PM2.5', 'PM25', 'PM10')
+MOLAR_VOLUME_PPB = 24.45  # µg/m³ -> ppb: ppb = µg/m³ * 24.45 / M (25 °C, 1 atm)
+
+# Constantes cinéticas de referencia
+J_NO2 = 8e-3        # Fotólisis del NO2 a mediodía (1/s)
+K_NO_O3 = 4.4e-4    # NO + O3 (1/(ppb s)), 1.8e-14 cm³/(molécula s) a 298 K
+K_NITRATE = 1e-5    # NO2 -> nitrato (1/s), ~3.6 %/h
+K_SULFATE = 3e-6    # SO2 -> sulfato (1/s), ~1 %/h
+
+
+def chemistry_py(grids: np.ndarray, roles, pm, scale, background, dt: float, j_no2: float,
+                 k_no_o3: float, k_nitrate: float, k_sulfate: float, keep: Optional[np.ndarray] = None):
+    """
+    Versión NumPy de chemistry_step en cs_module.c (modifica grids [S, ny, nx] in situ). keep
+    es la fracción de cada especie que sobrevive a la deposición del paso (o None).
+    """
+    ino, ino2, io3, init, iso2 = (int(r) for r in roles)
+    if ino >= 0 and ino2 >= 0 and io3 >= 0:
+        no = np.maximum(background[ino] + grids[ino] * scale[ino], 0.0)
+        no2 = np.maximum(background[ino2] + grids[ino2] * scale[ino2], 0.0)
+        o3 = np.maximum(background[io3] + grids[io3] * scale[io3], 0.0)
+        nox, ox = no + no2, o3 + no2
+        a = dt * k_no_o3
+        b = 1.0 + dt * j_no2 + a * (nox + ox)
+        c = no2 + a * nox * ox
+        x = 2.0 * c / (b + np.sqrt(np.maximum(b * b - 4.0 * a * c, 0.0)))
+        grids[ino] = (nox - x - background[ino]) / scale[ino]
+        grids[ino2] = (x - background[ino2]) / scale[ino2]
+        grids[io3] = (ox - x - background[io3]) / scale[io3]
+    formed = 0.0
+    for index, rate, yield_ in ((init, k_nitrate, 62.0 / 46.0), (iso2, k_sulfate, 96.0 / 64.0)):
+        if index >= 0:
+            lost = np.maximum(grids[index], 0.0) * (1.0 - 1.0 / (1.0 + dt * rate))
+            grids[index] -= lost
+            formed = formed + lost * yield_
+    for index in pm:
+        grids[index] += formed
+    if keep is not None:
+        grids *= np.asarray(keep).reshape((-1,) + (1,) * (grids.ndim - 1))
+
+
+class ChemistryOperator:
+    """
+    Química por celda para un conjunto fijo de especies.
+
+    Args:
+        species_list: Especies de las mallas (orden de la pila [S, ny, nx])
+        cell_volume: Volumen representado por una celda (m³), área * altura de mezcla
+        background: Concentración de fondo en ppb por especie (por defecto O3 = 35 ppb)
+        j_no2: Frecuencia de fotólisis del NO2 (1/s); 0 de noche
+        k_no_o3: Constante de NO + O3 (1/(ppb s))
+        k_nitrate, k_sulfate: Conversión a aerosol secundario (1/s)
+    """
+
+    def __init__(self, species_list: Sequence[str], cell_volume: float,
+                 background: Optional[Dict[str, float]] = None, j_no2: float = J_NO2,
+                 k_no_o3: float = K_NO_O3, k_nitrate: float = K_NITRATE, k_sulfate: float = K_SULFATE):
+        self.species_list = list(species_list)
+        self.j_no2, self.k_no_o3 = float(j_no2), float(k_no_o3)
+        self.k_nitrate, self.k_sulfate = float(k_nitrate), float(k_sulfate)
+        names = [sp.upper() for sp in self.species_list]
+        index = {name: s for s, name in enumerate(names)}
+        nitrate = index.get('NO2', index.get('NOX', -1))
+        self.roles = np.array([index.get('NO', -1), index.get('NO2', -1), index.get('O3', -1),
+                               nitrate, index.get('SO2', -1)], dtype=np.int32)
+        self.pm = np.array([s for s, name in enumerate(names) if name in PM_SPECIES], dtype=np.int32)
+        # ppb por gramo en la celda
+        self.scale = np.array([1e6 / cell_volume * MOLAR_VOLUME_PPB / MOLAR_MASS.get(name, 1.0)
+                               for name in names])
+        background = {'O3': 35.0} if background is None else background
+        background = {name.upper(): float(value) for name, value in background.items()}
+        self.background = np.array([background.get(name, 0.0) for name in names])
+        self._zero_steady = None
+
+    @property
+    def active(self) -> bool:
+        """True si hay alguna reacción que aplicar con estas especies."""
+        photo = (self.roles[:3] >= 0).all()
+        secondary = (self.roles[3:] >= 0).any() and (self.k_nitrate > 0 or self.k_sulfate > 0)
+        return bool(photo or secondary)
+
+    @property
+    def zero_steady(self) -> bool:
+        """True si una celda sin exceso sigue sin exceso (fondo en equilibrio fotoestacionario)."""
+        if self._zero_steady is None:
+            cell = np.zeros((len(self.species_list), 1, 1))
+            chemistry_py(cell, self.roles, self.pm, self.scale, self.background, 3600.0, self.j_no2,
+                         self.k_no_o3, self.k_nitrate, self.k_sulfate)
+            self._zero_steady = not np.any(cell)
+        return self._zero_steady
+
+    def step(self, grids: np.ndarray, dt: float, use_c_module: bool = True, keep: Optional[np.ndarray] = None,
+             floor: float = 0.0, tiles: Optional[np.ndarray] = None):
+        """
+        Aplica un paso dt de química a la pila de mallas [S, ny, nx] (in situ). Con keep [S]
+        aplica también la eliminación por deposición en la misma pasada; los valores menores
+        que floor pasan a cero exacto y tiles (ver dead_tiles) se actualiza con las teselas
+        que quedan a cero.
+        """
+        if tiles is not None and not self.zero_steady:
+            # Con un fondo fuera de equilibrio las celdas sin exceso también reaccionan
+            tiles[...] = 1
+        if not self.active:
+            if keep is not None or floor > 0.0 or tiles is not None:
+                decay_py(grids, np.ones(len(self.species_list)) if keep is None else keep, floor, tiles)
+            return
+        if keep is not None:
+            keep = np.ascontiguousarray(keep, dtype=np.float64)
+        args = (self.roles, self.pm, self.scale, self.background, float(dt), self.j_no2, self.k_no_o3,
+                self.k_nitrate, self.k_sulfate, keep)
+        if use_c_module and cs_module is not None and hasattr(cs_module, 'chemistry_step') \
+                and grids.dtype == np.float64 and grids.flags.c_contiguous and grids.ndim == 3:
+            cs_module.chemistry_step(grids, *args, floor, tiles)
+        else:
+            chemistry_py(grids, *args)
+            if floor > 0.0 or tiles is not None:
+                decay_py(grids, np.ones(len(self.species_list)), floor, tiles)
+
+    def ppb(self, grids: np.ndarray, species: str) -> np.ndarray:
+        """Concentración total (fondo + exceso) de una especie gaseosa en ppb."""
+        s = self.species_list.index(species)
+        return self.background[s] + grids[s] * self.scale[s]
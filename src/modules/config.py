@@ -71,7 +71,7 @@ class ContaminationConfigPlugin:
         create_labeled_entry(10, "Altura de chimeneas (m):", self.chimney_height,
                              "Altura de las chimeneas en metros", 0, 100)
         create_labeled_entry(11, "Tasa de deposición:", self.deposition_rate,
-                             "Tasa de deposición de contaminantes (g/m²/s)", 0, 1)
+                             "Velocidad de deposición seca (cm/s) de las especies sin valor propio", 0, 1)
 
         ttk.Checkbutton(self.master, text="Grabar simulación", variable=self.record_simulation).grid(row=12,
                                                                                                      column=0,
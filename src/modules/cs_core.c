@@ -0,0 +1,1256 @@
+// cs_core.c - Núcleos de dispersión de contaminación en C puro (ver cs_core.h)
+// No depende de Python ni de NumPy: lo usan la extensión cs_module y el ejecutable cs_runner.
+
+#include "cs_core.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <pmmintrin.h>
+    #define CS_HAVE_MXCSR 1
+#endif
+
+/**
+ * Calcula los coeficientes de dispersión basados en la distancia y clase de estabilidad.
+ *
+ * @param stability_class Clase de estabilidad atmosférica (A-F)
+ * @param distance Distancia desde la fuente en metros
+ * @param sigma_y Puntero donde se guardará el coeficiente de dispersión horizontal
+ * @param sigma_z Puntero donde se guardará el coeficiente de dispersión vertical
+ */
+void cs_dispersion_coefficients(const char *stability_class, double distance, double *sigma_y, double *sigma_z) {
+    double a, b;
+
+    // Parámetros según la clase de estabilidad
+    if (strcmp(stability_class, "A") == 0) {
+        a = 0.22; b = 0.20;
+    } else if (strcmp(stability_class, "B") == 0) {
+        a = 0.16; b = 0.12;
+    } else if (strcmp(stability_class, "C") == 0) {
+        a = 0.11; b = 0.08;
+    } else if (strcmp(stability_class, "D") == 0) {
+        a = 0.08; b = 0.06;
+    } else if (strcmp(stability_class, "E") == 0) {
+        a = 0.06; b = 0.03;
+    } else if (strcmp(stability_class, "F") == 0) {
+        a = 0.04; b = 0.016;
+    } else {
+        // Valor por defecto (clase D - neutral)
+        a = 0.10; b = 0.05;
+    }
+
+    // Cálculo de los coeficientes según fórmulas estándar
+    *sigma_y = a * distance * pow(1 + 0.0001 * distance, -0.5);
+    *sigma_z = b * distance * pow(1 + 0.0001 * distance, -0.5);
+}
+
+/**
+ * Calcula la tasa de emisión de contaminantes de un vehículo basada en su velocidad.
+ *
+ * @param vehicle_speed Velocidad del vehículo en m/s
+ * @param emission_factor Factor de emisión global configurado por el usuario
+ * @return Tasa de emisión calculada
+ */
+double cs_emission_rate(double vehicle_speed, double emission_factor) {
+    double base_emission = 0.1;  // Emisión base para cualquier vehículo
+
+    // Aumentar emisión para velocidades altas (>20 m/s)
+    double speed_factor = (vehicle_speed > 20) ?
+                         (1 + 0.05 * (vehicle_speed - 20)) : 1.0;
+
+    // Aplicar factor de emisión global (configurable por el usuario)
+    return base_emission * speed_factor * emission_factor;
+}
+
+/**
+ * Calcula la altura de la pluma de contaminación basada en la velocidad del vehículo.
+ *
+ * @param vehicle_speed Velocidad del vehículo en m/s
+ * @return Altura de la pluma en metros (mínimo 2 metros)
+ */
+double cs_plume_rise(double vehicle_speed) {
+    // La altura aumenta con la velocidad pero tiene un mínimo de 2 metros
+    return (vehicle_speed * 0.15 + 0.5 > 2.0) ?
+           (vehicle_speed * 0.15 + 0.5) : 2.0;
+}
+
+// Lectura y escritura del modo de coma flotante del hilo (MXCSR en x86, FPCR en AArch64) y el
+// mismo modo con flush-to-zero y denormals-are-zero activados
+#if defined(CS_HAVE_MXCSR)
+    #define CS_HAVE_FP_MODE 1
+    #define fp_mode_get() ((unsigned long long) _mm_getcsr())
+    #define fp_mode_set(mode) _mm_setcsr((unsigned int) (mode))
+    #define fp_mode_ftz(mode) ((mode) | _MM_FLUSH_ZERO_ON | _MM_DENORMALS_ZERO_ON)
+#elif defined(__aarch64__)
+    #define CS_HAVE_FP_MODE 1
+    static inline unsigned long long fp_mode_get(void) {
+        unsigned long long fpcr;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+        return fpcr;
+    }
+    #define fp_mode_set(mode) __asm__ __volatile__("msr fpcr, %0" : : "r"((unsigned long long) (mode)))
+    #define fp_mode_ftz(mode) ((mode) | (1ULL << 24))  // Bit FZ
+#endif
+
+#if defined(CS_HAVE_FP_MODE) && defined(_OPENMP)
+// Modo previo de cada hilo de OpenMP que ha pasado por cs_ftz_enter
+static unsigned long long ftz_saved_mode;
+static int ftz_active;
+#pragma omp threadprivate(ftz_saved_mode, ftz_active)
+#endif
+
+/**
+ * Activa flush-to-zero y denormals-are-zero en el hilo que llama y en los de OpenMP y
+ * devuelve el estado previo del que llama. Tras muchos pasos de decaimiento, las celdas
+ * lejanas acaban en valores subnormales y cada operación con ellos pasa por microcódigo
+ * (~100x más lenta); con FTZ/DAZ se tratan como cero. El pool de OpenMP es común a todo el
+ * proceso (NumPy, SciPy...), así que cs_ftz_leave devuelve cada hilo a su modo anterior.
+ */
+unsigned long long cs_ftz_enter(void) {
+#if defined(CS_HAVE_FP_MODE)
+    unsigned long long saved = fp_mode_get();
+    #if defined(_OPENMP)
+    #pragma omp parallel
+    {
+        ftz_saved_mode = fp_mode_get();
+        ftz_active = 1;
+        fp_mode_set(fp_mode_ftz(ftz_saved_mode));
+    }
+    #endif
+    fp_mode_set(fp_mode_ftz(saved));
+    return saved;
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Restaura el modo de coma flotante de los hilos de OpenMP y del que llama (ver cs_ftz_enter).
+ */
+void cs_ftz_leave(unsigned long long saved) {
+#if defined(CS_HAVE_FP_MODE)
+    #if defined(_OPENMP)
+    #pragma omp parallel
+    {
+        if (ftz_active) {
+            fp_mode_set(ftz_saved_mode);
+            ftz_active = 0;
+        }
+    }
+    #endif
+    fp_mode_set(saved);
+#else
+    (void) saved;
+#endif
+}
+
+/**
+ * Pluma gaussiana de un único vehículo en su ventana de cálculo (versión original con los
+ * coeficientes de dispersión de la clase por defecto).
+ */
+void cs_update_pollution(double *data, ptrdiff_t s0, ptrdiff_t s1, ptrdiff_t nx,
+                         int i_min, int i_max, int j_min, int j_max,
+                         double x, double y, double emission_rate, double plume_height,
+                         double wind_speed, double wind_direction,
+                         double x_min, double x_max, double y_min, double y_max, int grid_resolution,
+                         const uint8_t *obstacles) {
+    ptrdiff_t row_bytes = CS_ROW_BYTES(nx);
+
+    // Calcular tamaño de celda
+    double cell_width = (x_max - x_min) / grid_resolution;
+    double cell_height = (y_max - y_min) / grid_resolution;
+
+    // Precalcular constantes comunes para optimización
+    double two_pi = 2.0 * M_PI;
+    double emission_factor = emission_rate / (two_pi * wind_speed);
+
+    // Utilizar bucles optimizados con acceso eficiente a memoria
+    for (int i = i_min; i < i_max; i++) {
+        for (int j = j_min; j < j_max; j++) {
+            // Sin depósito dentro de edificios
+            if (obstacles != NULL && IS_SOLID(obstacles, row_bytes, i, j)) continue;
+            // Coordenadas del centro de la celda (i,j)
+            double receptor_x = x_min + (j + 0.5) * cell_width;
+            double receptor_y = y_min + (i + 0.5) * cell_height;
+
+            // Distancia desde el vehículo al receptor
+            double dx = receptor_x - x;
+            double dy = receptor_y - y;
+            double distance_squared = dx * dx + dy * dy;
+
+            // Optimización: evitar cálculos innecesarios para puntos muy cercanos
+            if (distance_squared < 1.0) continue;
+
+            double distance = sqrt(distance_squared);
+
+            // Evitar cálculos para puntos muy lejanos (débil contribución)
+            if (distance > 300.0) continue;
+
+            // Ángulo entre la dirección del viento y la dirección al receptor
+            double wind_dir_to_rec = atan2(dy, dx);
+            double angle_diff = fabs(wind_dir_to_rec - wind_direction);
+            if (angle_diff > M_PI)
+                angle_diff = two_pi - angle_diff;
+
+            // Calcular coeficientes de dispersión basados en la distancia
+            double sigma_y, sigma_z;
+            // Cálculo directo para evitar llamadas a función (optimización)
+            double distance_factor = pow(1 + 0.0001 * distance, -0.5);
+            sigma_y = 0.1 * distance * distance_factor;
+            sigma_z = 0.05 * distance * distance_factor;
+
+            // Calcular concentración usando la ecuación gaussiana de dispersión
+            double lateral_dispersion = exp(-0.5 * pow(angle_diff / sigma_y, 2));
+            double vertical_dispersion = exp(-0.5 * pow(plume_height / sigma_z, 2)) * 2.0; // Simplificado
+
+            double concentration = emission_factor * lateral_dispersion * vertical_dispersion / (sigma_y * sigma_z);
+
+            // Añadir la concentración a la cuadrícula (acceso optimizado)
+            data[i * s0 + j * s1] += concentration;
+        }
+    }
+}
+
+/**
+ * Decaimiento global con umbral (deposición del paso) y pluma gaussiana de todos los
+ * vehículos en una sola llamada.
+ */
+void cs_update_pollution_multiple(double *data, ptrdiff_t s0, ptrdiff_t s1, ptrdiff_t ny, ptrdiff_t nx,
+                                  const double *vehicles, ptrdiff_t n, double wind_speed, double wind_direction,
+                                  double emission_factor, const char *stability_class,
+                                  double x_min, double x_max, double y_min, double y_max, int grid_resolution,
+                                  const uint8_t *obstacles, double decay, double floor_value) {
+    ptrdiff_t row_bytes = CS_ROW_BYTES(nx);
+    double cell_width = (x_max - x_min) / grid_resolution;
+    double cell_height = (y_max - y_min) / grid_resolution;
+
+    // Aplicar decaimiento global (deposición del paso, 0.99 por defecto) con FTZ/DAZ y umbral
+    unsigned long long ftz = cs_ftz_enter();
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t i = 0; i < ny; i++) {
+        double *row = data + i * s0;
+        for (ptrdiff_t j = 0; j < nx; j++) {
+            double v = row[j * s1] * decay;
+            row[j * s1] = fabs(v) < floor_value ? 0.0 : v;
+        }
+    }
+
+    // Recorrer todos los vehículos
+    for (ptrdiff_t v = 0; v < n; v++) {
+        double x = vehicles[3 * v], y = vehicles[3 * v + 1], vehicle_speed = vehicles[3 * v + 2];
+
+        // Calcular parámetros para este vehículo
+        double emission_rate = cs_emission_rate(vehicle_speed, emission_factor);
+        double plume_height = cs_plume_rise(vehicle_speed);
+
+        // Calcular índices de la ventana de cálculo (convertidos a enteros de forma segura)
+        int i_min = (int)fmax(0.0, (y - y_min - 100.0) / (y_max - y_min) * (double)grid_resolution);
+        int i_max = (int)fmin((double)ny, (y - y_min + 100.0) / (y_max - y_min) * (double)grid_resolution);
+        int j_min = (int)fmax(0.0, (x - x_min - 100.0) / (x_max - x_min) * (double)grid_resolution);
+        int j_max = (int)fmin((double)nx, (x - x_min + 100.0) / (x_max - x_min) * (double)grid_resolution);
+
+        // Precalcular constantes comunes
+        double two_pi = 2.0 * M_PI;
+        double emission_factor_value = emission_rate / (two_pi * wind_speed);
+
+        // Calcular la dispersión para este vehículo
+        for (int i = i_min; i < i_max; i++) {
+            for (int j = j_min; j < j_max; j++) {
+                if (obstacles != NULL && IS_SOLID(obstacles, row_bytes, i, j)) continue;
+                double receptor_x = x_min + (j + 0.5) * cell_width;
+                double receptor_y = y_min + (i + 0.5) * cell_height;
+                double dx = receptor_x - x;
+                double dy = receptor_y - y;
+                double distance_squared = dx * dx + dy * dy;
+
+                if (distance_squared < 1.0) continue;
+
+                double distance = sqrt(distance_squared);
+                if (distance > 300.0) continue;
+
+                double wind_dir_to_rec = atan2(dy, dx);
+                double angle_diff = fabs(wind_dir_to_rec - wind_direction);
+                if (angle_diff > M_PI)
+                    angle_diff = two_pi - angle_diff;
+
+                // Calcular coeficientes de dispersión
+                double sigma_y, sigma_z;
+                cs_dispersion_coefficients(stability_class, distance, &sigma_y, &sigma_z);
+
+                // Calcular concentración
+                double lateral_dispersion = exp(-0.5 * pow(angle_diff / sigma_y, 2));
+                double vertical_dispersion = exp(-0.5 * pow(plume_height / sigma_z, 2)) * 2.0;
+
+                double concentration = emission_factor_value * lateral_dispersion * vertical_dispersion / (sigma_y * sigma_z);
+
+                data[i * s0 + j * s1] += concentration;
+            }
+        }
+    }
+
+    cs_ftz_leave(ftz);
+}
+
+/**
+ * Muestrea la malla en una posición fraccionaria (en unidades de celda) con interpolación bilineal.
+ * Los vecinos fuera del dominio valen 0 (frontera abierta: entra aire limpio).
+ */
+static inline double sample_bilinear(const double *src, ptrdiff_t ny, ptrdiff_t nx, double y, double x) {
+    double fy = floor(y), fx = floor(x);
+    ptrdiff_t i0 = (ptrdiff_t)fy, j0 = (ptrdiff_t)fx;
+    double wy = y - fy, wx = x - fx;
+    double v00 = 0.0, v01 = 0.0, v10 = 0.0, v11 = 0.0;
+
+    if (i0 >= 0 && i0 < ny) {
+        if (j0 >= 0 && j0 < nx) v00 = src[i0 * nx + j0];
+        if (j0 + 1 >= 0 && j0 + 1 < nx) v01 = src[i0 * nx + j0 + 1];
+    }
+    if (i0 + 1 >= 0 && i0 + 1 < ny) {
+        if (j0 >= 0 && j0 < nx) v10 = src[(i0 + 1) * nx + j0];
+        if (j0 + 1 >= 0 && j0 + 1 < nx) v11 = src[(i0 + 1) * nx + j0 + 1];
+    }
+    return (1.0 - wy) * ((1.0 - wx) * v00 + wx * v01) + wy * ((1.0 - wx) * v10 + wx * v11);
+}
+
+/**
+ * Reparte una masa en una posición fraccionaria entre las cuatro celdas vecinas (inversa de
+ * sample_bilinear). La fracción que cae fuera del dominio sale por la frontera abierta.
+ */
+static inline void scatter_bilinear(double *dst, ptrdiff_t ny, ptrdiff_t nx, double y, double x, double mass) {
+    double fy = floor(y), fx = floor(x);
+    ptrdiff_t i0 = (ptrdiff_t)fy, j0 = (ptrdiff_t)fx;
+    double wy = y - fy, wx = x - fx;
+    ptrdiff_t ii[2] = {i0, i0 + 1}, jj[2] = {j0, j0 + 1};
+    double w[2][2] = {{(1.0 - wy) * (1.0 - wx), (1.0 - wy) * wx}, {wy * (1.0 - wx), wy * wx}};
+
+    for (int a = 0; a < 2; a++) {
+        if (ii[a] < 0 || ii[a] >= ny) continue;
+        for (int b = 0; b < 2; b++) {
+            if (jj[b] < 0 || jj[b] >= nx) continue;
+            #pragma omp atomic
+            dst[ii[a] * nx + jj[b]] += w[a][b] * mass;
+        }
+    }
+}
+
+/**
+ * Desempaqueta la máscara en un array de fracción abierta (1.0 aire, 0.0 edificio) para que
+ * los estencilos enmascarados sean aritmética pura, sin saltos. Devuelve NULL si no hay memoria.
+ */
+static double* unpack_open(const uint8_t *bits, ptrdiff_t ny, ptrdiff_t nx) {
+    ptrdiff_t row_bytes = CS_ROW_BYTES(nx);
+    double *open = (double*) malloc(ny * nx * sizeof(double));
+    if (open == NULL) {
+        return NULL;
+    }
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t i = 0; i < ny; i++) {
+        for (ptrdiff_t j = 0; j < nx; j++) {
+            open[i * nx + j] = IS_SOLID(bits, row_bytes, i, j) ? 0.0 : 1.0;
+        }
+    }
+    return open;
+}
+
+/**
+ * Igual que sample_bilinear pero ignorando las esquinas dentro de edificios: los pesos de
+ * las esquinas abiertas se renormalizan (fuera del dominio cuenta como aire limpio).
+ */
+static inline double sample_bilinear_open(const double *src, const double *open, ptrdiff_t ny, ptrdiff_t nx,
+                                          double y, double x) {
+    double fy = floor(y), fx = floor(x);
+    ptrdiff_t i0 = (ptrdiff_t)fy, j0 = (ptrdiff_t)fx;
+    double wy = y - fy, wx = x - fx;
+    double w[4] = {(1.0 - wy) * (1.0 - wx), (1.0 - wy) * wx, wy * (1.0 - wx), wy * wx};
+    ptrdiff_t ii[4] = {i0, i0, i0 + 1, i0 + 1}, jj[4] = {j0, j0 + 1, j0, j0 + 1};
+    double acc = 0.0, norm = 0.0;
+
+    for (int k = 0; k < 4; k++) {
+        if (ii[k] < 0 || ii[k] >= ny || jj[k] < 0 || jj[k] >= nx) {
+            norm += w[k];
+            continue;
+        }
+        double o = open[ii[k] * nx + jj[k]];
+        acc += w[k] * o * src[ii[k] * nx + jj[k]];
+        norm += w[k] * o;
+    }
+    return norm > 0.0 ? acc / norm : 0.0;
+}
+
+/**
+ * Igual que scatter_bilinear pero sin depositar dentro de edificios: los pesos de las
+ * esquinas abiertas se renormalizan y, si las cuatro son edificio, la masa se queda en la
+ * celda de origen (oi, oj).
+ */
+static inline void scatter_bilinear_open(double *dst, const double *open, ptrdiff_t ny, ptrdiff_t nx,
+                                         double y, double x, double mass, ptrdiff_t oi, ptrdiff_t oj) {
+    double fy = floor(y), fx = floor(x);
+    ptrdiff_t i0 = (ptrdiff_t)fy, j0 = (ptrdiff_t)fx;
+    double wy = y - fy, wx = x - fx;
+    double w[4] = {(1.0 - wy) * (1.0 - wx), (1.0 - wy) * wx, wy * (1.0 - wx), wy * wx};
+    ptrdiff_t ii[4] = {i0, i0, i0 + 1, i0 + 1}, jj[4] = {j0, j0 + 1, j0, j0 + 1};
+    double norm = 0.0;
+
+    for (int k = 0; k < 4; k++) {
+        int inside = ii[k] >= 0 && ii[k] < ny && jj[k] >= 0 && jj[k] < nx;
+        if (inside) w[k] *= open[ii[k] * nx + jj[k]];
+        norm += w[k];
+    }
+    if (norm <= 0.0) {
+        #pragma omp atomic
+        dst[oi * nx + oj] += mass;
+        return;
+    }
+    for (int k = 0; k < 4; k++) {
+        if (w[k] == 0.0 || ii[k] < 0 || ii[k] >= ny || jj[k] < 0 || jj[k] >= nx) continue;
+        #pragma omp atomic
+        dst[ii[k] * nx + jj[k]] += w[k] / norm * mass;
+    }
+}
+
+/**
+ * Advección semi-lagrangiana con un campo de viento espacialmente variable.
+ *
+ * Cada celda retrocede a lo largo de su velocidad (trayectoria inversa) y toma el valor
+ * interpolado bilinealmente en el punto de partida. El coste por celda es constante, así
+ * que un campo urbano canalizado cuesta lo mismo que un viento uniforme, y el esquema es
+ * estable para cualquier número de Courant. Con conservative=1 se usa la variante directa:
+ * la masa de cada celda se reparte en su punto de llegada, lo que conserva la masa salvo
+ * la que sale del dominio. wind es [ny, nx, 2] con (vx, vy) en m/s.
+ */
+int cs_advect_wind_field(double *data, ptrdiff_t ny, ptrdiff_t nx, const double *uv, double dt,
+                         double cell_width, double cell_height, int conservative, const uint8_t *obstacles) {
+    ptrdiff_t size = ny * nx;
+    double *src = (double*) malloc(size * sizeof(double));
+    double *open = obstacles != NULL ? unpack_open(obstacles, ny, nx) : NULL;
+    if (src == NULL || (obstacles != NULL && open == NULL)) {
+        free(src);
+        free(open);
+        return CS_ERR_NOMEM;
+    }
+    memcpy(src, data, size * sizeof(double));
+    unsigned long long ftz = cs_ftz_enter();
+
+    // Velocidades en celdas por paso
+    const double cx = dt / cell_width, cy = dt / cell_height;
+
+    if (open != NULL && conservative) {
+        memset(data, 0, size * sizeof(double));
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < ny; i++) {
+            for (ptrdiff_t j = 0; j < nx; j++) {
+                double mass = src[i * nx + j];
+                if (mass == 0.0) continue;
+                const double *v = uv + 2 * (i * nx + j);
+                scatter_bilinear_open(data, open, ny, nx, i + v[1] * cy, j + v[0] * cx, mass, i, j);
+            }
+        }
+    } else if (open != NULL) {
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < ny; i++) {
+            const double *v = uv + 2 * i * nx;
+            double *row = data + i * nx;
+            for (ptrdiff_t j = 0; j < nx; j++) {
+                row[j] = open[i * nx + j] * sample_bilinear_open(src, open, ny, nx, i - v[2 * j + 1] * cy,
+                                                                 j - v[2 * j] * cx);
+            }
+        }
+    } else if (conservative) {
+        memset(data, 0, size * sizeof(double));
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < ny; i++) {
+            for (ptrdiff_t j = 0; j < nx; j++) {
+                double mass = src[i * nx + j];
+                if (mass == 0.0) continue;
+                const double *v = uv + 2 * (i * nx + j);
+                scatter_bilinear(data, ny, nx, i + v[1] * cy, j + v[0] * cx, mass);
+            }
+        }
+    } else {
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < ny; i++) {
+            const double *v = uv + 2 * i * nx;
+            double *row = data + i * nx;
+            for (ptrdiff_t j = 0; j < nx; j++) {
+                row[j] = sample_bilinear(src, ny, nx, i - v[2 * j + 1] * cy, j - v[2 * j] * cx);
+            }
+        }
+    }
+
+    cs_ftz_leave(ftz);
+    free(src);
+    free(open);
+    return CS_OK;
+}
+
+/**
+ * Flujo (en fracción de celda) a través de la cara entre la celda upwind q0 y la siguiente q1,
+ * con número de Courant 0 <= c <= 1. Esquema upwind de 2º orden con limitador de van Leer:
+ * la pendiente limitada es la media armónica de las diferencias a ambos lados (0 en extremos),
+ * lo que mantiene el esquema TVD (sin oscilaciones ni valores negativos).
+ */
+static inline double limited_face_flux(double qm1, double q0, double q1, double c) {
+    double d0 = q0 - qm1, d1 = q1 - q0;
+    double slope = (d0 * d1 > 0.0) ? 2.0 * d0 * d1 / (d0 + d1) : 0.0;
+    return c * (q0 + 0.5 * (1.0 - c) * slope);
+}
+
+/**
+ * Valor de la celda m contada en el sentido del flujo (m = 0 es la celda de entrada).
+ * Fuera del dominio: aire limpio aguas arriba y gradiente nulo aguas abajo (salida libre).
+ */
+static inline double upwind_value(const double *line, ptrdiff_t stride, ptrdiff_t n, int forward, ptrdiff_t m) {
+    if (m < 0) return 0.0;
+    if (m >= n) m = n - 1;
+    return line[(forward ? m : n - 1 - m) * stride];
+}
+
+/**
+ * Fracción abierta de la celda m contada en el sentido del flujo (1 fuera del dominio).
+ */
+static inline double upwind_open(const double *line, ptrdiff_t stride, ptrdiff_t n, int forward, ptrdiff_t m) {
+    if (line == NULL || m < 0 || m >= n) return 1.0;
+    return line[(forward ? m : n - 1 - m) * stride];
+}
+
+/**
+ * Un barrido 1D conservativo en forma de flujo: dst = src - (F_salida - F_entrada) por celda.
+ * axis = 1 recorre filas (x), axis = 0 columnas (y); c es el Courant con signo (|c| <= 1).
+ * Con open (fracción abierta por celda, o NULL) el flujo a través de una cara con un edificio
+ * a cualquiera de los dos lados es nulo: las fachadas son paredes sin flujo.
+ */
+static void flux_sweep(const double *src, double *dst, const double *open, ptrdiff_t ny, ptrdiff_t nx,
+                       int axis, double c) {
+    int forward = c >= 0.0;
+    double ac = fabs(c);
+
+    if (axis == 1) {
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t i = 0; i < ny; i++) {
+            const double *line = src + i * nx;
+            const double *oline = open != NULL ? open + i * nx : NULL;
+            double *out = dst + i * nx;
+            double f_in = 0.0;  // nada entra por la cara de entrada
+            for (ptrdiff_t m = 0; m < nx; m++) {
+                double f_out = limited_face_flux(upwind_value(line, 1, nx, forward, m - 1),
+                                                 upwind_value(line, 1, nx, forward, m),
+                                                 upwind_value(line, 1, nx, forward, m + 1), ac);
+                if (oline != NULL) {
+                    f_out *= upwind_open(oline, 1, nx, forward, m) * upwind_open(oline, 1, nx, forward, m + 1);
+                }
+                ptrdiff_t j = forward ? m : nx - 1 - m;
+                out[j] = line[j] - (f_out - f_in);
+                f_in = f_out;
+            }
+        }
+    } else {
+        // Columnas: cada fila de salida calcula sus dos caras recorriendo x de forma contigua
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t m = 0; m < ny; m++) {
+            ptrdiff_t i = forward ? m : ny - 1 - m;
+            double *out = dst + i * nx;
+            for (ptrdiff_t j = 0; j < nx; j++) {
+                const double *col = src + j;
+                double qm2 = upwind_value(col, nx, ny, forward, m - 2);
+                double qm1 = upwind_value(col, nx, ny, forward, m - 1);
+                double q0 = upwind_value(col, nx, ny, forward, m);
+                double q1 = upwind_value(col, nx, ny, forward, m + 1);
+                double f_in = limited_face_flux(qm2, qm1, q0, ac);
+                double f_out = limited_face_flux(qm1, q0, q1, ac);
+                if (open != NULL) {
+                    const double *ocol = open + j;
+                    double o0 = upwind_open(ocol, nx, ny, forward, m);
+                    f_in *= upwind_open(ocol, nx, ny, forward, m - 1) * o0;
+                    f_out *= o0 * upwind_open(ocol, nx, ny, forward, m + 1);
+                }
+                out[j] = q0 - (f_out - f_in);
+            }
+        }
+    }
+}
+
+/**
+ * Advección conservativa en forma de flujo con viento uniforme.
+ *
+ * Esquema de volúmenes finitos upwind de 2º orden con limitador (TVD) y separación
+ * direccional x/y (alternando el orden en cada subpaso). Los desplazamientos de fracción
+ * de celda se transportan correctamente (a diferencia de np.roll con desplazamientos
+ * enteros), la masa se conserva salvo la que sale por la frontera de salida y no hay
+ * recirculación periódica. Si el número de Courant supera 1 el paso se subdivide
+ * internamente. Devuelve el número de subpasos (o CS_ERR_NOMEM).
+ */
+int cs_advect_grid(double *data, ptrdiff_t ny, ptrdiff_t nx, double wind_speed, double wind_direction, double dt,
+                   double cell_width, double cell_height, const uint8_t *obstacles) {
+    double cx = wind_speed * cos(wind_direction) * dt / cell_width;
+    double cy = wind_speed * sin(wind_direction) * dt / cell_height;
+    int substeps = (int)ceil(fmax(fabs(cx), fabs(cy)));
+    if (substeps < 1) substeps = 1;
+    cx /= substeps;
+    cy /= substeps;
+
+    double *tmp = (double*) malloc(ny * nx * sizeof(double));
+    double *open = obstacles != NULL ? unpack_open(obstacles, ny, nx) : NULL;
+    if (tmp == NULL || (obstacles != NULL && open == NULL)) {
+        free(tmp);
+        free(open);
+        return CS_ERR_NOMEM;
+    }
+    unsigned long long ftz = cs_ftz_enter();
+    for (int k = 0; k < substeps; k++) {
+        if (k % 2 == 0) {
+            flux_sweep(data, tmp, open, ny, nx, 1, cx);
+            flux_sweep(tmp, data, open, ny, nx, 0, cy);
+        } else {
+            flux_sweep(data, tmp, open, ny, nx, 0, cy);
+            flux_sweep(tmp, data, open, ny, nx, 1, cx);
+        }
+    }
+    cs_ftz_leave(ftz);
+    free(tmp);
+    free(open);
+    return substeps;
+}
+
+/**
+ * Un subpaso de difusión de las filas [i0, i1) y columnas [j0, j1): data = src + r * laplaciano.
+ */
+static void diffuse_block(const double *src, double *data, const double *open, ptrdiff_t ny, ptrdiff_t nx,
+                          double rx, double ry, ptrdiff_t i0, ptrdiff_t i1, ptrdiff_t j0, ptrdiff_t j1) {
+    for (ptrdiff_t i = i0; i < i1; i++) {
+        ptrdiff_t iu = i > 0 ? i - 1 : i, id = i < ny - 1 ? i + 1 : i;
+        const double *row = src + i * nx, *up = src + iu * nx, *down = src + id * nx;
+        double *out = data + i * nx;
+        if (open != NULL) {
+            // Flujo por cara multiplicado por la fracción abierta de ambos lados (sin saltos)
+            const double *orow = open + i * nx, *oup = open + iu * nx, *odown = open + id * nx;
+            for (ptrdiff_t j = j0; j < j1; j++) {
+                ptrdiff_t jl = j > 0 ? j - 1 : j, jr = j < nx - 1 ? j + 1 : j;
+                double lap_x = orow[jl] * (row[jl] - row[j]) + orow[jr] * (row[jr] - row[j]);
+                double lap_y = oup[j] * (up[j] - row[j]) + odown[j] * (down[j] - row[j]);
+                out[j] = row[j] + orow[j] * (rx * lap_x + ry * lap_y);
+            }
+            continue;
+        }
+        for (ptrdiff_t j = j0; j < j1; j++) {
+            double left = row[j > 0 ? j - 1 : j];
+            double right = row[j < nx - 1 ? j + 1 : j];
+            out[j] = row[j] + rx * (left - 2.0 * row[j] + right) + ry * (up[j] - 2.0 * row[j] + down[j]);
+        }
+    }
+}
+
+/**
+ * Difusión explícita con el laplaciano de 5 puntos y fronteras de flujo nulo (la celda
+ * fantasma repite la del borde, como scipy.ndimage.laplace con mode='reflect'), por lo
+ * que la masa se conserva. Las fachadas de los edificios son también fronteras de flujo nulo
+ * y el interior no cambia. Con tiles (solo lectura) únicamente se calculan las teselas a
+ * menos de "substeps" celdas de una tesela viva: el resto vale cero y seguirá valiendo cero.
+ * Si el número de difusión supera 0.5 (inestable) el paso se subdivide internamente.
+ * Devuelve el número de subpasos (o CS_ERR_NOMEM).
+ */
+int cs_diffuse_grid(double *data, ptrdiff_t ny, ptrdiff_t nx, double diffusion_coeff, double dt,
+                    double cell_width, double cell_height, const uint8_t *obstacles, const uint8_t *tiles) {
+    double rx = diffusion_coeff * dt / (cell_width * cell_width);
+    double ry = diffusion_coeff * dt / (cell_height * cell_height);
+    int substeps = (int)ceil((rx + ry) / 0.5);
+    if (substeps < 1) substeps = 1;
+    rx /= substeps;
+    ry /= substeps;
+    if (rx == 0.0 && ry == 0.0) {
+        return 0;
+    }
+
+    // Teselas a calcular: las vivas dilatadas tantas teselas como celdas avanza la difusión
+    ptrdiff_t ty = CS_TILES(ny), tx = CS_TILES(nx);
+    ptrdiff_t *active = NULL, n_active = 0;
+    if (tiles != NULL) {
+        ptrdiff_t reach = (substeps + TILE_SIZE - 1) / TILE_SIZE;
+        active = (ptrdiff_t*) malloc(ty * tx * sizeof(ptrdiff_t));
+        if (active == NULL) {
+            return CS_ERR_NOMEM;
+        }
+        for (ptrdiff_t a = 0; a < ty; a++) {
+            for (ptrdiff_t b = 0; b < tx; b++) {
+                int live = 0;
+                for (ptrdiff_t c = a - reach; c <= a + reach && !live; c++) {
+                    for (ptrdiff_t d = b - reach; d <= b + reach && !live; d++) {
+                        live = c >= 0 && c < ty && d >= 0 && d < tx && tiles[c * tx + d];
+                    }
+                }
+                if (live) active[n_active++] = a * tx + b;
+            }
+        }
+        if (n_active == 0) {
+            free(active);
+            return substeps;
+        }
+    }
+
+    // Con teselas, las celdas no calculadas de src valen cero (igual que en data)
+    double *src = (double*) (active != NULL ? calloc(ny * nx, sizeof(double)) : malloc(ny * nx * sizeof(double)));
+    double *open = obstacles != NULL ? unpack_open(obstacles, ny, nx) : NULL;
+    if (src == NULL || (obstacles != NULL && open == NULL)) {
+        free(src);
+        free(open);
+        free(active);
+        return CS_ERR_NOMEM;
+    }
+    unsigned long long ftz = cs_ftz_enter();
+    for (int k = 0; k < substeps; k++) {
+        if (active == NULL) {
+            memcpy(src, data, ny * nx * sizeof(double));
+            #pragma omp parallel for schedule(static)
+            for (ptrdiff_t i = 0; i < ny; i++) {
+                diffuse_block(src, data, open, ny, nx, rx, ry, i, i + 1, 0, nx);
+            }
+            continue;
+        }
+        #pragma omp parallel for schedule(static)
+        for (ptrdiff_t t = 0; t < n_active; t++) {
+            ptrdiff_t i0 = active[t] / tx * TILE_SIZE, j0 = active[t] % tx * TILE_SIZE;
+            ptrdiff_t i1 = i0 + TILE_SIZE < ny ? i0 + TILE_SIZE : ny, j1 = j0 + TILE_SIZE < nx ? j0 + TILE_SIZE : nx;
+            for (ptrdiff_t i = i0; i < i1; i++) {
+                memcpy(src + i * nx + j0, data + i * nx + j0, (j1 - j0) * sizeof(double));
+            }
+        }
+        #pragma omp parallel for schedule(dynamic, 4)
+        for (ptrdiff_t t = 0; t < n_active; t++) {
+            ptrdiff_t i0 = active[t] / tx * TILE_SIZE, j0 = active[t] % tx * TILE_SIZE;
+            ptrdiff_t i1 = i0 + TILE_SIZE < ny ? i0 + TILE_SIZE : ny, j1 = j0 + TILE_SIZE < nx ? j0 + TILE_SIZE : nx;
+            diffuse_block(src, data, open, ny, nx, rx, ry, i0, i1, j0, j1);
+        }
+    }
+    cs_ftz_leave(ftz);
+    free(src);
+    free(open);
+    free(active);
+    return substeps;
+}
+
+/**
+ * Avanza las bocanadas (puffs) activas un paso dt: las desplaza con el viento (uniforme o
+ * campo [ny, nx, 2] muestreado bilinealmente en su posición), acumula la distancia recorrida
+ * y hace crecer su sigma horizontal con ella (misma ley que los coeficientes de dispersión:
+ * sigma = sigma0 + a * d * (1 + 0.0001 d)^-0.5). Paralelizado por bocanadas.
+ */
+void cs_puff_advect(ptrdiff_t n, double *x, double *y, double *sig, double *dist, double *age,
+                    const uint8_t *active, double dt, double wind_speed, double wind_direction,
+                    double sigma_a, double sigma0, const double *uv, ptrdiff_t ny, ptrdiff_t nx,
+                    double x_min, double x_max, double y_min, double y_max) {
+    const double fx = uv != NULL ? nx / (x_max - x_min) : 0.0, fy = uv != NULL ? ny / (y_max - y_min) : 0.0;
+    const double u0 = wind_speed * cos(wind_direction), v0 = wind_speed * sin(wind_direction);
+
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t k = 0; k < n; k++) {
+        if (!active[k]) continue;
+        double u = u0, v = v0;
+        if (uv != NULL) {
+            // Centros de celda en índices enteros: (x - x_min) * fx - 0.5
+            double ci = (y[k] - y_min) * fy - 0.5, cj = (x[k] - x_min) * fx - 0.5;
+            ci = ci < 0.0 ? 0.0 : (ci > ny - 1 ? ny - 1 : ci);
+            cj = cj < 0.0 ? 0.0 : (cj > nx - 1 ? nx - 1 : cj);
+            ptrdiff_t i0 = (ptrdiff_t)ci, j0 = (ptrdiff_t)cj;
+            ptrdiff_t i1 = i0 + 1 < ny ? i0 + 1 : i0, j1 = j0 + 1 < nx ? j0 + 1 : j0;
+            double wy = ci - i0, wx = cj - j0;
+            const double *p00 = uv + 2 * (i0 * nx + j0), *p01 = uv + 2 * (i0 * nx + j1);
+            const double *p10 = uv + 2 * (i1 * nx + j0), *p11 = uv + 2 * (i1 * nx + j1);
+            u = (1 - wy) * ((1 - wx) * p00[0] + wx * p01[0]) + wy * ((1 - wx) * p10[0] + wx * p11[0]);
+            v = (1 - wy) * ((1 - wx) * p00[1] + wx * p01[1]) + wy * ((1 - wx) * p10[1] + wx * p11[1]);
+        }
+        x[k] += u * dt;
+        y[k] += v * dt;
+        dist[k] += sqrt(u * u + v * v) * dt;
+        age[k] += dt;
+        sig[k] = sigma0 + sigma_a * dist[k] / sqrt(1.0 + 0.0001 * dist[k]);
+    }
+}
+
+/**
+ * Rasteriza las bocanadas activas sobre las mallas de especies. Cada bocanada es una
+ * gaussiana 2D isótropa cuya masa se integra exactamente por celda (diferencias de erf en
+ * x y en y, truncando a 4 sigma), de modo que una bocanada más pequeña que una celda deja
+ * toda su masa en ella. Las filas de la malla se reparten en bandas entre los hilos: cada
+ * hilo suma solo en su banda las bocanadas que la cruzan, sin operaciones atómicas.
+ * mass es [n, S]. Devuelve CS_OK o CS_ERR_NOMEM.
+ */
+int cs_puff_rasterize(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, ptrdiff_t n,
+                      const double *x, const double *y, const double *sig, const double *mass,
+                      const uint8_t *active, double x_min, double x_max, double y_min, double y_max) {
+    const double cw = (x_max - x_min) / nx, ch = (y_max - y_min) / ny;
+    const ptrdiff_t plane = ny * nx;
+
+    // Ventana [i0, i1] x [j0, j1] de cada bocanada (vacía si no toca el dominio)
+    ptrdiff_t *win = (ptrdiff_t*) malloc(4 * (n > 0 ? n : 1) * sizeof(ptrdiff_t));
+    if (win == NULL) {
+        return CS_ERR_NOMEM;
+    }
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t k = 0; k < n; k++) {
+        ptrdiff_t *w = win + 4 * k;
+        double s = sig[k] > 1e-9 ? sig[k] : 1e-9;
+        w[0] = (ptrdiff_t)floor((y[k] - 4.0 * s - y_min) / ch);
+        w[1] = (ptrdiff_t)floor((y[k] + 4.0 * s - y_min) / ch);
+        w[2] = (ptrdiff_t)floor((x[k] - 4.0 * s - x_min) / cw);
+        w[3] = (ptrdiff_t)floor((x[k] + 4.0 * s - x_min) / cw);
+        if (w[0] < 0) w[0] = 0;
+        if (w[2] < 0) w[2] = 0;
+        if (w[1] > ny - 1) w[1] = ny - 1;
+        if (w[3] > nx - 1) w[3] = nx - 1;
+        if (!active[k] || w[0] > w[1] || w[2] > w[3]) {
+            w[0] = 1;  // ventana vacía
+            w[1] = 0;
+        }
+    }
+
+    const ptrdiff_t band = 16;
+    const ptrdiff_t n_bands = (ny + band - 1) / band;
+    int failed = 0;
+    #pragma omp parallel
+    {
+        double *wx = (double*) malloc((nx + band) * sizeof(double));
+        double *wy = wx ? wx + nx : NULL;
+        if (wx == NULL) {
+            #pragma omp critical
+            failed = 1;
+        } else {
+            #pragma omp for schedule(dynamic, 1)
+            for (ptrdiff_t b = 0; b < n_bands; b++) {
+                ptrdiff_t r0 = b * band, r1 = r0 + band - 1 < ny - 1 ? r0 + band - 1 : ny - 1;
+                for (ptrdiff_t k = 0; k < n; k++) {
+                    const ptrdiff_t *w = win + 4 * k;
+                    ptrdiff_t i0 = w[0] > r0 ? w[0] : r0, i1 = w[1] < r1 ? w[1] : r1;
+                    if (i0 > i1) continue;
+                    ptrdiff_t j0 = w[2], j1 = w[3];
+                    double s = sig[k] > 1e-9 ? sig[k] : 1e-9;
+                    double inv = 1.0 / (s * sqrt(2.0));
+
+                    // Fracción de masa por columna y por fila (integral exacta de la gaussiana)
+                    double prev = erf((x_min + j0 * cw - x[k]) * inv);
+                    for (ptrdiff_t j = j0; j <= j1; j++) {
+                        double next = erf((x_min + (j + 1) * cw - x[k]) * inv);
+                        wx[j] = 0.5 * (next - prev);
+                        prev = next;
+                    }
+                    prev = erf((y_min + i0 * ch - y[k]) * inv);
+                    for (ptrdiff_t i = i0; i <= i1; i++) {
+                        double next = erf((y_min + (i + 1) * ch - y[k]) * inv);
+                        wy[i - r0] = 0.5 * (next - prev);
+                        prev = next;
+                    }
+                    for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+                        double m = mass[k * n_species + sp];
+                        if (m == 0.0) continue;
+                        for (ptrdiff_t i = i0; i <= i1; i++) {
+                            double mi = m * wy[i - r0];
+                            double *row = grids + sp * plane + i * nx;
+                            for (ptrdiff_t j = j0; j <= j1; j++) {
+                                row[j] += mi * wx[j];
+                            }
+                        }
+                    }
+                }
+            }
+            free(wx);
+        }
+    }
+    free(win);
+    return failed ? CS_ERR_NOMEM : CS_OK;
+}
+
+/**
+ * Evalúa la concentración de las bocanadas activas en puntos sueltos (receptores), sin
+ * rasterizar la malla. El valor en cada punto es la densidad gaussiana multiplicada por
+ * cell_area, es decir, la masa que tendría una celda de ese área centrada en el punto (mismas
+ * unidades que cs_puff_rasterize). Se truncan las bocanadas a 4 sigma. Paralelizado por
+ * puntos; sobrescribe out [m, S].
+ */
+void cs_puff_sample(double *out, ptrdiff_t m, ptrdiff_t n_species, const double *px, const double *py, ptrdiff_t n,
+                    const double *x, const double *y, const double *sig, const double *mass,
+                    const uint8_t *active, double cell_area) {
+    const double norm = cell_area / (2.0 * M_PI);
+
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t p = 0; p < m; p++) {
+        double *row = out + p * n_species;
+        for (ptrdiff_t sp = 0; sp < n_species; sp++) row[sp] = 0.0;
+        for (ptrdiff_t k = 0; k < n; k++) {
+            if (!active[k]) continue;
+            double s = sig[k] > 1e-9 ? sig[k] : 1e-9;
+            double dx = px[p] - x[k], dy = py[p] - y[k];
+            double r2 = (dx * dx + dy * dy) / (s * s);
+            if (r2 > 16.0) continue;
+            double w = norm / (s * s) * exp(-0.5 * r2);
+            for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+                row[sp] += w * mass[k * n_species + sp];
+            }
+        }
+    }
+}
+
+/**
+ * Factor OSPM (Operational Street Pollution Model, versión simplificada) de un receptor en un
+ * cañón urbano: la concentración de cada especie es factor * q, con q la emisión lineal de la
+ * calle (masa / m / s). Combina la pluma directa de la calle y la recirculación del vórtice
+ * según el lado del receptor respecto al viento sobre los tejados.
+ *
+ * @param W Anchura del cañón (m, entre fachadas)
+ * @param H Altura media de los edificios (m)
+ * @param theta Orientación del eje de la calle (rad)
+ * @param offset Distancia con signo del receptor al eje (> 0 a la izquierda del sentido del eje)
+ * @param u Velocidad del viento sobre los tejados (m/s)
+ * @param wind_direction Dirección hacia la que sopla el viento (rad)
+ * @param sigma_wt Turbulencia inducida por el tráfico (m/s)
+ */
+static inline double ospm_factor(double W, double H, double theta, double offset, double u,
+                                 double wind_direction, double sigma_wt) {
+    const double h0 = 2.0, z0 = 0.6, alpha = 0.1, lambda = 0.1;
+    double ut = u > 0.5 ? u : 0.5;
+    double hh = H > h0 + 0.1 ? H : h0 + 0.1;
+    double us = ut * log(h0 / z0) / log(hh / z0);
+    us = us > 0.2 ? us : 0.2;
+    double sw = sqrt(alpha * alpha * us * us + sigma_wt * sigma_wt);
+    double sv = sqrt(lambda * lambda * ut * ut + sigma_wt * sigma_wt);
+    double norm = sqrt(2.0 / M_PI) / (W * sw);
+
+    // Componente del viento normal a la calle (n = normal izquierda del eje)
+    double cross = cos(wind_direction) * -sin(theta) + sin(wind_direction) * cos(theta);
+    double s = fabs(cross);
+    double lr = W < 2.0 * H ? W : 2.0 * H;          // Longitud de la zona de recirculación
+    double lt = lr > 2e-3 ? 0.5 * lr : 1e-3;         // Tramo ventilado de la zona
+    double recirc = lr / (W * sv * lt);
+    double direct_lee = norm * log((h0 + sw * lr / us) / h0);
+    double direct_wind = W > lr ? norm * log((h0 + sw * (W - lr) / us) / h0) : 0.0;
+    // Sotavento (lado de la calle del que viene el viento) si offset y cross tienen signo opuesto
+    double perp = offset * cross < 0.0 ? direct_lee + recirc : direct_wind + recirc;
+    double parallel = norm * log((h0 + sw * W / us) / h0);
+    return s * perp + (1.0 - s) * parallel;
+}
+
+/**
+ * Concentración de calle OSPM en receptores situados en cañones urbanos (canyon = -1 fuera
+ * de cañón). q es [E, S]; sobrescribe out [m, S].
+ */
+void cs_canyon_concentration(double *out, ptrdiff_t m, ptrdiff_t n_species, const int32_t *canyon,
+                             const double *offset, ptrdiff_t n_canyons, const double *width, const double *height,
+                             const double *orient, const double *q, double wind_speed, double wind_direction,
+                             double sigma_wt) {
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t p = 0; p < m; p++) {
+        double *row = out + p * n_species;
+        int32_t c = canyon[p];
+        if (c < 0 || c >= n_canyons) {
+            for (ptrdiff_t sp = 0; sp < n_species; sp++) row[sp] = 0.0;
+            continue;
+        }
+        double f = ospm_factor(width[c], height[c], orient[c], offset[p], wind_speed, wind_direction, sigma_wt);
+        for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+            row[sp] = f * q[c * n_species + sp];
+        }
+    }
+}
+
+/**
+ * Emisión de cada especie por vehículo interpolando bilinealmente tablas precompiladas por
+ * clase de vehículo (velocidad x aceleración, estilo HBEFA/COPERT). Los ejes son uniformes
+ * (v0 + k dv, a0 + k da) y los valores fuera de la tabla se recortan al borde. Los vehículos
+ * con clase fuera de [0, C) (no motorizados) no emiten. table es [C, S, nv, na]; sobrescribe
+ * out [n, S]. Paralelizado por vehículos.
+ */
+void cs_emission_lookup(double *out, ptrdiff_t n, ptrdiff_t n_species, const int32_t *cls, const double *speed,
+                        const double *accel, const double *table, ptrdiff_t n_classes, ptrdiff_t nv, ptrdiff_t na,
+                        double v0, double dv, double a0, double da) {
+    const ptrdiff_t plane = nv * na;
+
+    #pragma omp parallel for schedule(static)
+    for (ptrdiff_t k = 0; k < n; k++) {
+        double *row = out + k * n_species;
+        int32_t c = cls[k];
+        if (c < 0 || c >= n_classes) {
+            for (ptrdiff_t sp = 0; sp < n_species; sp++) row[sp] = 0.0;
+            continue;
+        }
+        double fv = (speed[k] - v0) / dv, fa = (accel[k] - a0) / da;
+        fv = fv < 0.0 ? 0.0 : (fv > nv - 1 ? nv - 1 : fv);
+        fa = fa < 0.0 ? 0.0 : (fa > na - 1 ? na - 1 : fa);
+        ptrdiff_t iv = (ptrdiff_t) fv, ia = (ptrdiff_t) fa;
+        iv = iv < nv - 1 ? iv : nv - 2;
+        ia = ia < na - 1 ? ia : na - 2;
+        double tv = fv - iv, ta = fa - ia;
+        double w00 = (1.0 - tv) * (1.0 - ta), w01 = (1.0 - tv) * ta, w10 = tv * (1.0 - ta), w11 = tv * ta;
+        const double *base = table + (ptrdiff_t) c * n_species * plane + iv * na + ia;
+        for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+            const double *t = base + sp * plane;
+            row[sp] = w00 * t[0] + w01 * t[1] + w10 * t[na] + w11 * t[na + 1];
+        }
+    }
+}
+
+/**
+ * Deposita la emisión de fuentes puntuales (vehículos) en la celda que contiene a cada una:
+ * grids[s, i, j] += rates[k, s] * dt. Las fuentes fuera del dominio o dentro de un edificio
+ * se descartan. Con varias especies los hilos se reparten las especies, así que cada uno
+ * escribe en su propio plano sin operaciones atómicas.
+ */
+void cs_deposit_point_sources(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, ptrdiff_t n,
+                              const double *x, const double *y, const double *rates, double dt,
+                              double x_min, double x_max, double y_min, double y_max, const uint8_t *obstacles) {
+    const ptrdiff_t row_bytes = CS_ROW_BYTES(nx);
+    const double sx = nx / (x_max - x_min), sy = ny / (y_max - y_min);
+    const ptrdiff_t plane = ny * nx;
+
+    #pragma omp parallel for schedule(static) if (n_species > 1)
+    for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+        double *grid = grids + sp * plane;
+        for (ptrdiff_t k = 0; k < n; k++) {
+            double fi = floor((y[k] - y_min) * sy), fj = floor((x[k] - x_min) * sx);
+            if (fi < 0.0 || fi >= ny || fj < 0.0 || fj >= nx) continue;
+            ptrdiff_t i = (ptrdiff_t) fi, j = (ptrdiff_t) fj;
+            if (obstacles != NULL && IS_SOLID(obstacles, row_bytes, i, j)) continue;
+            grid[i * nx + j] += rates[k * n_species + sp] * dt;
+        }
+    }
+}
+
+/**
+ * Paso de química por celda (separado del transporte): equilibrio fotoestacionario
+ * NO2 + hv -> NO + O3, NO + O3 -> NO2 y formación de aerosol secundario de primer orden
+ * (NO2 -> nitrato, SO2 -> sulfato). Las mallas guardan masa por celda en exceso sobre el
+ * fondo; se pasan a ppb con scale (ppb por unidad de malla) y background (ppb). El aerosol
+ * solo se forma a partir del exceso (el fondo regional se supone en equilibrio).
+ *
+ * El sistema NO/NO2/O3 conserva NOx = NO + NO2 y Ox = O3 + NO2, así que Euler implícito
+ * para x = NO2 se reduce a la cuadrática a x² - b x + c = 0 con a = dt k, b = 1 + dt j +
+ * a (NOx + Ox), c = NO2 + a NOx Ox, cuya raíz pequeña (forma estable 2c / (b + sqrt(b² -
+ * 4ac))) queda en [0, min(NOx, Ox)]: incondicionalmente estable y sin saltos por celda.
+ * Las pérdidas de primer orden también son implícitas: C / (1 + dt k).
+ *
+ * roles son los índices de NO, NO2, O3, precursor de nitrato y SO2 (-1 si no está) y pm las
+ * especies que reciben el aerosol. keep (o NULL) es la fracción de cada especie que sobrevive
+ * a la deposición del paso, aplicada en el mismo recorrido; los valores menores que floor
+ * pasan a cero exacto. tiles solo es válido si el exceso nulo es estacionario (fondo en
+ * equilibrio) y se actualiza con las teselas que quedan a cero.
+ */
+long cs_chemistry_step(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, const int32_t *roles,
+                       const int32_t *pm, ptrdiff_t n_pm, const double *scale, const double *bg,
+                       double dt, double j_no2, double k_no_o3, double k_nitrate, double k_sulfate,
+                       const double *keep, double floor_value, uint8_t *tiles) {
+    const ptrdiff_t plane = ny * nx;
+    const int32_t ino = roles[0], ino2 = roles[1], io3 = roles[2], init = roles[3], iso2 = roles[4];
+    const int photo = ino >= 0 && ino2 >= 0 && io3 >= 0;
+    double *gno = photo ? grids + ino * plane : NULL, *gno2 = photo ? grids + ino2 * plane : NULL;
+    double *go3 = photo ? grids + io3 * plane : NULL;
+    double *gnit = init >= 0 ? grids + init * plane : NULL, *gso2 = iso2 >= 0 ? grids + iso2 * plane : NULL;
+    const double a = dt * k_no_o3, b0 = 1.0 + dt * j_no2;
+    const double keep_nit = 1.0 / (1.0 + dt * k_nitrate), keep_so2 = 1.0 / (1.0 + dt * k_sulfate);
+    // Masa de aerosol por masa de precursor perdida (NO3-/NO2, SO4--/SO2)
+    const double yield_nit = 62.0 / 46.0, yield_so2 = 96.0 / 64.0;
+
+    ptrdiff_t tx = CS_TILES(nx), n_tiles = CS_TILES(ny) * tx;
+    long live = 0;
+    unsigned long long ftz = cs_ftz_enter();
+    #pragma omp parallel for schedule(dynamic, 4) reduction(+:live)
+    for (ptrdiff_t t = 0; t < n_tiles; t++) {
+        if (tiles != NULL && !tiles[t]) continue;
+        ptrdiff_t i0 = t / tx * TILE_SIZE, j0 = t % tx * TILE_SIZE;
+        ptrdiff_t i1 = i0 + TILE_SIZE < ny ? i0 + TILE_SIZE : ny, j1 = j0 + TILE_SIZE < nx ? j0 + TILE_SIZE : nx;
+        int any = 0;
+        for (ptrdiff_t i = i0; i < i1; i++) {
+            for (ptrdiff_t p = i * nx + j0; p < i * nx + j1; p++) {
+                if (photo) {
+                    double no = fmax(bg[ino] + gno[p] * scale[ino], 0.0);
+                    double no2 = fmax(bg[ino2] + gno2[p] * scale[ino2], 0.0);
+                    double o3 = fmax(bg[io3] + go3[p] * scale[io3], 0.0);
+                    double nox = no + no2, ox = o3 + no2;
+                    double b = b0 + a * (nox + ox), c = no2 + a * nox * ox;
+                    double x = 2.0 * c / (b + sqrt(fmax(b * b - 4.0 * a * c, 0.0)));
+                    gno[p] = (nox - x - bg[ino]) / scale[ino];
+                    gno2[p] = (x - bg[ino2]) / scale[ino2];
+                    go3[p] = (ox - x - bg[io3]) / scale[io3];
+                }
+                double formed = 0.0;
+                if (gnit != NULL) {
+                    double lost = fmax(gnit[p], 0.0) * (1.0 - keep_nit);
+                    gnit[p] -= lost;
+                    formed += lost * yield_nit;
+                }
+                if (gso2 != NULL) {
+                    double lost = fmax(gso2[p], 0.0) * (1.0 - keep_so2);
+                    gso2[p] -= lost;
+                    formed += lost * yield_so2;
+                }
+                for (ptrdiff_t k = 0; k < n_pm; k++) {
+                    grids[pm[k] * plane + p] += formed;
+                }
+                for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+                    double v = grids[sp * plane + p] * (keep != NULL ? keep[sp] : 1.0);
+                    v = fabs(v) < floor_value ? 0.0 : v;
+                    grids[sp * plane + p] = v;
+                    any |= v != 0.0;
+                }
+            }
+        }
+        if (tiles != NULL) tiles[t] = (uint8_t) any;
+        live += any;
+    }
+    cs_ftz_leave(ftz);
+    return live;
+}
+
+/**
+ * Pasada de eliminación física sin química: grids[s] *= keep[s] (deposición seca, lavado
+ * por lluvia y sedimentación del paso, ver modules/deposition.py), con FTZ/DAZ y los valores
+ * menores que floor (en módulo) a cero exacto para que el campo lejano no acabe en
+ * subnormales. Con tiles salta las teselas muertas y marca como muertas las que quedan a
+ * cero en todas las especies. Paralelizado por teselas.
+ */
+long cs_decay_grids(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, const double *keep,
+                    double floor_value, uint8_t *tiles) {
+    ptrdiff_t tx = CS_TILES(nx), n_tiles = CS_TILES(ny) * tx;
+    long live = 0;
+
+    unsigned long long ftz = cs_ftz_enter();
+    #pragma omp parallel for schedule(dynamic, 4) reduction(+:live)
+    for (ptrdiff_t t = 0; t < n_tiles; t++) {
+        if (tiles != NULL && !tiles[t]) continue;
+        ptrdiff_t i0 = t / tx * TILE_SIZE, j0 = t % tx * TILE_SIZE;
+        ptrdiff_t i1 = i0 + TILE_SIZE < ny ? i0 + TILE_SIZE : ny, j1 = j0 + TILE_SIZE < nx ? j0 + TILE_SIZE : nx;
+        int any = 0;
+        for (ptrdiff_t sp = 0; sp < n_species; sp++) {
+            const double f = keep[sp];
+            for (ptrdiff_t i = i0; i < i1; i++) {
+                double *row = grids + (sp * ny + i) * nx;
+                for (ptrdiff_t j = j0; j < j1; j++) {
+                    double v = row[j] * f;
+                    v = fabs(v) < floor_value ? 0.0 : v;
+                    row[j] = v;
+                    any |= v != 0.0;
+                }
+            }
+        }
+        if (tiles != NULL) tiles[t] = (uint8_t) any;
+        live += any;
+    }
+    cs_ftz_leave(ftz);
+    return live;
+}
+
+/**
+ * Pluma gaussiana de fuentes puntuales (vehículos) evaluada a varias alturas de receptor en
+ * una sola pasada (2.5D): los términos horizontales (distancia, ángulo con el viento,
+ * sigma_y, sigma_z y dispersión lateral) se calculan una vez por celda y fuente y solo el
+ * término vertical con reflexión en el suelo, exp(-(z - H)² / 2sz²) + exp(-(z + H)² / 2sz²),
+ * se evalúa por capa. En z = 0 coincide con el término 2 exp(-H² / 2sz²) de update_pollution.
+ * Cada hilo escribe en sus propias filas, sin operaciones atómicas.
+ */
+void cs_update_pollution_layers(double *grids, ptrdiff_t n_layers, ptrdiff_t ny, ptrdiff_t nx,
+                                const double *src, ptrdiff_t n, const double *z,
+                                double wind_speed, double wind_direction, const char *stability_class,
+                                double x_min, double x_max, double y_min, double y_max, const uint8_t *obstacles) {
+    const ptrdiff_t row_bytes = CS_ROW_BYTES(nx);
+    const double cw = (x_max - x_min) / nx, ch = (y_max - y_min) / ny;
+    const double u = wind_speed > 0.5 ? wind_speed : 0.5;
+    const ptrdiff_t plane = ny * nx;
+
+    unsigned long long ftz = cs_ftz_enter();
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (ptrdiff_t i = 0; i < ny; i++) {
+        double receptor_y = y_min + (i + 0.5) * ch;
+        for (ptrdiff_t k = 0; k < n; k++) {
+            const double *sk = src + 4 * k;
+            double x = sk[0], y = sk[1], q = sk[2], H = sk[3];
+            // Misma ventana de ±100 m que update_pollution
+            if (fabs(receptor_y - y) > 100.0) continue;
+            ptrdiff_t j_min = (ptrdiff_t) fmax(0.0, (x - x_min - 100.0) / cw);
+            ptrdiff_t j_max = (ptrdiff_t) fmin((double) nx, (x - x_min + 100.0) / cw);
+            double factor = q / (2.0 * M_PI * u);
+            for (ptrdiff_t j = j_min; j < j_max; j++) {
+                if (obstacles != NULL && IS_SOLID(obstacles, row_bytes, i, j)) continue;
+                double dx = x_min + (j + 0.5) * cw - x, dy = receptor_y - y;
+                double d2 = dx * dx + dy * dy;
+                if (d2 < 1.0 || d2 > 90000.0) continue;
+                double distance = sqrt(d2);
+                double angle_diff = fabs(atan2(dy, dx) - wind_direction);
+                if (angle_diff > M_PI) angle_diff = 2.0 * M_PI - angle_diff;
+                double sigma_y, sigma_z;
+                cs_dispersion_coefficients(stability_class, distance, &sigma_y, &sigma_z);
+                double horizontal = factor * exp(-0.5 * (angle_diff / sigma_y) * (angle_diff / sigma_y))
+                                    / (sigma_y * sigma_z);
+                double inv = 0.5 / (sigma_z * sigma_z);
+                for (ptrdiff_t l = 0; l < n_layers; l++) {
+                    double below = z[l] - H, above = z[l] + H;
+                    grids[l * plane + i * nx + j] += horizontal * (exp(-below * below * inv) + exp(-above * above * inv));
+                }
+            }
+        }
+    }
+    cs_ftz_leave(ftz);
+}
+
+/**
+ * Intercambio vertical entre capas por difusión turbulenta (Kz) con Euler implícito: en cada
+ * columna se resuelve un sistema tridiagonal con flujo nulo en el suelo y en la cima, que
+ * conserva sum_k c_k dz_k con cualquier dt. Los coeficientes son iguales en todas las
+ * columnas, así que la factorización de Thomas se calcula una vez y las sustituciones se
+ * hacen capa a capa sobre el plano completo (acceso contiguo). heights son los centros de
+ * capa en m y deben ser estrictamente crecientes (si no, CS_ERR_VALUE).
+ */
+int cs_vertical_exchange(double *grids, ptrdiff_t n_layers, ptrdiff_t plane, const double *z, double kz, double dt) {
+    for (ptrdiff_t l = 1; l < n_layers; l++) {
+        if (z[l] <= z[l - 1]) {
+            return CS_ERR_VALUE;
+        }
+    }
+    if (n_layers < 2 || kz <= 0.0 || dt <= 0.0) {
+        return CS_OK;
+    }
+
+    // Coeficientes: lower[l] c_{l-1} + diag[l] c_l + upper[l] c_{l+1} = c_l (anterior)
+    double *coef = (double*) malloc(4 * n_layers * sizeof(double));
+    if (coef == NULL) {
+        return CS_ERR_NOMEM;
+    }
+    double *lower = coef, *upper = coef + n_layers, *cprime = coef + 2 * n_layers, *inv = coef + 3 * n_layers;
+    for (ptrdiff_t l = 0; l < n_layers; l++) {
+        double bottom = l == 0 ? 0.0 : 0.5 * (z[l - 1] + z[l]);
+        double top = l == n_layers - 1 ? z[l] + (z[l] - bottom) : 0.5 * (z[l] + z[l + 1]);
+        double dz = top - bottom;
+        lower[l] = l == 0 ? 0.0 : -dt * kz / (dz * (z[l] - z[l - 1]));
+        upper[l] = l == n_layers - 1 ? 0.0 : -dt * kz / (dz * (z[l + 1] - z[l]));
+    }
+    // Factorización de Thomas (común a todas las columnas)
+    for (ptrdiff_t l = 0; l < n_layers; l++) {
+        double diag = 1.0 - lower[l] - upper[l];
+        double denom = diag - (l > 0 ? lower[l] * cprime[l - 1] : 0.0);
+        inv[l] = 1.0 / denom;
+        cprime[l] = upper[l] * inv[l];
+    }
+
+    unsigned long long ftz = cs_ftz_enter();
+    #pragma omp parallel
+    {
+        // Sustitución hacia delante y hacia atrás, capa a capa sobre el plano
+        for (ptrdiff_t l = 0; l < n_layers; l++) {
+            double *cur = grids + l * plane;
+            const double *prev = l > 0 ? grids + (l - 1) * plane : NULL;
+            #pragma omp for schedule(static)
+            for (ptrdiff_t p = 0; p < plane; p++) {
+                cur[p] = (cur[p] - (prev != NULL ? lower[l] * prev[p] : 0.0)) * inv[l];
+            }
+        }
+        for (ptrdiff_t l = n_layers - 2; l >= 0; l--) {
+            double *cur = grids + l * plane;
+            const double *next = grids + (l + 1) * plane;
+            #pragma omp for schedule(static)
+            for (ptrdiff_t p = 0; p < plane; p++) {
+                cur[p] -= cprime[l] * next[p];
+            }
+        }
+    }
+    cs_ftz_leave(ftz);
+    free(coef);
+    return CS_OK;
+}
@@ -0,0 +1,109 @@
+// cs_core.h - Núcleos de dispersión de contaminación en C puro (sin Python ni NumPy)
+// La extensión cs_module (cs_module.c) y el ejecutable cs_runner (cs_runner.c) son dos capas
+// finas sobre estas funciones: validan y convierten sus entradas y llaman aquí.
+//
+// Convenciones:
+//   - Las mallas son double C-contiguas; las pilas de especies o capas son [S, ny, nx].
+//   - obstacles es la máscara empaquetada de edificios (un bit por celda, filas de
+//     (nx + 7) / 8 bytes, bit j % 8 del byte j / 8) o NULL.
+//   - tiles son los indicadores de teselas vivas (uint8 [ceil(ny / TILE_SIZE), ceil(nx / TILE_SIZE)],
+//     0 = todas las celdas a cero en todas las especies) o NULL.
+//   - Las funciones que reservan memoria devuelven CS_ERR_NOMEM si no hay; las que validan
+//     argumentos que solo se conocen aquí, CS_ERR_VALUE.
+
+#ifndef CS_CORE_H
+#define CS_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef M_PI
+    #define M_PI 3.14159265358979323846  // Definir pi si no está disponible
+#endif
+
+// Lado (celdas) de las teselas con indicador "todo cero" que saltan decaimiento y difusión
+#define TILE_SIZE 32
+
+#define CS_OK 0
+#define CS_ERR_NOMEM (-1)
+#define CS_ERR_VALUE (-2)
+
+// Celda (i, j) dentro de un edificio en la máscara empaquetada
+#define IS_SOLID(bits, row_bytes, i, j) (((bits)[(i) * (row_bytes) + ((j) >> 3)] >> ((j) & 7)) & 1)
+
+#define CS_ROW_BYTES(nx) (((nx) + 7) / 8)
+#define CS_TILES(n) (((n) + TILE_SIZE - 1) / TILE_SIZE)
+
+// Modelo de emisión y pluma de un vehículo
+void cs_dispersion_coefficients(const char *stability_class, double distance, double *sigma_y, double *sigma_z);
+double cs_emission_rate(double vehicle_speed, double emission_factor);
+double cs_plume_rise(double vehicle_speed);
+
+// Flush-to-zero / denormals-are-zero en los hilos de OpenMP (ver cs_core.c)
+unsigned long long cs_ftz_enter(void);
+void cs_ftz_leave(unsigned long long saved);
+
+// Pluma gaussiana de un vehículo en la ventana [i_min, i_max) x [j_min, j_max) (malla con pasos s0, s1)
+void cs_update_pollution(double *data, ptrdiff_t s0, ptrdiff_t s1, ptrdiff_t nx,
+                         int i_min, int i_max, int j_min, int j_max,
+                         double x, double y, double emission_rate, double plume_height,
+                         double wind_speed, double wind_direction,
+                         double x_min, double x_max, double y_min, double y_max, int grid_resolution,
+                         const uint8_t *obstacles);
+
+// Decaimiento con umbral y pluma de n vehículos (vehicles [n, 3]: x, y, velocidad)
+void cs_update_pollution_multiple(double *data, ptrdiff_t s0, ptrdiff_t s1, ptrdiff_t ny, ptrdiff_t nx,
+                                  const double *vehicles, ptrdiff_t n, double wind_speed, double wind_direction,
+                                  double emission_factor, const char *stability_class,
+                                  double x_min, double x_max, double y_min, double y_max, int grid_resolution,
+                                  const uint8_t *obstacles, double decay, double floor_value);
+
+// Transporte de una malla [ny, nx] in situ
+int cs_advect_wind_field(double *data, ptrdiff_t ny, ptrdiff_t nx, const double *wind, double dt,
+                         double cell_width, double cell_height, int conservative, const uint8_t *obstacles);
+int cs_advect_grid(double *data, ptrdiff_t ny, ptrdiff_t nx, double wind_speed, double wind_direction, double dt,
+                   double cell_width, double cell_height, const uint8_t *obstacles);
+int cs_diffuse_grid(double *data, ptrdiff_t ny, ptrdiff_t nx, double diffusion_coeff, double dt,
+                    double cell_width, double cell_height, const uint8_t *obstacles, const uint8_t *tiles);
+
+// Bocanadas (puffs)
+void cs_puff_advect(ptrdiff_t n, double *x, double *y, double *sigma, double *dist, double *age,
+                    const uint8_t *active, double dt, double wind_speed, double wind_direction,
+                    double sigma_a, double sigma0, const double *wind, ptrdiff_t ny, ptrdiff_t nx,
+                    double x_min, double x_max, double y_min, double y_max);
+int cs_puff_rasterize(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, ptrdiff_t n,
+                      const double *x, const double *y, const double *sigma, const double *mass,
+                      const uint8_t *active, double x_min, double x_max, double y_min, double y_max);
+void cs_puff_sample(double *out, ptrdiff_t m, ptrdiff_t n_species, const double *px, const double *py, ptrdiff_t n,
+                    const double *x, const double *y, const double *sigma, const double *mass,
+                    const uint8_t *active, double cell_area);
+
+// Cañones urbanos y emisiones
+void cs_canyon_concentration(double *out, ptrdiff_t m, ptrdiff_t n_species, const int32_t *canyon,
+                             const double *offset, ptrdiff_t n_canyons, const double *width, const double *height,
+                             const double *orientation, const double *q, double wind_speed, double wind_direction,
+                             double sigma_wt);
+void cs_emission_lookup(double *out, ptrdiff_t n, ptrdiff_t n_species, const int32_t *cls, const double *speed,
+                        const double *accel, const double *table, ptrdiff_t n_classes, ptrdiff_t nv, ptrdiff_t na,
+                        double v0, double dv, double a0, double da);
+void cs_deposit_point_sources(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, ptrdiff_t n,
+                              const double *x, const double *y, const double *rates, double dt,
+                              double x_min, double x_max, double y_min, double y_max, const uint8_t *obstacles);
+
+// Química y eliminación física de una pila [S, ny, nx]; devuelven el número de teselas vivas
+long cs_chemistry_step(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, const int32_t *roles,
+                       const int32_t *pm, ptrdiff_t n_pm, const double *scale, const double *background,
+                       double dt, double j_no2, double k_no_o3, double k_nitrate, double k_sulfate,
+                       const double *keep, double floor_value, uint8_t *tiles);
+long cs_decay_grids(double *grids, ptrdiff_t n_species, ptrdiff_t ny, ptrdiff_t nx, const double *keep,
+                    double floor_value, uint8_t *tiles);
+
+// Capas verticales [L, ny, nx] (sources [n, 4]: x, y, emisión, altura efectiva)
+void cs_update_pollution_layers(double *grids, ptrdiff_t n_layers, ptrdiff_t ny, ptrdiff_t nx,
+                                const double *sources, ptrdiff_t n, const double *heights,
+                                double wind_speed, double wind_direction, const char *stability_class,
+                                double x_min, double x_max, double y_min, double y_max, const uint8_t *obstacles);
+int cs_vertical_exchange(double *grids, ptrdiff_t n_layers, ptrdiff_t plane, const double *heights,
+                         double kz, double dt);
+
+#endif  // CS_CORE_H
@@ -1,96 +1,123 @@
 // cs_module.c - Módulo C optimizado para cálculos de dispersión de contaminación
 // Este módulo proporciona funciones de alto rendimiento para calcular la dispersión de contaminantes
-// utilizando el modelo gaussiano de dispersión.
+// utilizando el modelo gaussiano de dispersión. Es una capa fina sobre los núcleos de cs_core.c:
+// aquí solo se leen y validan los argumentos de Python y se traducen los códigos de error.
+// Cada núcleo se ejecuta sin el GIL (Py_BEGIN_ALLOW_THREADS), así que varias simulaciones pueden
+// avanzar en hilos de un mismo proceso; el llamante no debe modificar las mismas mallas a la vez.
 
 #define PY_SSIZE_T_CLEAN
-#ifndef M_PI
-    #define M_PI 3.14159265358979323846  // Definir pi si no está disponible
-#endif
 #include <Python.h>
-#include <math.h>
 #include <numpy/arrayobject.h>
-#include <string.h>
+#include <stdlib.h>
+
+#include "cs_core.h"
+
+#if PY_VERSION_HEX < 0x030D0000
+// PyList_GetItemRef (3.13): elemento con referencia propia, válido aunque otro hilo modifique la lista
+static PyObject* PyList_GetItemRef(PyObject *list, Py_ssize_t i) {
+    PyObject *item = PyList_GetItem(list, i);
+    Py_XINCREF(item);
+    return item;
+}
+#endif
 
 /**
- * Calcula los coeficientes de dispersión basados en la distancia y clase de estabilidad.
- * 
- * @param stability_class Clase de estabilidad atmosférica (A-F)
- * @param distance Distancia desde la fuente en metros
- * @param sigma_y Puntero donde se guardará el coeficiente de dispersión horizontal
- * @param sigma_z Puntero donde se guardará el coeficiente de dispersión vertical
+ * Traduce un código de error de cs_core a una excepción de Python. Devuelve 1 si no hay error.
  */
-static void calculate_dispersion_coefficients(const char* stability_class, double distance, double* sigma_y, double* sigma_z) {
-    double a, b;
-    
-    // Parámetros según la clase de estabilidad
-    if (strcmp(stability_class, "A") == 0) {
-        a = 0.22; b = 0.20;
-    } else if (strcmp(stability_class, "B") == 0) {
-        a = 0.16; b = 0.12;
-    } else if (strcmp(stability_class, "C") == 0) {
-        a = 0.11; b = 0.08;
-    } else if (strcmp(stability_class, "D") == 0) {
-        a = 0.08; b = 0.06;
-    } else if (strcmp(stability_class, "E") == 0) {
-        a = 0.06; b = 0.03;
-    } else if (strcmp(stability_class, "F") == 0) {
-        a = 0.04; b = 0.016;
-    } else {
-        // Valor por defecto (clase D - neutral)
-        a = 0.10; b = 0.05;
-    }
-    
-    // Cálculo de los coeficientes según fórmulas estándar
-    *sigma_y = a * distance * pow(1 + 0.0001 * distance, -0.5);
-    *sigma_z = b * distance * pow(1 + 0.0001 * distance, -0.5);
+static int check_status(long status) {
+    if (status == CS_ERR_NOMEM) {
+        PyErr_NoMemory();
+        return 0;
+    }
+    return 1;
 }
 
 /**
- * Calcula la tasa de emisión de contaminantes de un vehículo basada en su velocidad.
- * 
- * @param vehicle_speed Velocidad del vehículo en m/s
- * @param emission_factor Factor de emisión global configurado por el usuario
- * @return Tasa de emisión calculada
+ * Valida la matriz opcional de teselas vivas (uint8 [ceil(ny / TILE_SIZE), ceil(nx / TILE_SIZE)],
+ * 0 = tesela con todas las celdas a cero en todas las especies). None -> *tiles = NULL.
  */
-static double calculate_emission_rate(double vehicle_speed, double emission_factor) {
-    double base_emission = 0.1;  // Emisión base para cualquier vehículo
-    
-    // Aumentar emisión para velocidades altas (>20 m/s)
-    double speed_factor = (vehicle_speed > 20) ? 
-                         (1 + 0.05 * (vehicle_speed - 20)) : 1.0;
-    
-    // Aplicar factor de emisión global (configurable por el usuario)
-    return base_emission * speed_factor * emission_factor;
+static int parse_tiles(PyObject *obj, npy_intp ny, npy_intp nx, uint8_t **tiles) {
+    npy_intp ty = CS_TILES(ny), tx = CS_TILES(nx);
+    *tiles = NULL;
+    if (obj == NULL || obj == Py_None) {
+        return 1;
+    }
+    PyArrayObject *array = (PyArrayObject*) obj;
+    if (!PyArray_Check(obj) || PyArray_TYPE(array) != NPY_UINT8 || PyArray_NDIM(array) != 2
+            || !PyArray_IS_C_CONTIGUOUS(array) || PyArray_DIM(array, 0) != ty || PyArray_DIM(array, 1) != tx) {
+        PyErr_Format(PyExc_TypeError, "tiles debe ser un array uint8 C-contiguo [%zd, %zd]",
+                     (Py_ssize_t)ty, (Py_ssize_t)tx);
+        return 0;
+    }
+    *tiles = (uint8_t*) PyArray_DATA(array);
+    return 1;
 }
 
 /**
- * Calcula la altura de la pluma de contaminación basada en la velocidad del vehículo.
- * 
- * @param vehicle_speed Velocidad del vehículo en m/s
- * @return Altura de la pluma en metros (mínimo 2 metros)
+ * Valida la máscara de obstáculos opcional (None -> *bits = NULL). Devuelve 0 si no es válida.
+ * Es un bit por celda, filas de (nx + 7) / 8 bytes con el bit j % 8 del byte j / 8 para la
+ * columna j (np.packbits(..., bitorder='little')).
  */
-static double calculate_plume_rise(double vehicle_speed) {
-    // La altura aumenta con la velocidad pero tiene un mínimo de 2 metros
-    return (vehicle_speed * 0.15 + 0.5 > 2.0) ? 
-           (vehicle_speed * 0.15 + 0.5) : 2.0;
+static int parse_obstacles(PyObject *obj, npy_intp ny, npy_intp nx, const uint8_t **bits) {
+    npy_intp row_bytes = CS_ROW_BYTES(nx);
+    *bits = NULL;
+    if (obj == NULL || obj == Py_None) {
+        return 1;
+    }
+    PyArrayObject *mask = (PyArrayObject*) obj;
+    if (!PyArray_Check(obj) || PyArray_TYPE(mask) != NPY_UINT8 || PyArray_NDIM(mask) != 2
+            || !PyArray_IS_C_CONTIGUOUS(mask) || PyArray_DIM(mask, 0) != ny || PyArray_DIM(mask, 1) != row_bytes) {
+        PyErr_Format(PyExc_TypeError, "obstacles debe ser un array uint8 C-contiguo [%zd, %zd] (bits empaquetados)",
+                     (Py_ssize_t)ny, (Py_ssize_t)row_bytes);
+        return 0;
+    }
+    *bits = (const uint8_t*) PyArray_DATA(mask);
+    return 1;
+}
+
+/**
+ * Valida que un objeto sea un array NumPy double C-contiguo con la dimensión indicada.
+ */
+static int check_double_array(PyArrayObject *array, int ndim, const char *name) {
+    if (!PyArray_Check(array) || PyArray_TYPE(array) != NPY_DOUBLE || PyArray_NDIM(array) != ndim
+            || !PyArray_IS_C_CONTIGUOUS(array)) {
+        PyErr_Format(PyExc_TypeError, "%s debe ser un array NumPy de %d dimensiones, tipo double y C-contiguo",
+                     name, ndim);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Valida un vector NumPy C-contiguo de n elementos del tipo indicado.
+ */
+static int check_vector(PyArrayObject *array, int type, npy_intp n, const char *name) {
+    if (!PyArray_Check(array) || PyArray_TYPE(array) != type || PyArray_NDIM(array) != 1
+            || !PyArray_IS_C_CONTIGUOUS(array) || PyArray_DIM(array, 0) != n) {
+        PyErr_Format(PyExc_TypeError, "%s debe ser un vector NumPy C-contiguo de %zd elementos del tipo esperado",
+                     name, (Py_ssize_t)n);
+        return 0;
+    }
+    return 1;
 }
 
 /**
  * Esta es la función principal que actualiza la cuadrícula de contaminación para un único vehículo.
  * Es llamada desde Python para cada vehículo en la simulación.
- * 
+ *
  * @param self Puntero al objeto Python (requerido por la API)
  * @param args Argumentos de Python empaquetados en una tupla
  * @return Objeto Python (None)
  */
 static PyObject* update_pollution(PyObject *self, PyObject *args) {
     PyArrayObject *grid;
+    PyObject *obstacles = Py_None;
     int i_min, i_max, j_min, j_max, grid_resolution;
     double x, y, emission_rate, plume_height, wind_speed, wind_direction;
     double x_min, x_max, y_min, y_max;
 
     // Extraer argumentos de Python
-    if (!PyArg_ParseTuple(args, "Oiiiiddddddddddi", 
+    if (!PyArg_ParseTuple(args, "Oiiiiddddddddddi|O",
             &grid,                         // Cuadrícula de contaminación
             &i_min, &i_max, &j_min, &j_max, // Ventana de cálculo
             &x, &y,                         // Posición del vehículo
@@ -99,7 +126,8 @@ static PyObject* update_pollution(PyObject *self, PyObject *args) {
             &wind_speed,                    // Velocidad del viento
             &wind_direction,                // Dirección del viento
             &x_min, &x_max, &y_min, &y_max, // Límites del área
-            &grid_resolution)) {            // Resolución de la cuadrícula
+            &grid_resolution,               // Resolución de la cuadrícula
+            &obstacles)) {                  // Máscara de edificios (opcional)
         return NULL;
     }
 
@@ -115,72 +143,25 @@ static PyObject* update_pollution(PyObject *self, PyObject *args) {
         PyErr_SetString(PyExc_IndexError, "Índices fuera de rango");
         return NULL;
     }
-
-    // Acceso optimizado a los datos
-    double *data = (double*) PyArray_DATA(grid);
-    npy_intp strides[2];
-    strides[0] = PyArray_STRIDE(grid, 0) / sizeof(double);
-    strides[1] = PyArray_STRIDE(grid, 1) / sizeof(double);
-
-    // Calcular tamaño de celda
-    double cell_width = (x_max - x_min) / grid_resolution;
-    double cell_height = (y_max - y_min) / grid_resolution;
-
-    // Precalcular constantes comunes para optimización
-    double two_pi = 2.0 * M_PI;
-    double emission_factor = emission_rate / (two_pi * wind_speed);
-
-    // Utilizar bucles optimizados con acceso eficiente a memoria
-    for (int i = i_min; i < i_max; i++) {
-        for (int j = j_min; j < j_max; j++) {
-            // Coordenadas del centro de la celda (i,j)
-            double receptor_x = x_min + (j + 0.5) * cell_width;
-            double receptor_y = y_min + (i + 0.5) * cell_height;
-            
-            // Distancia desde el vehículo al receptor
-            double dx = receptor_x - x;
-            double dy = receptor_y - y;
-            double distance_squared = dx * dx + dy * dy;
-            
-            // Optimización: evitar cálculos innecesarios para puntos muy cercanos
-            if (distance_squared < 1.0) continue;
-            
-            double distance = sqrt(distance_squared);
-            
-            // Evitar cálculos para puntos muy lejanos (débil contribución)
-            if (distance > 300.0) continue;
-
-            // Ángulo entre la dirección del viento y la dirección al receptor
-            double wind_dir_to_rec = atan2(dy, dx);
-            double angle_diff = fabs(wind_dir_to_rec - wind_direction);
-            if (angle_diff > M_PI)
-                angle_diff = two_pi - angle_diff;
-
-            // Calcular coeficientes de dispersión basados en la distancia
-            double sigma_y, sigma_z;
-            // Cálculo directo para evitar llamadas a función (optimización)
-            double distance_factor = pow(1 + 0.0001 * distance, -0.5);
-            sigma_y = 0.1 * distance * distance_factor;
-            sigma_z = 0.05 * distance * distance_factor;
-
-            // Calcular concentración usando la ecuación gaussiana de dispersión
-            double lateral_dispersion = exp(-0.5 * pow(angle_diff / sigma_y, 2));
-            double vertical_dispersion = exp(-0.5 * pow(plume_height / sigma_z, 2)) * 2.0; // Simplificado
-
-            double concentration = emission_factor * lateral_dispersion * vertical_dispersion / (sigma_y * sigma_z);
-            
-            // Añadir la concentración a la cuadrícula (acceso optimizado)
-            data[i * strides[0] + j * strides[1]] += concentration;
-        }
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, dims[0], dims[1], &bits)) {
+        return NULL;
     }
 
+    // Acceso optimizado a los datos (pasos en elementos, la malla puede no ser contigua)
+    Py_BEGIN_ALLOW_THREADS
+    cs_update_pollution((double*) PyArray_DATA(grid), PyArray_STRIDE(grid, 0) / sizeof(double),
+                        PyArray_STRIDE(grid, 1) / sizeof(double), dims[1], i_min, i_max, j_min, j_max,
+                        x, y, emission_rate, plume_height, wind_speed, wind_direction,
+                        x_min, x_max, y_min, y_max, grid_resolution, bits);
+    Py_END_ALLOW_THREADS
     Py_RETURN_NONE;
 }
 
 /**
  * Actualiza la cuadrícula de contaminación para múltiples vehículos en una sola llamada.
  * Esta es una versión optimizada que procesa todos los vehículos en C.
- * 
+ *
  * @param self Puntero al objeto Python
  * @param args Argumentos de Python
  * @return Objeto Python (None)
@@ -188,13 +169,15 @@ static PyObject* update_pollution(PyObject *self, PyObject *args) {
 static PyObject* update_pollution_multiple(PyObject *self, PyObject *args) {
     PyArrayObject *grid;
     PyObject *vehicle_list;  // Lista de tuplas (x, y, speed)
+    PyObject *obstacles = Py_None;
     double wind_speed, wind_direction, emission_factor;
     const char *stability_class;
     double x_min, x_max, y_min, y_max;
     int grid_resolution;
+    double decay = 0.99, floor_value = 0.0;
 
-    // CORRECCIÓN: Ajustar para aceptar 11 argumentos (formato "OOdddsdddi")
-    if (!PyArg_ParseTuple(args, "OOdddsdddi", 
+    // 11 argumentos obligatorios más la máscara de edificios, el factor de decaimiento y el umbral opcionales
+    if (!PyArg_ParseTuple(args, "OOdddsddddi|Odd",
             &grid,                // Cuadrícula de contaminación
             &vehicle_list,        // Lista de vehículos
             &wind_speed,          // Velocidad del viento
@@ -202,7 +185,10 @@ static PyObject* update_pollution_multiple(PyObject *self, PyObject *args) {
             &emission_factor,     // Factor de emisión
             &stability_class,     // Clase de estabilidad
             &x_min, &x_max, &y_min, &y_max, // Límites del área
-            &grid_resolution)) {  // Resolución de la cuadrícula
+            &grid_resolution,     // Resolución de la cuadrícula
+            &obstacles,           // Máscara de edificios (opcional)
+            &decay,               // Fracción que queda tras la eliminación física (opcional)
+            &floor_value)) {      // Valores menores (en módulo) pasan a cero exacto (opcional)
         return NULL;
     }
 
@@ -218,106 +204,689 @@ static PyObject* update_pollution_multiple(PyObject *self, PyObject *args) {
         return NULL;
     }
 
-    // Aplicar decaimiento global (factor 0.99)
-    double *data = (double*) PyArray_DATA(grid);
-    npy_intp size = PyArray_SIZE(grid);
-    for (npy_intp i = 0; i < size; i++) {
-        data[i] *= 0.99;
-    }
-
-    // Acceso optimizado a los datos
-    npy_intp strides[2];
-    strides[0] = PyArray_STRIDE(grid, 0) / sizeof(double);
-    strides[1] = PyArray_STRIDE(grid, 1) / sizeof(double);
     npy_intp* dims = PyArray_DIMS(grid);
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, dims[0], dims[1], &bits)) {
+        return NULL;
+    }
 
-    double cell_width = (x_max - x_min) / grid_resolution;
-    double cell_height = (y_max - y_min) / grid_resolution;
-
-    // Recorrer todos los vehículos
+    // Copiar los vehículos a un buffer [n, 3] antes de soltar el GIL. Cada elemento se toma con
+    // referencia propia: sin GIL (3.13t) otro hilo puede modificar la lista mientras se recorre
+    // y, si la acorta, PyList_GetItemRef lanza IndexError
     Py_ssize_t num_vehicles = PyList_Size(vehicle_list);
+    double *vehicles = (double*) malloc(3 * (num_vehicles > 0 ? num_vehicles : 1) * sizeof(double));
+    if (vehicles == NULL) {
+        return PyErr_NoMemory();
+    }
     for (Py_ssize_t v = 0; v < num_vehicles; v++) {
-        PyObject *vehicle_tuple = PyList_GetItem(vehicle_list, v);
+        PyObject *vehicle_tuple = PyList_GetItemRef(vehicle_list, v);
+        if (vehicle_tuple == NULL) {
+            free(vehicles);
+            return NULL;
+        }
         if (!PyTuple_Check(vehicle_tuple) || PyTuple_Size(vehicle_tuple) != 3) {
             PyErr_SetString(PyExc_ValueError, "Cada vehículo debe ser una tupla (x, y, speed)");
+            Py_DECREF(vehicle_tuple);
+            free(vehicles);
             return NULL;
         }
+        for (int c = 0; c < 3; c++) {
+            vehicles[3 * v + c] = PyFloat_AsDouble(PyTuple_GET_ITEM(vehicle_tuple, c));
+        }
+        Py_DECREF(vehicle_tuple);
+        if (PyErr_Occurred()) {
+            free(vehicles);
+            return NULL;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_update_pollution_multiple((double*) PyArray_DATA(grid), PyArray_STRIDE(grid, 0) / sizeof(double),
+                                 PyArray_STRIDE(grid, 1) / sizeof(double), dims[0], dims[1],
+                                 vehicles, num_vehicles, wind_speed, wind_direction, emission_factor,
+                                 stability_class, x_min, x_max, y_min, y_max, grid_resolution, bits,
+                                 decay, floor_value);
+    Py_END_ALLOW_THREADS
+    free(vehicles);
+    Py_RETURN_NONE;
+}
+
+/**
+ * Advección semi-lagrangiana con un campo de viento espacialmente variable (ver
+ * cs_advect_wind_field).
+ *
+ * Argumentos Python: grid [ny, nx], wind_field [ny, nx, 2] (vx, vy en m/s), dt,
+ * cell_width, cell_height, conservative (opcional, 0 por defecto) y obstacles (opcional,
+ * máscara empaquetada de edificios: no se interpola ni se deposita masa dentro de ellos).
+ * Modifica grid in situ.
+ */
+static PyObject* advect_wind_field(PyObject *self, PyObject *args) {
+    PyArrayObject *grid, *wind;
+    PyObject *obstacles = Py_None;
+    double dt, cell_width, cell_height;
+    int conservative = 0;
+
+    if (!PyArg_ParseTuple(args, "OOddd|iO", &grid, &wind, &dt, &cell_width, &cell_height, &conservative,
+                          &obstacles)) {
+        return NULL;
+    }
+    if (!check_double_array(grid, 2, "El grid") || !check_double_array(wind, 3, "El campo de viento")) {
+        return NULL;
+    }
+    npy_intp ny = PyArray_DIM(grid, 0), nx = PyArray_DIM(grid, 1);
+    if (PyArray_DIM(wind, 0) != ny || PyArray_DIM(wind, 1) != nx || PyArray_DIM(wind, 2) != 2) {
+        PyErr_SetString(PyExc_ValueError, "El campo de viento debe tener forma [ny, nx, 2]");
+        return NULL;
+    }
+    if (cell_width <= 0.0 || cell_height <= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "El tamaño de celda debe ser positivo");
+        return NULL;
+    }
+
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, ny, nx, &bits)) {
+        return NULL;
+    }
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    status = cs_advect_wind_field((double*) PyArray_DATA(grid), ny, nx, (const double*) PyArray_DATA(wind),
+                                  dt, cell_width, cell_height, conservative, bits);
+    Py_END_ALLOW_THREADS
+    if (!check_status(status)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/**
+ * Advección conservativa en forma de flujo con viento uniforme (ver cs_advect_grid). Si el
+ * número de Courant supera 1 el paso se subdivide internamente, así que dt puede ser mayor
+ * que el tamaño de celda / velocidad.
+ *
+ * Argumentos Python: grid [ny, nx], wind_speed (m/s), wind_direction (rad), dt,
+ * cell_width, cell_height y obstacles (opcional, máscara empaquetada de edificios con
+ * paredes sin flujo). Modifica grid in situ. Devuelve el número de subpasos.
+ */
+static PyObject* advect_grid(PyObject *self, PyObject *args) {
+    PyArrayObject *grid;
+    PyObject *obstacles = Py_None;
+    double wind_speed, wind_direction, dt, cell_width, cell_height;
+
+    if (!PyArg_ParseTuple(args, "Oddddd|O", &grid, &wind_speed, &wind_direction, &dt,
+                          &cell_width, &cell_height, &obstacles)) {
+        return NULL;
+    }
+    if (!check_double_array(grid, 2, "El grid")) {
+        return NULL;
+    }
+    if (cell_width <= 0.0 || cell_height <= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "El tamaño de celda debe ser positivo");
+        return NULL;
+    }
+
+    npy_intp ny = PyArray_DIM(grid, 0), nx = PyArray_DIM(grid, 1);
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, ny, nx, &bits)) {
+        return NULL;
+    }
+    int substeps;
+    Py_BEGIN_ALLOW_THREADS
+    substeps = cs_advect_grid((double*) PyArray_DATA(grid), ny, nx, wind_speed, wind_direction, dt,
+                              cell_width, cell_height, bits);
+    Py_END_ALLOW_THREADS
+    if (!check_status(substeps)) {
+        return NULL;
+    }
+    return PyLong_FromLong(substeps);
+}
+
+/**
+ * Difusión explícita con el laplaciano de 5 puntos y fronteras de flujo nulo (ver
+ * cs_diffuse_grid).
+ *
+ * Argumentos Python: grid [ny, nx], diffusion_coeff (m²/s), dt, cell_width, cell_height,
+ * obstacles (opcional, máscara empaquetada de edificios: las fachadas son también fronteras
+ * de flujo nulo y el interior no cambia) y tiles (opcional, teselas vivas de parse_tiles, solo
+ * lectura). Con tiles únicamente se calculan las teselas a menos de "substeps" celdas de una
+ * tesela viva: el resto vale cero y seguirá valiendo cero. Modifica grid in situ. Si el número
+ * de difusión supera 0.5 (inestable) el paso se subdivide internamente. Devuelve el número de
+ * subpasos.
+ */
+static PyObject* diffuse_grid(PyObject *self, PyObject *args) {
+    PyArrayObject *grid;
+    PyObject *obstacles = Py_None, *otiles = Py_None;
+    double diffusion_coeff, dt, cell_width, cell_height;
+
+    if (!PyArg_ParseTuple(args, "Odddd|OO", &grid, &diffusion_coeff, &dt, &cell_width, &cell_height,
+                          &obstacles, &otiles)) {
+        return NULL;
+    }
+    if (!check_double_array(grid, 2, "El grid")) {
+        return NULL;
+    }
+    if (cell_width <= 0.0 || cell_height <= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "El tamaño de celda debe ser positivo");
+        return NULL;
+    }
+
+    npy_intp ny = PyArray_DIM(grid, 0), nx = PyArray_DIM(grid, 1);
+    const uint8_t *bits;
+    uint8_t *tiles;
+    if (!parse_obstacles(obstacles, ny, nx, &bits) || !parse_tiles(otiles, ny, nx, &tiles)) {
+        return NULL;
+    }
+    int substeps;
+    Py_BEGIN_ALLOW_THREADS
+    substeps = cs_diffuse_grid((double*) PyArray_DATA(grid), ny, nx, diffusion_coeff, dt,
+                               cell_width, cell_height, bits, tiles);
+    Py_END_ALLOW_THREADS
+    if (!check_status(substeps)) {
+        return NULL;
+    }
+    return PyLong_FromLong(substeps);
+}
+
+/**
+ * Avanza las bocanadas (puffs) activas un paso dt (ver cs_puff_advect).
+ *
+ * Argumentos Python: x, y, sigma, dist, age (float64 [n]), active (uint8 [n]), dt,
+ * wind_speed, wind_direction, sigma_a, sigma0 y, opcionalmente, wind_field, x_min, x_max,
+ * y_min, y_max. Modifica los vectores in situ.
+ */
+static PyObject* puff_advect(PyObject *self, PyObject *args) {
+    PyArrayObject *ax, *ay, *asig, *adist, *aage, *aactive;
+    PyObject *wind_obj = Py_None;
+    double dt, wind_speed, wind_direction, sigma_a, sigma0;
+    double x_min = 0.0, x_max = 1.0, y_min = 0.0, y_max = 1.0;
+
+    if (!PyArg_ParseTuple(args, "OOOOOOddddd|Odddd", &ax, &ay, &asig, &adist, &aage, &aactive,
+                          &dt, &wind_speed, &wind_direction, &sigma_a, &sigma0,
+                          &wind_obj, &x_min, &x_max, &y_min, &y_max)) {
+        return NULL;
+    }
+    if (!PyArray_Check(ax)) {
+        PyErr_SetString(PyExc_TypeError, "x debe ser un vector NumPy");
+        return NULL;
+    }
+    npy_intp n = PyArray_SIZE(ax);
+    if (!check_vector(ax, NPY_DOUBLE, n, "x") || !check_vector(ay, NPY_DOUBLE, n, "y")
+            || !check_vector(asig, NPY_DOUBLE, n, "sigma") || !check_vector(adist, NPY_DOUBLE, n, "dist")
+            || !check_vector(aage, NPY_DOUBLE, n, "age") || !check_vector(aactive, NPY_UINT8, n, "active")) {
+        return NULL;
+    }
+
+    const double *uv = NULL;
+    npy_intp ny = 0, nx = 0;
+    if (wind_obj != Py_None) {
+        PyArrayObject *wind = (PyArrayObject*) wind_obj;
+        if (!check_double_array(wind, 3, "El campo de viento") || PyArray_DIM(wind, 2) != 2) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_ValueError, "El campo de viento debe tener forma [ny, nx, 2]");
+            return NULL;
+        }
+        uv = (const double*) PyArray_DATA(wind);
+        ny = PyArray_DIM(wind, 0);
+        nx = PyArray_DIM(wind, 1);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_puff_advect(n, (double*) PyArray_DATA(ax), (double*) PyArray_DATA(ay), (double*) PyArray_DATA(asig),
+                   (double*) PyArray_DATA(adist), (double*) PyArray_DATA(aage),
+                   (const uint8_t*) PyArray_DATA(aactive), dt, wind_speed, wind_direction, sigma_a, sigma0,
+                   uv, ny, nx, x_min, x_max, y_min, y_max);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Rasteriza las bocanadas activas sobre las mallas de especies (ver cs_puff_rasterize).
+ *
+ * Argumentos Python: grids (float64 [S, ny, nx]), x, y, sigma (float64 [n]),
+ * mass (float64 [n, S]), active (uint8 [n]), x_min, x_max, y_min, y_max.
+ * Suma sobre grids in situ.
+ */
+static PyObject* puff_rasterize(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *ax, *ay, *asig, *amass, *aactive;
+    double x_min, x_max, y_min, y_max;
+
+    if (!PyArg_ParseTuple(args, "OOOOOOdddd", &agrids, &ax, &ay, &asig, &amass, &aactive,
+                          &x_min, &x_max, &y_min, &y_max)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids") || !check_double_array(amass, 2, "mass")) {
+        return NULL;
+    }
+    npy_intp n_species = PyArray_DIM(agrids, 0), ny = PyArray_DIM(agrids, 1), nx = PyArray_DIM(agrids, 2);
+    npy_intp n = PyArray_DIM(amass, 0);
+    if (PyArray_DIM(amass, 1) != n_species) {
+        PyErr_SetString(PyExc_ValueError, "mass debe tener una columna por especie");
+        return NULL;
+    }
+    if (!check_vector(ax, NPY_DOUBLE, n, "x") || !check_vector(ay, NPY_DOUBLE, n, "y")
+            || !check_vector(asig, NPY_DOUBLE, n, "sigma") || !check_vector(aactive, NPY_UINT8, n, "active")) {
+        return NULL;
+    }
+
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    status = cs_puff_rasterize((double*) PyArray_DATA(agrids), n_species, ny, nx, n,
+                               (const double*) PyArray_DATA(ax), (const double*) PyArray_DATA(ay),
+                               (const double*) PyArray_DATA(asig), (const double*) PyArray_DATA(amass),
+                               (const uint8_t*) PyArray_DATA(aactive), x_min, x_max, y_min, y_max);
+    Py_END_ALLOW_THREADS
+    if (!check_status(status)) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/**
+ * Evalúa la concentración de las bocanadas activas en puntos sueltos (receptores), sin
+ * rasterizar la malla (ver cs_puff_sample).
+ *
+ * Argumentos Python: out (float64 [m, S]), px, py (float64 [m]), x, y, sigma (float64 [n]),
+ * mass (float64 [n, S]), active (uint8 [n]), cell_area. Sobrescribe out.
+ */
+static PyObject* puff_sample(PyObject *self, PyObject *args) {
+    PyArrayObject *aout, *apx, *apy, *ax, *ay, *asig, *amass, *aactive;
+    double cell_area;
+
+    if (!PyArg_ParseTuple(args, "OOOOOOOOd", &aout, &apx, &apy, &ax, &ay, &asig, &amass, &aactive,
+                          &cell_area)) {
+        return NULL;
+    }
+    if (!check_double_array(aout, 2, "out") || !check_double_array(amass, 2, "mass")) {
+        return NULL;
+    }
+    npy_intp m = PyArray_DIM(aout, 0), n_species = PyArray_DIM(aout, 1), n = PyArray_DIM(amass, 0);
+    if (PyArray_DIM(amass, 1) != n_species) {
+        PyErr_SetString(PyExc_ValueError, "out y mass deben tener una columna por especie");
+        return NULL;
+    }
+    if (!check_vector(apx, NPY_DOUBLE, m, "px") || !check_vector(apy, NPY_DOUBLE, m, "py")
+            || !check_vector(ax, NPY_DOUBLE, n, "x") || !check_vector(ay, NPY_DOUBLE, n, "y")
+            || !check_vector(asig, NPY_DOUBLE, n, "sigma") || !check_vector(aactive, NPY_UINT8, n, "active")) {
+        return NULL;
+    }
 
-        double x = PyFloat_AsDouble(PyTuple_GetItem(vehicle_tuple, 0)); // trabajamos con los floats   
-        double y = PyFloat_AsDouble(PyTuple_GetItem(vehicle_tuple, 1));
-        double vehicle_speed = PyFloat_AsDouble(PyTuple_GetItem(vehicle_tuple, 2));
-
-        // Calcular parámetros para este vehículo
-        double emission_rate = calculate_emission_rate(vehicle_speed, emission_factor); // trabajamos con los floats, evitar tiempo en la conversion
-        double plume_height = calculate_plume_rise(vehicle_speed);
-
-        // Calcular índices de la ventana de cálculo (convertidos a enteros de forma segura)
-        int i_min = (int)fmax(0.0, (y - y_min - 100.0) / (y_max - y_min) * (double)grid_resolution);
-        int i_max = (int)fmin((double)dims[0], (y - y_min + 100.0) / (y_max - y_min) * (double)grid_resolution);
-        int j_min = (int)fmax(0.0, (x - x_min - 100.0) / (x_max - x_min) * (double)grid_resolution);
-        int j_max = (int)fmin((double)dims[1], (x - x_min + 100.0) / (x_max - x_min) * (double)grid_resolution);
-
-        // Precalcular constantes comunes
-        double two_pi = 2.0 * M_PI;
-        double emission_factor_value = emission_rate / (two_pi * wind_speed);
-
-        // Calcular la dispersión para este vehículo
-        for (int i = i_min; i < i_max; i++) {
-            for (int j = j_min; j < j_max; j++) {
-                double receptor_x = x_min + (j + 0.5) * cell_width;
-                double receptor_y = y_min + (i + 0.5) * cell_height;
-                double dx = receptor_x - x;
-                double dy = receptor_y - y;
-                double distance_squared = dx * dx + dy * dy;
-                
-                if (distance_squared < 1.0) continue;
-                
-                double distance = sqrt(distance_squared);
-                if (distance > 300.0) continue;
-
-                double wind_dir_to_rec = atan2(dy, dx);
-                double angle_diff = fabs(wind_dir_to_rec - wind_direction);
-                if (angle_diff > M_PI)
-                    angle_diff = two_pi - angle_diff;
-
-                // Calcular coeficientes de dispersión
-                double sigma_y, sigma_z;
-                calculate_dispersion_coefficients(stability_class, distance, &sigma_y, &sigma_z);
-
-                // Calcular concentración
-                double lateral_dispersion = exp(-0.5 * pow(angle_diff / sigma_y, 2));
-                double vertical_dispersion = exp(-0.5 * pow(plume_height / sigma_z, 2)) * 2.0;
-
-                double concentration = emission_factor_value * lateral_dispersion * vertical_dispersion / (sigma_y * sigma_z);
-                
-                data[i * strides[0] + j * strides[1]] += concentration;
-            }
+    Py_BEGIN_ALLOW_THREADS
+    cs_puff_sample((double*) PyArray_DATA(aout), m, n_species, (const double*) PyArray_DATA(apx),
+                   (const double*) PyArray_DATA(apy), n, (const double*) PyArray_DATA(ax),
+                   (const double*) PyArray_DATA(ay), (const double*) PyArray_DATA(asig),
+                   (const double*) PyArray_DATA(amass), (const uint8_t*) PyArray_DATA(aactive), cell_area);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Concentración de calle OSPM en receptores situados en cañones urbanos (ver
+ * cs_canyon_concentration).
+ *
+ * Argumentos Python: out (float64 [m, S]), canyon (int32 [m], -1 fuera de cañón),
+ * offset (float64 [m]), width, height, orientation (float64 [E]), q (float64 [E, S]),
+ * wind_speed, wind_direction, sigma_wt. Sobrescribe out.
+ */
+static PyObject* canyon_concentration(PyObject *self, PyObject *args) {
+    PyArrayObject *aout, *acanyon, *aoffset, *awidth, *aheight, *aorient, *aq;
+    double wind_speed, wind_direction, sigma_wt;
+
+    if (!PyArg_ParseTuple(args, "OOOOOOOddd", &aout, &acanyon, &aoffset, &awidth, &aheight, &aorient,
+                          &aq, &wind_speed, &wind_direction, &sigma_wt)) {
+        return NULL;
+    }
+    if (!check_double_array(aout, 2, "out") || !check_double_array(aq, 2, "q")) {
+        return NULL;
+    }
+    npy_intp m = PyArray_DIM(aout, 0), n_species = PyArray_DIM(aout, 1), n_canyons = PyArray_DIM(aq, 0);
+    if (PyArray_DIM(aq, 1) != n_species) {
+        PyErr_SetString(PyExc_ValueError, "out y q deben tener una columna por especie");
+        return NULL;
+    }
+    if (!check_vector(acanyon, NPY_INT32, m, "canyon") || !check_vector(aoffset, NPY_DOUBLE, m, "offset")
+            || !check_vector(awidth, NPY_DOUBLE, n_canyons, "width")
+            || !check_vector(aheight, NPY_DOUBLE, n_canyons, "height")
+            || !check_vector(aorient, NPY_DOUBLE, n_canyons, "orientation")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_canyon_concentration((double*) PyArray_DATA(aout), m, n_species, (const int32_t*) PyArray_DATA(acanyon),
+                            (const double*) PyArray_DATA(aoffset), n_canyons, (const double*) PyArray_DATA(awidth),
+                            (const double*) PyArray_DATA(aheight), (const double*) PyArray_DATA(aorient),
+                            (const double*) PyArray_DATA(aq), wind_speed, wind_direction, sigma_wt);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Emisión de cada especie por vehículo interpolando bilinealmente tablas precompiladas por
+ * clase de vehículo (ver cs_emission_lookup).
+ *
+ * Argumentos Python: out (float64 [n, S]), cls (int32 [n]), speed, accel (float64 [n]),
+ * table (float64 [C, S, nv, na]), v0, dv, a0, da. Sobrescribe out.
+ */
+static PyObject* emission_lookup(PyObject *self, PyObject *args) {
+    PyArrayObject *aout, *acls, *aspeed, *aaccel, *atable;
+    double v0, dv, a0, da;
+
+    if (!PyArg_ParseTuple(args, "OOOOOdddd", &aout, &acls, &aspeed, &aaccel, &atable, &v0, &dv, &a0, &da)) {
+        return NULL;
+    }
+    if (!check_double_array(aout, 2, "out") || !check_double_array(atable, 4, "table")) {
+        return NULL;
+    }
+    npy_intp n = PyArray_DIM(aout, 0), n_species = PyArray_DIM(aout, 1);
+    npy_intp n_classes = PyArray_DIM(atable, 0), nv = PyArray_DIM(atable, 2), na = PyArray_DIM(atable, 3);
+    if (PyArray_DIM(atable, 1) != n_species || nv < 2 || na < 2) {
+        PyErr_SetString(PyExc_ValueError, "table debe tener forma [C, S, nv >= 2, na >= 2] con S columnas de out");
+        return NULL;
+    }
+    if (dv <= 0.0 || da <= 0.0) {
+        PyErr_SetString(PyExc_ValueError, "Los pasos de velocidad y aceleración deben ser positivos");
+        return NULL;
+    }
+    if (!check_vector(acls, NPY_INT32, n, "cls") || !check_vector(aspeed, NPY_DOUBLE, n, "speed")
+            || !check_vector(aaccel, NPY_DOUBLE, n, "accel")) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_emission_lookup((double*) PyArray_DATA(aout), n, n_species, (const int32_t*) PyArray_DATA(acls),
+                       (const double*) PyArray_DATA(aspeed), (const double*) PyArray_DATA(aaccel),
+                       (const double*) PyArray_DATA(atable), n_classes, nv, na, v0, dv, a0, da);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Deposita la emisión de fuentes puntuales (vehículos) en la celda que contiene a cada una
+ * (ver cs_deposit_point_sources).
+ *
+ * Argumentos Python: grids (float64 [S, ny, nx]), x, y (float64 [n]), rates (float64 [n, S]),
+ * dt, x_min, x_max, y_min, y_max [, obstacles]. Suma sobre grids in situ.
+ */
+static PyObject* deposit_point_sources(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *ax, *ay, *arates;
+    double dt, x_min, x_max, y_min, y_max;
+    PyObject *obstacles = NULL;
+
+    if (!PyArg_ParseTuple(args, "OOOOddddd|O", &agrids, &ax, &ay, &arates, &dt, &x_min, &x_max, &y_min, &y_max,
+                          &obstacles)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids") || !check_double_array(arates, 2, "rates")) {
+        return NULL;
+    }
+    npy_intp n_species = PyArray_DIM(agrids, 0), ny = PyArray_DIM(agrids, 1), nx = PyArray_DIM(agrids, 2);
+    npy_intp n = PyArray_DIM(arates, 0);
+    if (PyArray_DIM(arates, 1) != n_species) {
+        PyErr_SetString(PyExc_ValueError, "rates debe tener una columna por especie");
+        return NULL;
+    }
+    if (!check_vector(ax, NPY_DOUBLE, n, "x") || !check_vector(ay, NPY_DOUBLE, n, "y")) {
+        return NULL;
+    }
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, ny, nx, &bits)) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_deposit_point_sources((double*) PyArray_DATA(agrids), n_species, ny, nx, n,
+                             (const double*) PyArray_DATA(ax), (const double*) PyArray_DATA(ay),
+                             (const double*) PyArray_DATA(arates), dt, x_min, x_max, y_min, y_max, bits);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Paso de química por celda: equilibrio fotoestacionario NO/NO2/O3 implícito y aerosol
+ * secundario de primer orden (ver cs_chemistry_step).
+ *
+ * Argumentos Python: grids (float64 [S, ny, nx]), roles (int32 [5]: índices de NO, NO2, O3,
+ * precursor de nitrato y SO2, -1 si no está), pm (int32 [P]: especies que reciben el
+ * aerosol), scale, background (float64 [S]), dt, j_no2, k_no_o3, k_nitrate, k_sulfate
+ * [, keep (float64 [S]): fracción de cada especie que sobrevive a la deposición del paso,
+ * aplicada en el mismo recorrido, floor: valores menores en módulo pasan a cero exacto,
+ * tiles: teselas vivas (parse_tiles); solo es válido si el exceso nulo es estacionario, es
+ * decir, si el fondo está en equilibrio, y se actualiza con las teselas que quedan a cero].
+ * Modifica grids in situ. Devuelve el número de teselas vivas.
+ */
+static PyObject* chemistry_step(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *aroles, *apm, *ascale, *abg;
+    PyObject *okeep = Py_None, *otiles = Py_None;
+    double dt, j_no2, k_no_o3, k_nitrate, k_sulfate, floor_value = 0.0;
+
+    if (!PyArg_ParseTuple(args, "OOOOOddddd|OdO", &agrids, &aroles, &apm, &ascale, &abg, &dt, &j_no2, &k_no_o3,
+                          &k_nitrate, &k_sulfate, &okeep, &floor_value, &otiles)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids")) {
+        return NULL;
+    }
+    npy_intp n_species = PyArray_DIM(agrids, 0), ny = PyArray_DIM(agrids, 1), nx = PyArray_DIM(agrids, 2);
+    uint8_t *tiles;
+    if (!parse_tiles(otiles, ny, nx, &tiles)) {
+        return NULL;
+    }
+    if (!check_vector(aroles, NPY_INT32, 5, "roles") || !PyArray_Check(apm) || PyArray_NDIM(apm) != 1
+            || !check_vector(apm, NPY_INT32, PyArray_DIM(apm, 0), "pm")
+            || !check_vector(ascale, NPY_DOUBLE, n_species, "scale")
+            || !check_vector(abg, NPY_DOUBLE, n_species, "background")) {
+        return NULL;
+    }
+    if (okeep != Py_None && !check_vector((PyArrayObject*) okeep, NPY_DOUBLE, n_species, "keep")) {
+        return NULL;
+    }
+    const double *keep = okeep != Py_None ? (const double*) PyArray_DATA((PyArrayObject*) okeep) : NULL;
+    const int32_t *roles = (const int32_t*) PyArray_DATA(aroles);
+    const int32_t *pm = (const int32_t*) PyArray_DATA(apm);
+    npy_intp n_pm = PyArray_DIM(apm, 0);
+    for (int r = 0; r < 5; r++) {
+        if (roles[r] >= n_species) {
+            PyErr_SetString(PyExc_ValueError, "Índice de especie fuera de rango en roles");
+            return NULL;
         }
     }
+    for (npy_intp k = 0; k < n_pm; k++) {
+        if (pm[k] < 0 || pm[k] >= n_species) {
+            PyErr_SetString(PyExc_ValueError, "Índice de especie fuera de rango en pm");
+            return NULL;
+        }
+    }
+
+    long live;
+    Py_BEGIN_ALLOW_THREADS
+    live = cs_chemistry_step((double*) PyArray_DATA(agrids), n_species, ny, nx, roles, pm, n_pm,
+                             (const double*) PyArray_DATA(ascale), (const double*) PyArray_DATA(abg),
+                             dt, j_no2, k_no_o3, k_nitrate, k_sulfate, keep, floor_value, tiles);
+    Py_END_ALLOW_THREADS
+    return PyLong_FromLong(live);
+}
+
+/**
+ * Pasada de eliminación física sin química: grids[s] *= keep[s] con umbral a cero y teselas
+ * muertas (ver cs_decay_grids).
+ *
+ * Argumentos Python: grids (float64 [S, ny, nx]), keep (float64 [S]) [, floor, tiles].
+ * Modifica grids in situ. Devuelve el número de teselas vivas.
+ */
+static PyObject* decay_grids(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *akeep;
+    PyObject *otiles = Py_None;
+    double floor_value = 0.0;
+
+    if (!PyArg_ParseTuple(args, "OO|dO", &agrids, &akeep, &floor_value, &otiles)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids")) {
+        return NULL;
+    }
+    npy_intp n_species = PyArray_DIM(agrids, 0), ny = PyArray_DIM(agrids, 1), nx = PyArray_DIM(agrids, 2);
+    uint8_t *tiles;
+    if (!check_vector(akeep, NPY_DOUBLE, n_species, "keep") || !parse_tiles(otiles, ny, nx, &tiles)) {
+        return NULL;
+    }
+    long live;
+    Py_BEGIN_ALLOW_THREADS
+    live = cs_decay_grids((double*) PyArray_DATA(agrids), n_species, ny, nx,
+                          (const double*) PyArray_DATA(akeep), floor_value, tiles);
+    Py_END_ALLOW_THREADS
+    return PyLong_FromLong(live);
+}
+
+/**
+ * Pluma gaussiana de fuentes puntuales (vehículos) evaluada a varias alturas de receptor en
+ * una sola pasada (ver cs_update_pollution_layers).
+ *
+ * Argumentos Python: grids (float64 [L, ny, nx]), sources (float64 [n, 4]: x, y, emisión,
+ * altura efectiva), heights (float64 [L]), wind_speed, wind_direction, stability_class,
+ * x_min, x_max, y_min, y_max [, obstacles]. Suma sobre grids in situ.
+ */
+static PyObject* update_pollution_layers(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *asources, *aheights;
+    PyObject *obstacles = Py_None;
+    double wind_speed, wind_direction, x_min, x_max, y_min, y_max;
+    const char *stability_class;
+
+    if (!PyArg_ParseTuple(args, "OOOddsdddd|O", &agrids, &asources, &aheights, &wind_speed, &wind_direction,
+                          &stability_class, &x_min, &x_max, &y_min, &y_max, &obstacles)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids") || !check_double_array(asources, 2, "sources")) {
+        return NULL;
+    }
+    npy_intp n_layers = PyArray_DIM(agrids, 0), ny = PyArray_DIM(agrids, 1), nx = PyArray_DIM(agrids, 2);
+    npy_intp n = PyArray_DIM(asources, 0);
+    if (PyArray_DIM(asources, 1) != 4) {
+        PyErr_SetString(PyExc_ValueError, "sources debe tener forma [n, 4] (x, y, emisión, altura)");
+        return NULL;
+    }
+    if (!check_vector(aheights, NPY_DOUBLE, n_layers, "heights")) {
+        return NULL;
+    }
+    const uint8_t *bits;
+    if (!parse_obstacles(obstacles, ny, nx, &bits)) {
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    cs_update_pollution_layers((double*) PyArray_DATA(agrids), n_layers, ny, nx,
+                               (const double*) PyArray_DATA(asources), n, (const double*) PyArray_DATA(aheights),
+                               wind_speed, wind_direction, stability_class, x_min, x_max, y_min, y_max, bits);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+/**
+ * Intercambio vertical entre capas por difusión turbulenta (Kz) con Euler implícito (ver
+ * cs_vertical_exchange).
+ *
+ * Argumentos Python: grids (float64 [L, ny, nx], concentraciones), heights (float64 [L],
+ * centros de capa crecientes en m), kz (m²/s), dt. Modifica grids in situ.
+ */
+static PyObject* vertical_exchange(PyObject *self, PyObject *args) {
+    PyArrayObject *agrids, *aheights;
+    double kz, dt;
 
+    if (!PyArg_ParseTuple(args, "OOdd", &agrids, &aheights, &kz, &dt)) {
+        return NULL;
+    }
+    if (!check_double_array(agrids, 3, "grids")) {
+        return NULL;
+    }
+    npy_intp n_layers = PyArray_DIM(agrids, 0), plane = PyArray_DIM(agrids, 1) * PyArray_DIM(agrids, 2);
+    if (!check_vector(aheights, NPY_DOUBLE, n_layers, "heights")) {
+        return NULL;
+    }
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    status = cs_vertical_exchange((double*) PyArray_DATA(agrids), n_layers, plane,
+                                  (const double*) PyArray_DATA(aheights), kz, dt);
+    Py_END_ALLOW_THREADS
+    if (status == CS_ERR_VALUE) {
+        PyErr_SetString(PyExc_ValueError, "heights debe ser estrictamente creciente");
+        return NULL;
+    }
+    if (!check_status(status)) {
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
 // Métodos del módulo
 static PyMethodDef CSMethods[] = {
-    {"update_pollution", update_pollution, METH_VARARGS, 
+    {"update_pollution", update_pollution, METH_VARARGS,
      "Actualiza la cuadrícula de contaminación para un único vehículo."},
-    {"update_pollution_multiple", update_pollution_multiple, METH_VARARGS, 
+    {"update_pollution_multiple", update_pollution_multiple, METH_VARARGS,
      "Actualiza la cuadrícula de contaminación para múltiples vehículos de manera optimizada."},
+    {"advect_wind_field", advect_wind_field, METH_VARARGS,
+     "Advección semi-lagrangiana (retroceso bilineal) con un campo de viento [ny, nx, 2]."},
+    {"advect_grid", advect_grid, METH_VARARGS,
+     "Advección conservativa en forma de flujo (upwind 2º orden con limitador, salida libre)."},
+    {"diffuse_grid", diffuse_grid, METH_VARARGS,
+     "Difusión explícita (laplaciano de 5 puntos) con fronteras de flujo nulo; salta las teselas muertas."},
+    {"puff_advect", puff_advect, METH_VARARGS,
+     "Desplaza las bocanadas activas con el viento y hace crecer su sigma con la distancia recorrida."},
+    {"puff_rasterize", puff_rasterize, METH_VARARGS,
+     "Suma sobre las mallas de especies la masa de las bocanadas activas (gaussianas integradas por celda)."},
+    {"puff_sample", puff_sample, METH_VARARGS,
+     "Concentración de las bocanadas activas en puntos sueltos (receptores) sin rasterizar la malla."},
+    {"canyon_concentration", canyon_concentration, METH_VARARGS,
+     "Concentración de calle (OSPM simplificado) en receptores situados en cañones urbanos."},
+    {"emission_lookup", emission_lookup, METH_VARARGS,
+     "Emisión por vehículo y especie interpolada en tablas por clase (velocidad x aceleración)."},
+    {"deposit_point_sources", deposit_point_sources, METH_VARARGS,
+     "Suma la emisión de fuentes puntuales en su celda de cada malla de especie."},
+    {"chemistry_step", chemistry_step, METH_VARARGS,
+     "Química por celda: equilibrio fotoestacionario NO/NO2/O3 implícito y aerosol secundario."},
+    {"decay_grids", decay_grids, METH_VARARGS,
+     "Eliminación física del paso: grids[s] *= keep[s] con umbral a cero y teselas muertas."},
+    {"update_pollution_layers", update_pollution_layers, METH_VARARGS,
+     "Pluma gaussiana a varias alturas de receptor en una pasada (términos horizontales compartidos)."},
+    {"vertical_exchange", vertical_exchange, METH_VARARGS,
+     "Intercambio vertical implícito (Kz) entre capas con flujo nulo en suelo y cima."},
     {NULL, NULL, 0, NULL}
 };
 
-// Definición del módulo
+/**
+ * Inicialización de cada instancia del módulo (fase de ejecución de la inicialización multifase).
+ * El módulo no guarda estado propio: solo importa la API de NumPy.
+ */
+static int cs_module_exec(PyObject *module) {
+    (void) module;
+    import_array1(-1);  // Inicializa la API de NumPy
+    return 0;
+}
+
+static PyModuleDef_Slot cs_module_slots[] = {
+    {Py_mod_exec, cs_module_exec},
+#if PY_VERSION_HEX >= 0x030C0000
+    // Sin estado global, pero la tabla de la API de NumPy es común a todo el proceso: se admiten
+    // subintérpretes que compartan el GIL, no los que tienen uno propio
+    {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_SUPPORTED},
+#endif
+#if PY_VERSION_HEX >= 0x030D0000
+    // Los núcleos no tocan objetos de Python sin el GIL (CPython sin GIL, 3.13t)
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+    {0, NULL}
+};
+
+// Definición del módulo (sin estado por módulo: m_size = 0)
 static struct PyModuleDef csmodule = {
     PyModuleDef_HEAD_INIT,
     "cs_module",
     "Módulo C optimizado para cálculos de dispersión de contaminación",
-    -1,
-    CSMethods
+    0,
+    CSMethods,
+    cs_module_slots,
+    NULL,
+    NULL,
+    NULL
 };
 
 // Función de inicialización del módulo
 PyMODINIT_FUNC PyInit_cs_module(void) {
-    import_array();  // Inicializa la API de NumPy
-    return PyModule_Create(&csmodule);
-}
\ No newline at end of file
+    return PyModuleDef_Init(&csmodule);
+}
@@ -0,0 +1,607 @@
+// cs_runner.c - Ejecutable de simulación sin Python ni interfaz (servidores y clústeres)
+// Lee una configuración clave = valor, el tráfico grabado por SUMO (FCD, --fcd-output) y,
+// opcionalmente, una serie meteorológica CSV, y ejecuta el mismo modelo que CS.update (o el
+// transporte euleriano) con los núcleos de cs_core.c. Escribe instantáneas .npy de la malla y
+// las métricas por paso en el formato de modules/evolution_store.py, así que la WebApp y los
+// scripts de análisis leen sus resultados sin cambios.
+//
+// Uso:
+//     cs_runner simulacion.cfg
+//
+// Configuración (las claves coinciden con las de la configuración de Python; '#' comenta):
+//     fcd = trafico.fcd.xml          # Obligatoria: salida FCD de SUMO
+//     x_min = 0                      # Límites del dominio (m, coordenadas de SUMO)
+//     x_max = 1000
+//     y_min = 0
+//     y_max = 1000
+//     grid_resolution = 100          # Celdas por lado
+//     step_length = 1.0              # Paso (s) de transporte y eliminación
+//     wind_speed = 2.0               # m/s
+//     wind_direction = 0.0           # Grados, hacia donde sopla, desde el eje x
+//     stability_class = D
+//     emission_factor = 0.5
+//     mode = plume                   # plume (pluma gaussiana de CS.update) o transport
+//     diffusion_coeff = 2.0          # m²/s (solo transport)
+//     decay = 0.99                   # Fracción que queda tras la eliminación física del paso
+//     value_floor = 1e-12            # Valores menores (en módulo) pasan a cero exacto
+//     species = NOx                  # Nombre de la especie en las salidas
+//     meteorology = met.csv          # Opcional: time,wind_speed,wind_direction[,stability_class]
+//     output_dir = resultados        # Carpeta de salida
+//     snapshot_every = 10            # Pasos entre instantáneas (0: solo la final)
+//     steps = 0                      # Máximo de pasos (0: todo el FCD)
+//
+// Salidas:
+//     <output_dir>/snapshots/<especie>_<paso>.npy   float64 [ny, nx]
+//     <output_dir>/evolution/index.json, <especie>.bin  (EvolutionStore)
+
+#include "cs_core.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _OPENMP
+    #include <omp.h>
+#endif
+#ifdef _WIN32
+    #include <direct.h>
+    #define make_dir(path) _mkdir(path)
+#else
+    #include <sys/stat.h>
+    #define make_dir(path) mkdir(path, 0755)
+#endif
+
+#define LINE_SIZE 8192
+#define PATH_SIZE 1024
+
+// Configuración de la ejecución (valores por defecto en default_config)
+typedef struct {
+    char fcd[PATH_SIZE];
+    char meteorology[PATH_SIZE];
+    char output_dir[PATH_SIZE];
+    char species[64];
+    char stability_class[8];
+    char mode[16];
+    double x_min, x_max, y_min, y_max;
+    int grid_resolution;
+    double step_length;
+    double wind_speed, wind_direction;
+    double emission_factor;
+    double diffusion_coeff;
+    double decay;
+    double value_floor;
+    long snapshot_every;
+    long steps;
+} RunnerConfig;
+
+// Serie meteorológica: interpolación lineal; la dirección como vector unitario (igual que MetSeries)
+typedef struct {
+    ptrdiff_t n;
+    double *time, *speed, *dir_cos, *dir_sin;
+    char (*stability)[8];
+    int has_speed, has_dir;  // Columnas presentes en la cabecera
+    ptrdiff_t cursor;
+} MetSeries;
+
+// Lector de FCD en flujo: un <timestep> cada vez, sin cargar el fichero completo
+typedef struct {
+    FILE *file;
+    char line[LINE_SIZE];
+    double time;
+    double *vehicles;  // [n, 3]: x, y, velocidad
+    ptrdiff_t n, capacity;
+} FcdReader;
+
+// Registro del almacén de evolución (RECORD_DTYPE de evolution_store.py, little-endian)
+typedef struct {
+    int64_t step;
+    double mean, max, total;
+} EvolutionRecord;
+
+static double wall_time(void) {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * Elimina los espacios en blanco iniciales y finales (in situ) y devuelve el inicio.
+ */
+static char* trim(char *s) {
+    while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) end--;
+    *end = '\0';
+    return s;
+}
+
+static void copy_string(char *dst, size_t size, const char *src) {
+    snprintf(dst, size, "%s", src);
+}
+
+static void default_config(RunnerConfig *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    copy_string(cfg->output_dir, sizeof(cfg->output_dir), "resultados");
+    copy_string(cfg->species, sizeof(cfg->species), "NOx");
+    copy_string(cfg->stability_class, sizeof(cfg->stability_class), "D");
+    copy_string(cfg->mode, sizeof(cfg->mode), "plume");
+    cfg->x_max = cfg->y_max = 1.0;
+    cfg->grid_resolution = 100;
+    cfg->step_length = 1.0;
+    cfg->wind_speed = 2.0;
+    cfg->emission_factor = 0.5;
+    cfg->diffusion_coeff = 2.0;
+    cfg->decay = 0.99;
+    cfg->value_floor = 1e-12;
+    cfg->snapshot_every = 10;
+}
+
+/**
+ * Convierte el valor numérico de una clave; rechaza textos que no sean un número completo y
+ * finito (cs_setup.py compila este fichero con -fno-finite-math-only para que isfinite funcione).
+ */
+static int parse_number(const char *key, const char *value, double *out) {
+    char *end;
+    *out = strtod(value, &end);
+    if (end == value || *end != '\0' || !isfinite(*out)) {
+        fprintf(stderr, "Valor numérico no válido para '%s': '%s'\n", key, value);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Lee el fichero de configuración clave = valor. Devuelve 0 si falta algo obligatorio o no es válido.
+ */
+static int load_config(const char *path, RunnerConfig *cfg) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir la configuración %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    default_config(cfg);
+    char line[LINE_SIZE];
+    int has_bounds = 0, ok = 1;
+    double number;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *hash = strchr(line, '#');
+        if (hash != NULL) *hash = '\0';
+        char *eq = strchr(line, '=');
+        if (eq == NULL) continue;
+        *eq = '\0';
+        char *key = trim(line), *value = trim(eq + 1);
+
+        if (strcmp(key, "fcd") == 0) copy_string(cfg->fcd, sizeof(cfg->fcd), value);
+        else if (strcmp(key, "meteorology") == 0) copy_string(cfg->meteorology, sizeof(cfg->meteorology), value);
+        else if (strcmp(key, "output_dir") == 0) copy_string(cfg->output_dir, sizeof(cfg->output_dir), value);
+        else if (strcmp(key, "species") == 0) copy_string(cfg->species, sizeof(cfg->species), value);
+        else if (strcmp(key, "stability_class") == 0)
+            copy_string(cfg->stability_class, sizeof(cfg->stability_class), value);
+        else if (strcmp(key, "mode") == 0) copy_string(cfg->mode, sizeof(cfg->mode), value);
+        else if (strcmp(key, "x_min") == 0) { ok &= parse_number(key, value, &cfg->x_min); has_bounds |= 1; }
+        else if (strcmp(key, "x_max") == 0) { ok &= parse_number(key, value, &cfg->x_max); has_bounds |= 2; }
+        else if (strcmp(key, "y_min") == 0) { ok &= parse_number(key, value, &cfg->y_min); has_bounds |= 4; }
+        else if (strcmp(key, "y_max") == 0) { ok &= parse_number(key, value, &cfg->y_max); has_bounds |= 8; }
+        else if (strcmp(key, "grid_resolution") == 0) {
+            ok &= parse_number(key, value, &number);
+            cfg->grid_resolution = (int)number;
+        }
+        else if (strcmp(key, "step_length") == 0) ok &= parse_number(key, value, &cfg->step_length);
+        else if (strcmp(key, "wind_speed") == 0) ok &= parse_number(key, value, &cfg->wind_speed);
+        else if (strcmp(key, "wind_direction") == 0) ok &= parse_number(key, value, &cfg->wind_direction);
+        else if (strcmp(key, "emission_factor") == 0) ok &= parse_number(key, value, &cfg->emission_factor);
+        else if (strcmp(key, "diffusion_coeff") == 0) ok &= parse_number(key, value, &cfg->diffusion_coeff);
+        else if (strcmp(key, "decay") == 0) ok &= parse_number(key, value, &cfg->decay);
+        else if (strcmp(key, "value_floor") == 0) ok &= parse_number(key, value, &cfg->value_floor);
+        else if (strcmp(key, "snapshot_every") == 0) {
+            ok &= parse_number(key, value, &number);
+            cfg->snapshot_every = (long)number;
+        }
+        else if (strcmp(key, "steps") == 0) {
+            ok &= parse_number(key, value, &number);
+            cfg->steps = (long)number;
+        }
+        else fprintf(stderr, "Aviso: clave de configuración desconocida '%s'\n", key);
+    }
+    fclose(f);
+
+    if (!ok) return 0;
+    if (cfg->fcd[0] == '\0') {
+        fprintf(stderr, "La configuración necesita 'fcd' (salida FCD de SUMO)\n");
+        return 0;
+    }
+    if (has_bounds != 15 || cfg->x_max <= cfg->x_min || cfg->y_max <= cfg->y_min) {
+        fprintf(stderr, "La configuración necesita x_min < x_max e y_min < y_max\n");
+        return 0;
+    }
+    if (cfg->grid_resolution <= 0 || cfg->step_length <= 0.0) {
+        fprintf(stderr, "grid_resolution y step_length deben ser positivos\n");
+        return 0;
+    }
+    if (strcmp(cfg->mode, "plume") != 0 && strcmp(cfg->mode, "transport") != 0) {
+        fprintf(stderr, "mode debe ser 'plume' o 'transport' (no '%s')\n", cfg->mode);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Lee un CSV con cabecera y columnas time, wind_speed, wind_direction (grados) y, opcionalmente,
+ * stability_class. Las columnas que falten mantienen el valor de la configuración.
+ */
+static int load_met(const char *path, MetSeries *met) {
+    memset(met, 0, sizeof(*met));
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo abrir la meteorología %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    char line[LINE_SIZE];
+    int col_time = -1, col_speed = -1, col_dir = -1, col_stab = -1;
+    if (fgets(line, sizeof(line), f) != NULL) {
+        int c = 0;
+        for (char *tok = strtok(line, ","); tok != NULL; tok = strtok(NULL, ","), c++) {
+            tok = trim(tok);
+            for (char *p = tok; *p; p++) *p = (char) (*p >= 'A' && *p <= 'Z' ? *p - 'A' + 'a' : *p);
+            if (strcmp(tok, "time") == 0) col_time = c;
+            else if (strcmp(tok, "wind_speed") == 0) col_speed = c;
+            else if (strcmp(tok, "wind_direction") == 0) col_dir = c;
+            else if (strcmp(tok, "stability_class") == 0) col_stab = c;
+        }
+    }
+    if (col_time < 0) {
+        fprintf(stderr, "La serie meteorológica necesita una columna 'time'\n");
+        fclose(f);
+        return 0;
+    }
+    met->has_speed = col_speed >= 0;
+    met->has_dir = col_dir >= 0;
+
+    ptrdiff_t capacity = 0;
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        if (trim(line)[0] == '\0') continue;
+        if (met->n == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            double *t = realloc(met->time, capacity * sizeof(double));
+            if (t != NULL) met->time = t;
+            double *s = realloc(met->speed, capacity * sizeof(double));
+            if (s != NULL) met->speed = s;
+            double *dc = realloc(met->dir_cos, capacity * sizeof(double));
+            if (dc != NULL) met->dir_cos = dc;
+            double *ds = realloc(met->dir_sin, capacity * sizeof(double));
+            if (ds != NULL) met->dir_sin = ds;
+            char (*st)[8] = realloc(met->stability, capacity * sizeof(*met->stability));
+            if (st != NULL) met->stability = st;
+            if (t == NULL || s == NULL || dc == NULL || ds == NULL || st == NULL) {
+                fprintf(stderr, "Sin memoria para la serie meteorológica\n");
+                ok = 0;
+                break;
+            }
+        }
+        ptrdiff_t k = met->n;
+        met->speed[k] = met->dir_cos[k] = met->dir_sin[k] = 0.0;
+        met->stability[k][0] = '\0';
+        // Campos separados por comas, sin fusionar los vacíos (strtok desalinearía las columnas)
+        int seen_time = 0, seen_speed = 0, seen_dir = 0;
+        char *field = line;
+        for (int c = 0; ok && field != NULL; c++) {
+            char *comma = strchr(field, ',');
+            if (comma != NULL) *comma = '\0';
+            char *tok = trim(field);
+            field = comma != NULL ? comma + 1 : NULL;
+            if (c == col_time) seen_time = ok = parse_number("time", tok, &met->time[k]);
+            else if (c == col_speed) seen_speed = ok = parse_number("wind_speed", tok, &met->speed[k]);
+            else if (c == col_dir) {
+                double deg;
+                seen_dir = ok = parse_number("wind_direction", tok, &deg);
+                met->dir_cos[k] = cos(deg * M_PI / 180.0);
+                met->dir_sin[k] = sin(deg * M_PI / 180.0);
+            } else if (c == col_stab) {
+                copy_string(met->stability[k], sizeof(met->stability[k]), tok);
+            }
+        }
+        if (!ok) break;
+        if (!seen_time || (met->has_speed && !seen_speed) || (met->has_dir && !seen_dir)) {
+            fprintf(stderr, "Fila %ld de la serie meteorológica incompleta\n", (long) k + 1);
+            ok = 0;
+            break;
+        }
+        if (k > 0 && met->time[k] <= met->time[k - 1]) {
+            fprintf(stderr, "La serie meteorológica necesita instantes estrictamente crecientes\n");
+            ok = 0;
+        }
+        met->n++;
+    }
+    fclose(f);
+    if (ok && met->n == 0) {
+        fprintf(stderr, "La serie meteorológica está vacía\n");
+        ok = 0;
+    }
+    return ok;
+}
+
+/**
+ * Meteorología en el instante t (s). Fuera de la serie se mantienen los valores extremos; la
+ * clase de estabilidad es la del registro vigente. Las columnas que no están en la serie (y
+ * una clase vacía) no modifican el valor recibido.
+ */
+static void met_at(MetSeries *met, double t, double *wind_speed, double *wind_direction, char *stability) {
+    ptrdiff_t k = met->cursor;
+    while (k > 0 && met->time[k] > t) k--;
+    while (k + 1 < met->n && met->time[k + 1] <= t) k++;
+    met->cursor = k;
+    ptrdiff_t k1 = k + 1 < met->n ? k + 1 : k;
+    double w = 0.0;
+    if (k1 != k && t > met->time[k]) {
+        w = (t - met->time[k]) / (met->time[k1] - met->time[k]);
+    }
+    if (met->has_speed) {
+        *wind_speed = (1.0 - w) * met->speed[k] + w * met->speed[k1];
+    }
+    if (met->has_dir) {
+        double c = (1.0 - w) * met->dir_cos[k] + w * met->dir_cos[k1];
+        double s = (1.0 - w) * met->dir_sin[k] + w * met->dir_sin[k1];
+        *wind_direction = atan2(s, c);
+    }
+    if (met->stability[k][0] != '\0') copy_string(stability, 8, met->stability[k]);
+}
+
+static void free_met(MetSeries *met) {
+    free(met->time);
+    free(met->speed);
+    free(met->dir_cos);
+    free(met->dir_sin);
+    free(met->stability);
+}
+
+/**
+ * Valor numérico del atributo name="..." de una etiqueta XML en una línea. Devuelve 0 si no está.
+ */
+static int xml_attr(const char *line, const char *name, double *value) {
+    size_t len = strlen(name);
+    for (const char *p = strstr(line, name); p != NULL; p = strstr(p + 1, name)) {
+        if (p > line && (p[-1] == ' ' || p[-1] == '\t') && p[len] == '=' && p[len + 1] == '"') {
+            *value = strtod(p + len + 2, NULL);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Lee el siguiente <timestep> del FCD con sus vehículos (x, y, speed). Devuelve 1 si lo ha leído,
+ * 0 al final del fichero y -1 si no hay memoria.
+ */
+static int fcd_next(FcdReader *reader) {
+    reader->n = 0;
+    while (fgets(reader->line, sizeof(reader->line), reader->file) != NULL) {
+        if (strstr(reader->line, "<timestep") == NULL) continue;
+        reader->time = 0.0;
+        xml_attr(reader->line, "time", &reader->time);
+        if (strstr(reader->line, "/>") != NULL) {
+            return 1;  // Paso sin vehículos
+        }
+        while (fgets(reader->line, sizeof(reader->line), reader->file) != NULL) {
+            if (strstr(reader->line, "</timestep") != NULL) break;
+            if (strstr(reader->line, "<vehicle") == NULL) continue;
+            double x, y, speed = 0.0;
+            if (!xml_attr(reader->line, "x", &x) || !xml_attr(reader->line, "y", &y)) continue;
+            xml_attr(reader->line, "speed", &speed);
+            if (reader->n == reader->capacity) {
+                ptrdiff_t capacity = reader->capacity ? 2 * reader->capacity : 1024;
+                double *vehicles = realloc(reader->vehicles, 3 * capacity * sizeof(double));
+                if (vehicles == NULL) {
+                    return -1;
+                }
+                reader->vehicles = vehicles;
+                reader->capacity = capacity;
+            }
+            double *v = reader->vehicles + 3 * reader->n++;
+            v[0] = x;
+            v[1] = y;
+            v[2] = speed;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static int ensure_dir(const char *path) {
+    if (make_dir(path) != 0 && errno != EEXIST) {
+        fprintf(stderr, "No se pudo crear la carpeta %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Escribe una malla float64 [ny, nx] en formato .npy (versión 1.0, little-endian).
+ */
+static int write_npy(const char *path, const double *data, ptrdiff_t ny, ptrdiff_t nx) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "No se pudo escribir %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    char header[128];
+    int len = snprintf(header, sizeof(header), "{'descr': '<f8', 'fortran_order': False, 'shape': (%ld, %ld), }",
+                       (long) ny, (long) nx);
+    // Cabecera rellena con espacios y terminada en '\n' hasta un múltiplo de 64 bytes
+    int total = (10 + len + 1 + 63) / 64 * 64;
+    while (10 + len + 1 < total) header[len++] = ' ';
+    header[len++] = '\n';
+    unsigned char preamble[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                                  (unsigned char) (len & 0xff), (unsigned char) (len >> 8)};
+    int ok = fwrite(preamble, 1, 10, f) == 10 && fwrite(header, 1, len, f) == (size_t) len
+             && fwrite(data, sizeof(double), ny * nx, f) == (size_t) (ny * nx);
+    ok &= fclose(f) == 0;
+    return ok;
+}
+
+/**
+ * Crea el almacén de evolución (<output_dir>/evolution/index.json) y abre el fichero de
+ * registros de la especie.
+ */
+static FILE* open_evolution(const char *output_dir, const char *species) {
+    char path[2 * PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/evolution/index.json", output_dir);
+    FILE *index = fopen(path, "w");
+    if (index == NULL) {
+        fprintf(stderr, "No se pudo escribir %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fprintf(index, "{\"species\": [\"%s\"], \"metrics\": [\"mean\", \"max\", \"total\"], "
+                   "\"dtype\": [[\"step\", \"<i8\"], [\"mean\", \"<f8\"], [\"max\", \"<f8\"], [\"total\", \"<f8\"]]}",
+            species);
+    fclose(index);
+    snprintf(path, sizeof(path), "%s/evolution/%s.bin", output_dir, species);
+    FILE *records = fopen(path, "wb");
+    if (records == NULL) {
+        fprintf(stderr, "No se pudo escribir %s: %s\n", path, strerror(errno));
+    }
+    return records;
+}
+
+static int write_snapshot(const RunnerConfig *cfg, long step, const double *grid, ptrdiff_t n) {
+    char path[2 * PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/snapshots/%s_%06ld.npy", cfg->output_dir, cfg->species, step);
+    return write_npy(path, grid, n, n);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <configuracion.cfg>\n", argv[0]);
+        return 2;
+    }
+    RunnerConfig cfg;
+    if (!load_config(argv[1], &cfg)) {
+        return 1;
+    }
+    MetSeries met;
+    int has_met = cfg.meteorology[0] != '\0';
+    if (has_met && !load_met(cfg.meteorology, &met)) {
+        free_met(&met);
+        return 1;
+    }
+    FcdReader fcd = {0};
+    fcd.file = fopen(cfg.fcd, "r");
+    if (fcd.file == NULL) {
+        fprintf(stderr, "No se pudo abrir el FCD %s: %s\n", cfg.fcd, strerror(errno));
+        return 1;
+    }
+
+    char path[2 * PATH_SIZE];
+    int ok = ensure_dir(cfg.output_dir);
+    snprintf(path, sizeof(path), "%s/snapshots", cfg.output_dir);
+    ok = ok && ensure_dir(path);
+    snprintf(path, sizeof(path), "%s/evolution", cfg.output_dir);
+    ok = ok && ensure_dir(path);
+    FILE *evolution = ok ? open_evolution(cfg.output_dir, cfg.species) : NULL;
+
+    const ptrdiff_t n = cfg.grid_resolution, size = n * n;
+    const double cell_width = (cfg.x_max - cfg.x_min) / n, cell_height = (cfg.y_max - cfg.y_min) / n;
+    const int transport = strcmp(cfg.mode, "transport") == 0;
+    double *grid = calloc(size, sizeof(double));
+    double *scratch = NULL;  // x, y y emisión separados para el modo de transporte
+    ptrdiff_t scratch_capacity = 0;
+    if (evolution == NULL || grid == NULL) {
+        if (grid == NULL) fprintf(stderr, "Sin memoria para la malla %ldx%ld\n", (long) n, (long) n);
+        ok = 0;
+    }
+
+    double wind_speed = cfg.wind_speed, wind_direction = cfg.wind_direction * M_PI / 180.0;
+    char stability[8];
+    copy_string(stability, sizeof(stability), cfg.stability_class);
+    long step = 0, last_snapshot = -1;
+    double vehicles_total = 0.0, start = wall_time();
+
+    while (ok && (cfg.steps <= 0 || step < cfg.steps)) {
+        int status = fcd_next(&fcd);
+        if (status == 0) break;
+        if (status < 0) {
+            fprintf(stderr, "Sin memoria para los vehículos del paso %ld\n", step);
+            ok = 0;
+            break;
+        }
+        if (has_met) {
+            met_at(&met, fcd.time, &wind_speed, &wind_direction, stability);
+        }
+
+        if (!transport) {
+            // Igual que CS.update: decaimiento con umbral y pluma gaussiana de todos los vehículos
+            cs_update_pollution_multiple(grid, n, 1, n, n, fcd.vehicles, fcd.n, wind_speed, wind_direction,
+                                         cfg.emission_factor, stability, cfg.x_min, cfg.x_max, cfg.y_min, cfg.y_max,
+                                         cfg.grid_resolution, NULL, cfg.decay, cfg.value_floor);
+        } else {
+            // Depósito de las emisiones del paso, advección, difusión y eliminación física
+            if (fcd.n > scratch_capacity) {
+                double *buffer = realloc(scratch, 3 * fcd.n * sizeof(double));
+                if (buffer == NULL) {
+                    fprintf(stderr, "Sin memoria para los vehículos del paso %ld\n", step);
+                    ok = 0;
+                    break;
+                }
+                scratch = buffer;
+                scratch_capacity = fcd.n;
+            }
+            double *x = scratch, *y = scratch + fcd.n, *rates = scratch + 2 * fcd.n;
+            for (ptrdiff_t k = 0; k < fcd.n; k++) {
+                x[k] = fcd.vehicles[3 * k];
+                y[k] = fcd.vehicles[3 * k + 1];
+                rates[k] = cs_emission_rate(fcd.vehicles[3 * k + 2], cfg.emission_factor);
+            }
+            cs_deposit_point_sources(grid, 1, n, n, fcd.n, x, y, rates, cfg.step_length,
+                                     cfg.x_min, cfg.x_max, cfg.y_min, cfg.y_max, NULL);
+            if (cs_advect_grid(grid, n, n, wind_speed, wind_direction, cfg.step_length, cell_width, cell_height,
+                               NULL) < 0
+                    || cs_diffuse_grid(grid, n, n, cfg.diffusion_coeff, cfg.step_length, cell_width, cell_height,
+                                       NULL, NULL) < 0) {
+                fprintf(stderr, "Sin memoria para el transporte del paso %ld\n", step);
+                ok = 0;
+                break;
+            }
+            cs_decay_grids(grid, 1, n, n, &cfg.decay, cfg.value_floor, NULL);
+        }
+        vehicles_total += fcd.n;
+
+        // Métricas del paso (mismas que EvolutionWriter.append)
+        EvolutionRecord record = {step, 0.0, -INFINITY, 0.0};
+        for (ptrdiff_t p = 0; p < size; p++) {
+            record.total += grid[p];
+            record.max = grid[p] > record.max ? grid[p] : record.max;
+        }
+        record.mean = record.total / size;
+        if (fwrite(&record, sizeof(record), 1, evolution) != 1) {
+            fprintf(stderr, "No se pudieron escribir las métricas del paso %ld\n", step);
+            ok = 0;
+            break;
+        }
+        if (cfg.snapshot_every > 0 && step % cfg.snapshot_every == 0) {
+            ok = write_snapshot(&cfg, step, grid, n);
+            last_snapshot = step;
+        }
+        step++;
+    }
+    // Instantánea final si el último paso no la tenía
+    if (ok && step > 0 && last_snapshot != step - 1) {
+        ok = write_snapshot(&cfg, step - 1, grid, n);
+    }
+
+    double elapsed = wall_time() - start;
+    if (ok) {
+        printf("%ld pasos, %.1f vehículos por paso, %.3f s (%.3f ms por paso)\n", step,
+               step > 0 ? vehicles_total / step : 0.0, elapsed, step > 0 ? 1e3 * elapsed / step : 0.0);
+    }
+    if (evolution != NULL) fclose(evolution);
+    fclose(fcd.file);
+    free(fcd.vehicles);
+    free(scratch);
+    free(grid);
+    if (has_met) free_met(&met);
+    return ok ? 0 : 1;
+}
@@ -4,11 +4,17 @@ Script de configuración para compilar el módulo C optimizado para cálculos de
 Este script detecta automáticamente el sistema operativo y configura las opciones de compilación
 adecuadas para Windows (MSVC) o Linux/Mac (GCC/Clang).
 
+Los núcleos están en cs_core.c (C puro); cs_module.c es la capa de Python y cs_runner.c un
+ejecutable sin Python que reproduce una salida FCD de SUMO (ver su cabecera).
+
 Uso:
-    python cs_setup.py build_ext --inplace
+    python cs_setup.py build_ext --inplace    # Extensión cs_module
+    python cs_setup.py build_runner           # Ejecutable cs_runner en src/modules
 """
 
-from setuptools import setup, Extension
+from setuptools import setup, Extension, Command
+from setuptools.command.build_ext import customize_compiler
+from distutils.ccompiler import new_compiler
 import numpy
 import sys
 import os
@@ -17,31 +23,77 @@ import platform
 # Detectar sistema operativo y configurar opciones de compilación adecuadas
 if sys.platform == 'win32':
     # Opciones para Windows con MSVC
-    extra_compile_args = ['/O2']  # Optimización nivel 2
+    extra_compile_args = ['/O2', '/openmp']  # Optimización nivel 2 y OpenMP
     extra_link_args = []
-    print("Configurando para Windows con MSVC")
+    runner_compile_args = extra_compile_args
+    platform_label = "Windows con MSVC"
 else:
     # Opciones para Linux/MacOS con GCC/Clang
     extra_compile_args = ['-O3', '-ffast-math', '-fopenmp']
-    extra_link_args = ['-fopenmp']
-    print("Configurando para Linux/MacOS con GCC/Clang")
+    # -lm también enlaza libmvec, donde están las exp vectorizadas que genera -ffast-math
+    extra_link_args = ['-fopenmp', '-lm']
+    # cs_runner.c comprueba valores no finitos de la configuración: -ffast-math sin suponer
+    # aritmética finita (los núcleos de cs_core.c sí la suponen)
+    runner_compile_args = extra_compile_args + ['-fno-finite-math-only']
+    platform_label = "Linux/MacOS con GCC/Clang"
+
+MODULES_DIR = os.path.dirname(os.path.abspath(__file__))
 
 # Definir el módulo de extensión
 module = Extension('cs_module',
-                  sources=['src/modules/cs_module.c'],
-                  include_dirs=[numpy.get_include()],
+                  sources=['src/modules/cs_module.c', 'src/modules/cs_core.c'],
+                  include_dirs=[numpy.get_include(), 'src/modules'],
                   extra_compile_args=extra_compile_args,
                   extra_link_args=extra_link_args)
 
 
-# Configuración del paquete
-setup(
-    name='cs_module',
-    version='1.0',
-    description='Módulo C optimizado para cálculos de dispersión de contaminación',
-    author='Mario Díaz Gómez',
-    ext_modules=[module]
-)
+def build_runner(output_dir: str = MODULES_DIR, build_dir: str = 'build') -> str:
+    """
+    Compila el ejecutable cs_runner (cs_core.c + cs_runner.c) con las opciones de la extensión.
+
+    Returns:
+        Ruta del ejecutable generado
+    """
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    include_dirs = [MODULES_DIR]
+    objects = compiler.compile([os.path.join(MODULES_DIR, 'cs_core.c')], output_dir=build_dir,
+                               include_dirs=include_dirs, extra_postargs=extra_compile_args)
+    objects += compiler.compile([os.path.join(MODULES_DIR, 'cs_runner.c')], output_dir=build_dir,
+                                include_dirs=include_dirs, extra_postargs=runner_compile_args)
+    compiler.link_executable(objects, 'cs_runner', output_dir=output_dir, extra_postargs=extra_link_args)
+    return os.path.join(output_dir, compiler.executable_filename('cs_runner'))
+
+
+class BuildRunner(Command):
+    """Comando build_runner: compila cs_runner en src/modules (ver build_runner)."""
+
+    description = 'compila el ejecutable cs_runner'
+    user_options = []
+
+    def initialize_options(self):
+        pass
+
+    def finalize_options(self):
+        pass
+
+    def run(self):
+        build_runner()
+
+
+if __name__ == '__main__':
+    print(f"Configurando para {platform_label}")
+
+    # Configuración del paquete
+    setup(
+        name='cs_module',
+        version='1.0',
+        description='Módulo C optimizado para cálculos de dispersión de contaminación',
+        author='Mario Díaz Gómez',
+        ext_modules=[module],
+        cmdclass={'build_runner': BuildRunner}
+    )
 
-print(f"Configuración completada para {platform.system()} ({platform.architecture()[0]})")
-print("Ejecute 'python cs_setup.py build_ext --inplace' para compilar el módulo")
\ No newline at end of file
+    print(f"Configuración completada para {platform.system()} ({platform.architecture()[0]})")
+    print("Ejecute 'python cs_setup.py build_ext --inplace' para compilar el módulo")
+    print("Ejecute 'python cs_setup.py build_runner' para compilar el ejecutable cs_runner")
@@ -0,0 +1,83 @@
+"""
+Módulo de Teselas Muertas y Umbral de Valores
+
+Tras horas de decaimiento, las celdas lejanas a las fuentes tienden a valores ínfimos que
+acaban siendo subnormales (cada operación con ellos es ~100 veces más lenta). Para evitarlo:
+    - Los núcleos C activan flush-to-zero/denormals-are-zero en sus hilos
+    - Los valores por debajo de un umbral (config['value_floor']) pasan a cero exacto en la
+      pasada de eliminación física
+    - La pila de especies se divide en teselas de TILE_SIZE x TILE_SIZE celdas con un
+      indicador "viva" (uint8 [ty, tx], compartido por todas las especies). Una tesela muerta
+      vale exactamente cero en todas las especies, así que el decaimiento y la difusión la
+      saltan.
+
+Los indicadores son conservadores: una tesela marcada como viva puede valer cero, pero una
+muerta nunca tiene masa. Quien añade masa debe marcarla (mark_points) y el transporte los
+dilata según las celdas que avanza (dilate). La pasada de eliminación vuelve a marcar como
+muertas las teselas que quedan a cero.
+"""
+
+import math
+from typing import Optional, Tuple
+
+import numpy as np
+import scipy.ndimage
+
+TILE_SIZE = 32  # Igual que TILE_SIZE en cs_module.c
+
+
+def tile_shape(shape) -> Tuple[int, int]:
+    """Número de teselas (ty, tx) de una malla [ny, nx]."""
+    ny, nx = shape[-2:]
+    return -(-ny // TILE_SIZE), -(-nx // TILE_SIZE)
+
+
+def live_tiles(grids: np.ndarray) -> np.ndarray:
+    """Indicadores exactos: 1 en las teselas con algún valor distinto de cero (pila [S, ny, nx] o malla 2D)."""
+    grids = grids.reshape((-1,) + grids.shape[-2:])
+    ty, tx = tile_shape(grids.shape)
+    ny, nx = grids.shape[1:]
+    padded = np.zeros((ty * TILE_SIZE, tx * TILE_SIZE), dtype=bool)
+    padded[:ny, :nx] = (grids != 0.0).any(axis=0)
+    return padded.reshape(ty, TILE_SIZE, tx, TILE_SIZE).any(axis=(1, 3)).astype(np.uint8)
+
+
+def reach(cells: float) -> int:
+    """Teselas que puede cruzar la masa al avanzar un número de celdas."""
+    return int(math.ceil(max(cells, 0.0) / TILE_SIZE))
+
+
+def dilate(tiles: np.ndarray, radius: int) -> np.ndarray:
+    """Marca como vivas las teselas a menos de radius teselas de una viva (in situ)."""
+    if radius > 0 and tiles.any():
+        tiles[...] = scipy.ndimage.maximum_filter(tiles, size=2 * radius + 1, mode='constant', cval=0)
+    return tiles
+
+
+def mark_points(tiles: np.ndarray, x: np.ndarray, y: np.ndarray, bounds, shape):
+    """Marca como vivas las teselas que contienen los puntos (x, y) en metros."""
+    x_min, x_max, y_min, y_max = bounds
+    ny, nx = shape[-2:]
+    j = np.floor((np.asarray(x) - x_min) / (x_max - x_min) * nx).astype(np.intp)
+    i = np.floor((np.asarray(y) - y_min) / (y_max - y_min) * ny).astype(np.intp)
+    inside = (i >= 0) & (i < ny) & (j >= 0) & (j < nx)
+    tiles[i[inside] // TILE_SIZE, j[inside] // TILE_SIZE] = 1
+
+
+def snap_floor(grids: np.ndarray, floor: float):
+    """Pone a cero exacto los valores menores que floor en módulo (in situ)."""
+    if floor > 0.0:
+        grids[np.abs(grids) < floor] = 0.0
+
+
+def decay_py(grids: np.ndarray, keep: np.ndarray, floor: float = 0.0, tiles: Optional[np.ndarray] = None) -> int:
+    """
+    Versión NumPy de cs_module.decay_grids: grids[s] *= keep[s], umbral y actualización de
+    los indicadores de teselas. Devuelve el número de teselas vivas.
+    """
+    grids *= np.asarray(keep).reshape((-1,) + (1,) * (grids.ndim - 1))
+    snap_floor(grids, floor)
+    live = live_tiles(grids)
+    if tiles is not None:
+        tiles[...] = live
+    return int(live.sum())
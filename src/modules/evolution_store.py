@@ -0,0 +1,137 @@
+"""
+Módulo de Almacén de Evolución Temporal (series por paso, indexadas y de solo anexado)
+
+La simulación anexa en cada paso las métricas agregadas de cada especie
+(media, máximo y total de la malla) y la WebApp las consulta por especie y rango
+de pasos sin recorrer ni parsear los CSV exportados.
+
+Disposición en disco:
+    <raíz>/index.json       especies, métricas y tipo de registro
+    <raíz>/<especie>.bin    registros de tamaño fijo (step int64, mean, max, total float64)
+
+Los pasos se anexan en orden creciente, así que el propio fichero es el índice: una
+consulta por rango hace una búsqueda binaria sobre la columna de pasos (memmap) y lee
+solo los registros del resultado. Un registro a medio escribir (lectura concurrente o
+caída del proceso) se ignora porque el lector solo ve registros completos.
+"""
+
+import json
+import os
+from typing import Dict, Iterable, List, Optional
+
+import numpy as np
+
+METRICS = ('mean', 'max', 'total')
+RECORD_DTYPE = np.dtype([('step', '<i8')] + [(m, '<f8') for m in METRICS])
+INDEX_FILE = 'index.json'
+
+
+class EvolutionWriter:
+    """
+    Escritor del almacén para una simulación. Al crearse reinicia las series de las
+    especies indicadas.
+
+    Args:
+        root: Carpeta del almacén (p. ej. 'evolution')
+        species_list: Especies de la simulación
+        flush_every: Registros entre volcados a disco (los lectores ven los datos volcados)
+    """
+
+    def __init__(self, root: str, species_list: Iterable[str], flush_every: int = 10):
+        self.root = root
+        self.species_list = list(species_list)
+        self.flush_every = max(1, int(flush_every))
+        os.makedirs(root, exist_ok=True)
+        self._files = {sp: open(os.path.join(root, f'{sp}.bin'), 'wb') for sp in self.species_list}
+        self._record = np.zeros(1, dtype=RECORD_DTYPE)
+        self._pending = 0
+        index = {'species': self.species_list, 'metrics': list(METRICS), 'dtype': RECORD_DTYPE.descr}
+        tmp = os.path.join(root, INDEX_FILE + '.tmp')
+        with open(tmp, 'w', encoding='utf-8') as f:
+            json.dump(index, f)
+        os.replace(tmp, os.path.join(root, INDEX_FILE))
+
+    def append(self, step: int, grids: Dict[str, np.ndarray]):
+        """Anexa las métricas del paso para cada especie presente en grids."""
+        record = self._record
+        record['step'] = step
+        for sp, f in self._files.items():
+            grid = grids.get(sp)
+            if grid is None:
+                continue
+            total = float(grid.sum())
+            record['mean'] = total / grid.size
+            record['max'] = float(grid.max())
+            record['total'] = total
+            f.write(record.tobytes())
+        self._pending += 1
+        if self._pending >= self.flush_every:
+            self.flush()
+
+    def flush(self):
+        for f in self._files.values():
+            f.flush()
+        self._pending = 0
+
+    def close(self):
+        for f in self._files.values():
+            f.close()
+        self._files = {}
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+class EvolutionStore:
+    """Consultas de solo lectura sobre el almacén de evolución."""
+
+    def __init__(self, root: str):
+        self.root = root
+
+    def exists(self) -> bool:
+        return os.path.exists(os.path.join(self.root, INDEX_FILE))
+
+    def species(self) -> List[str]:
+        if not self.exists():
+            return []
+        with open(os.path.join(self.root, INDEX_FILE), 'r', encoding='utf-8') as f:
+            return json.load(f)['species']
+
+    def _records(self, species: str) -> Optional[np.ndarray]:
+        path = os.path.join(self.root, f'{species}.bin')
+        if not os.path.exists(path):
+            return None
+        count = os.path.getsize(path) // RECORD_DTYPE.itemsize
+        if count == 0:
+            return np.zeros(0, dtype=RECORD_DTYPE)
+        return np.memmap(path, dtype=RECORD_DTYPE, mode='r', shape=(count,))
+
+    def query(self, species: str, start: Optional[int] = None, stop: Optional[int] = None,
+              stride: int = 1, metric: str = 'mean') -> Optional[Dict[str, list]]:
+        """
+        Serie de una especie para los pasos en [start, stop], tomando uno de cada stride.
+
+        Returns:
+            {'steps': [...], 'values': [...]} o None si la especie no está en el almacén
+        """
+        records = self._records(species)
+        if records is None or metric not in METRICS:
+            return None
+        steps = records['step']
+        lo = 0 if start is None else int(np.searchsorted(steps, start, side='left'))
+        hi = len(steps) if stop is None else int(np.searchsorted(steps, stop, side='right'))
+        window = records[lo:hi:max(1, int(stride))]
+        return {'steps': window['step'].tolist(), 'values': window[metric].tolist()}
+
+    def query_all(self, start: Optional[int] = None, stop: Optional[int] = None,
+                  stride: int = 1, metric: str = 'mean') -> Dict[str, Dict[str, list]]:
+        """Series de todas las especies del almacén (mismo formato que query)."""
+        result = {}
+        for sp in self.species():
+            series = self.query(sp, start, stop, stride, metric)
+            if series is not None:
+                result[sp] = series
+        return result
@@ -0,0 +1,127 @@
+"""
+Módulo de Pluma Gaussiana Vectorizada
+
+Versión NumPy de la pluma gaussiana de cs_module.update_pollution_multiple, para cuando no se
+puede cargar el módulo C. Usa las mismas fórmulas (emisión, elevación de la pluma, sigma de
+Pasquill-Gifford, ventana de ±100 m y alcance de 300 m) y, en lugar de recorrer celda a celda,
+evalúa de una vez las ventanas de un lote de vehículos con difusión de arrays y suma las
+contribuciones en la malla con np.bincount.
+"""
+
+import math
+from typing import Optional, Tuple
+
+import numpy as np
+
+from modules.vertical_layers import STABILITY_PARAMS
+
+WINDOW = 100.0         # Semiancho de la ventana de cálculo por vehículo (m)
+MAX_DISTANCE = 300.0   # Alcance máximo de la pluma (m)
+BATCH_CELLS = 1 << 20  # Celdas evaluadas por lote (acota la memoria temporal)
+
+
+def emission_rates(speed: np.ndarray, emission_factor: float) -> np.ndarray:
+    """Tasa de emisión por vehículo (igual que calculate_emission_rate en cs_module.c)."""
+    speed = np.asarray(speed, dtype=np.float64)
+    return 0.1 * np.where(speed > 20, 1 + 0.05 * (speed - 20), 1.0) * emission_factor
+
+
+def plume_rises(speed: np.ndarray) -> np.ndarray:
+    """Altura de la pluma por vehículo, mínimo 2 m (igual que calculate_plume_rise)."""
+    return np.maximum(2.0, np.asarray(speed, dtype=np.float64) * 0.15 + 0.5)
+
+
+def dispersion(distance: np.ndarray, stability_class: str) -> Tuple[np.ndarray, np.ndarray]:
+    """sigma_y y sigma_z (m) a la distancia dada para la clase de estabilidad."""
+    a, b = STABILITY_PARAMS.get(stability_class, (0.10, 0.05))
+    shrink = 1.0 / np.sqrt(1 + 0.0001 * distance)
+    return a * distance * shrink, b * distance * shrink
+
+
+def plume_windows(x: np.ndarray, y: np.ndarray, bounds, shape) -> Tuple[np.ndarray, ...]:
+    """
+    Ventanas [i_min, i_max) x [j_min, j_max) de cada vehículo, con el mismo redondeo que el
+    núcleo C (truncado hacia cero tras recortar al dominio).
+    """
+    x_min, x_max, y_min, y_max = bounds
+    ny, nx = shape
+    y = np.asarray(y, dtype=np.float64)
+    x = np.asarray(x, dtype=np.float64)
+    return (np.maximum(0.0, (y - y_min - WINDOW) / (y_max - y_min) * ny).astype(np.intp),
+            np.minimum(float(ny), (y - y_min + WINDOW) / (y_max - y_min) * ny).astype(np.intp),
+            np.maximum(0.0, (x - x_min - WINDOW) / (x_max - x_min) * nx).astype(np.intp),
+            np.minimum(float(nx), (x - x_min + WINDOW) / (x_max - x_min) * nx).astype(np.intp))
+
+
+def gaussian_plumes_py(grid: np.ndarray, x: np.ndarray, y: np.ndarray, emission: np.ndarray, height: np.ndarray,
+                       wind_speed: float, wind_direction: float, stability_class: str, bounds,
+                       obstacles: Optional[np.ndarray] = None, windows: Optional[Tuple[np.ndarray, ...]] = None):
+    """
+    Suma en grid [ny, nx] la pluma gaussiana de cada vehículo (in situ).
+
+    Args:
+        grid: Malla de concentración
+        x, y: Posición de los vehículos (m)
+        emission: Tasa de emisión de cada vehículo
+        height: Altura de la pluma de cada vehículo (m)
+        wind_speed: Velocidad del viento (m/s)
+        wind_direction: Dirección del viento (radianes)
+        stability_class: Clase de estabilidad de Pasquill
+        bounds: (x_min, x_max, y_min, y_max) del dominio
+        obstacles: Máscara booleana [ny, nx] de edificios (sin depósito dentro) o None
+        windows: Ventanas (i_min, i_max, j_min, j_max) por vehículo; por defecto plume_windows
+    """
+    ny, nx = grid.shape
+    x_min, x_max, y_min, y_max = bounds
+    cell_width, cell_height = (x_max - x_min) / nx, (y_max - y_min) / ny
+    x, y, emission, height = (np.atleast_1d(np.asarray(v, dtype=np.float64)) for v in (x, y, emission, height))
+    i_min, i_max, j_min, j_max = plume_windows(x, y, bounds, grid.shape) if windows is None \
+        else (np.atleast_1d(np.asarray(w, dtype=np.intp)) for w in windows)
+    rows = int(max(0, (i_max - i_min).max(initial=0)))
+    cols = int(max(0, (j_max - j_min).max(initial=0)))
+    if rows == 0 or cols == 0:
+        return
+    di = np.arange(rows)[None, :, None]
+    dj = np.arange(cols)[None, None, :]
+    batch = max(1, BATCH_CELLS // (rows * cols))
+    total = np.zeros(ny * nx)
+    for start in range(0, len(x), batch):
+        part = slice(start, start + batch)
+        ii = i_min[part, None, None] + di
+        jj = j_min[part, None, None] + dj
+        valid = (ii < i_max[part, None, None]) & (jj < j_max[part, None, None])
+        ii = np.minimum(ii, ny - 1)
+        jj = np.minimum(jj, nx - 1)
+        dx = x_min + (jj + 0.5) * cell_width - x[part, None, None]
+        dy = y_min + (ii + 0.5) * cell_height - y[part, None, None]
+        distance_squared = dx * dx + dy * dy
+        valid &= (distance_squared >= 1.0) & (distance_squared <= MAX_DISTANCE ** 2)
+        if obstacles is not None:
+            valid &= ~obstacles[ii, jj]
+        # A partir de aquí solo las celdas válidas, como vectores planos
+        owner = np.nonzero(valid)[0]
+        cells = np.broadcast_to(ii * nx + jj, valid.shape)[valid]
+        dx = np.broadcast_to(dx, valid.shape)[valid]
+        dy = np.broadcast_to(dy, valid.shape)[valid]
+        distance = np.sqrt(distance_squared[valid])
+        angle = np.arctan2(dy, dx)
+        angle -= wind_direction
+        np.abs(angle, out=angle)
+        angle = np.minimum(angle, 2.0 * math.pi - angle)
+        sigma_y, sigma_z = dispersion(distance, stability_class)
+        with np.errstate(divide='ignore'):
+            factor = emission[part] / (2.0 * math.pi * wind_speed)
+        # Término lateral y vertical (reflexión en el suelo) en una sola exponencial
+        angle /= sigma_y
+        angle *= angle
+        vertical = height[part][owner]
+        vertical /= sigma_z
+        vertical *= vertical
+        angle += vertical
+        angle *= -0.5
+        concentration = np.exp(angle, out=angle)
+        concentration *= 2.0 * factor[owner]
+        sigma_y *= sigma_z
+        concentration /= sigma_y
+        total += np.bincount(cells, weights=concentration, minlength=ny * nx)
+    grid += total.reshape(ny, nx)
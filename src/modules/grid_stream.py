@@ -0,0 +1,232 @@
+"""
+Módulo de Streaming de Mallas de Contaminación
+
+Este módulo codifica las mallas de contaminación de la simulación en curso como
+mensajes binarios compactos (deltas por teselas) para enviarlos al navegador
+mediante Server-Sent Events. El navegador reconstruye la malla y la pinta en un
+canvas, de modo que el servidor no tiene que renderizar ningún PNG.
+
+Formato de cada mensaje (little-endian):
+    cabecera  '<4sBBHHHIfI'  magic b'CSGD', versión, flags, ny, nx, tamaño de tesela,
+                            paso, escala (valor que corresponde a 255), nº de teselas
+    índices   '<2H' * n      (fila, columna) de cada tesela cambiada
+    payload   zlib( bytes uint8 de todas las teselas, en el mismo orden )
+
+Las teselas de borde se rellenan con ceros hasta el tamaño completo para que el
+decodificador pueda tratarlas todas igual.
+"""
+
+import base64
+import struct
+import threading
+import zlib
+from collections import deque
+from typing import Dict, Optional, Tuple
+
+import numpy as np
+
+MAGIC = b'CSGD'
+VERSION = 1
+FLAG_KEYFRAME = 0x01
+HEADER_FORMAT = '<4sBBHHHIfI'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+DEFAULT_TILE = 32
+
+# Si el máximo de la malla cambia más que este factor, se recuantiza todo (keyframe)
+RESCALE_TOLERANCE = 1.25
+
+
+def quantize_grid(grid: np.ndarray, scale: float) -> np.ndarray:
+    """
+    Cuantiza una malla de concentraciones a uint8 en el rango [0, scale].
+
+    Args:
+        grid: Malla 2D de concentraciones
+        scale: Concentración que se corresponde con el valor 255
+
+    Returns:
+        Malla uint8 de la misma forma
+    """
+    if scale <= 0:
+        return np.zeros(grid.shape, dtype=np.uint8)
+    q = np.clip(grid * (255.0 / scale), 0.0, 255.0)
+    return (q + 0.5).astype(np.uint8)
+
+
+def _pad_to_tiles(frame: np.ndarray, tile: int) -> np.ndarray:
+    ny, nx = frame.shape
+    py = (-ny) % tile
+    px = (-nx) % tile
+    if py or px:
+        frame = np.pad(frame, ((0, py), (0, px)))
+    return frame
+
+
+def _tiles_view(frame: np.ndarray, tile: int) -> np.ndarray:
+    """Vista (nty, ntx, tile, tile) de una malla ya rellenada a múltiplos de tile."""
+    ny, nx = frame.shape
+    return frame.reshape(ny // tile, tile, nx // tile, tile).swapaxes(1, 2)
+
+
+def encode_frame(frame: np.ndarray, previous: Optional[np.ndarray], step: int,
+                 scale: float, tile: int = DEFAULT_TILE) -> bytes:
+    """
+    Codifica una malla cuantizada como delta respecto a la anterior.
+
+    Args:
+        frame: Malla uint8 actual (sin rellenar)
+        previous: Malla uint8 anterior de la misma forma, o None para un keyframe
+        step: Paso de simulación
+        scale: Escala usada en la cuantización
+        tile: Tamaño de tesela en celdas
+
+    Returns:
+        Mensaje binario con la cabecera, índices y payload comprimido
+    """
+    ny, nx = frame.shape
+    tiles = _tiles_view(_pad_to_tiles(frame, tile), tile)
+    if previous is None:
+        changed = np.ones(tiles.shape[:2], dtype=bool)
+        flags = FLAG_KEYFRAME
+    else:
+        prev_tiles = _tiles_view(_pad_to_tiles(previous, tile), tile)
+        changed = np.any(tiles != prev_tiles, axis=(2, 3))
+        flags = 0
+    rows, cols = np.nonzero(changed)
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, flags, ny, nx, tile,
+                         step, float(scale), len(rows))
+    index = np.stack([rows, cols], axis=1).astype('<u2').tobytes()
+    payload = zlib.compress(np.ascontiguousarray(tiles[rows, cols]).tobytes(), 1)
+    return header + index + payload
+
+
+def decode_frame(message: bytes, previous: Optional[np.ndarray] = None) -> Tuple[np.ndarray, int, float]:
+    """
+    Aplica un mensaje sobre la malla cuantizada anterior (inverso de encode_frame).
+
+    Returns:
+        Tupla (malla uint8, paso, escala)
+    """
+    magic, version, flags, ny, nx, tile, step, scale, n = struct.unpack_from(HEADER_FORMAT, message)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("Mensaje de malla no reconocido")
+    if flags & FLAG_KEYFRAME or previous is None:
+        padded = np.zeros((ny + (-ny) % tile, nx + (-nx) % tile), dtype=np.uint8)
+    else:
+        padded = _pad_to_tiles(previous, tile).copy()
+    offset = HEADER_SIZE
+    index = np.frombuffer(message, dtype='<u2', count=2 * n, offset=offset).reshape(n, 2)
+    offset += 4 * n
+    data = np.frombuffer(zlib.decompress(message[offset:]), dtype=np.uint8).reshape(n, tile, tile)
+    tiles = _tiles_view(padded, tile)
+    tiles[index[:, 0], index[:, 1]] = data
+    return padded[:ny, :nx], step, scale
+
+
+class _SpeciesChannel:
+    """Estado de streaming de una especie: última malla cuantizada y deltas recientes."""
+
+    def __init__(self, history: int):
+        self.frame = None
+        self.scale = 0.0
+        self.step = -1
+        self.seq = 0
+        self.deltas = deque(maxlen=history)  # (seq, mensaje)
+
+
+class GridStreamHub:
+    """
+    Punto de publicación/suscripción entre la simulación y los clientes web.
+
+    La simulación llama a publish() en cada paso; cada suscriptor recibe primero un
+    keyframe y después solo los deltas. Un suscriptor que se queda atrás más allá
+    del historial recibe un nuevo keyframe en lugar de los deltas perdidos.
+    """
+
+    def __init__(self, tile: int = DEFAULT_TILE, history: int = 64):
+        self.tile = tile
+        self.history = history
+        self._channels: Dict[str, _SpeciesChannel] = {}
+        self._subscribers = 0
+        self._cond = threading.Condition()
+
+    def has_subscribers(self) -> bool:
+        return self._subscribers > 0
+
+    def publish(self, species: str, step: int, grid: np.ndarray):
+        """
+        Publica la malla de una especie. No hace nada si no hay clientes conectados.
+        """
+        if not self.has_subscribers():
+            return
+        peak = float(np.max(grid)) if grid.size else 0.0
+        with self._cond:
+            ch = self._channels.setdefault(species, _SpeciesChannel(self.history))
+            rescale = (ch.frame is None or peak > ch.scale or
+                       peak * RESCALE_TOLERANCE ** 2 < ch.scale)
+            scale = peak * RESCALE_TOLERANCE if rescale else ch.scale
+            frame = quantize_grid(grid, scale)
+            if ch.frame is not None and ch.frame.shape != frame.shape:
+                rescale = True
+            message = encode_frame(frame, None if rescale else ch.frame, step, scale, self.tile)
+            ch.seq += 1
+            if rescale:
+                ch.deltas.clear()
+            ch.deltas.append((ch.seq, message))
+            ch.frame = frame
+            ch.scale = scale
+            ch.step = step
+            self._cond.notify_all()
+
+    def keyframe(self, species: str) -> Tuple[int, Optional[bytes]]:
+        """Devuelve (seq, keyframe) del estado actual de una especie."""
+        with self._cond:
+            ch = self._channels.get(species)
+            if ch is None or ch.frame is None:
+                return 0, None
+            return ch.seq, encode_frame(ch.frame, None, ch.step, ch.scale, self.tile)
+
+    def subscribe(self, species: str, timeout: float = 15.0):
+        """
+        Generador de mensajes binarios para un cliente.
+
+        Emite None cada `timeout` segundos sin datos para que el llamador pueda
+        enviar un keep-alive y detectar desconexiones.
+        """
+        with self._cond:
+            self._subscribers += 1
+        try:
+            seq, message = self.keyframe(species)
+            if message is not None:
+                yield message
+            while True:
+                with self._cond:
+                    ch = self._channels.get(species)
+                    if ch is None or ch.seq <= seq:
+                        self._cond.wait(timeout)
+                        ch = self._channels.get(species)
+                    pending = [] if ch is None else [(s, m) for s, m in ch.deltas if s > seq]
+                    lost = ch is not None and ch.seq > seq and (not pending or pending[0][0] != seq + 1)
+                if lost:
+                    seq, message = self.keyframe(species)
+                    yield message
+                elif pending:
+                    for s, m in pending:
+                        yield m
+                    seq = pending[-1][0]
+                else:
+                    yield None
+        finally:
+            with self._cond:
+                self._subscribers -= 1
+
+
+def sse_event(message: Optional[bytes]) -> str:
+    """Formatea un mensaje binario (o un keep-alive si es None) como evento SSE."""
+    if message is None:
+        return ': keep-alive\n\n'
+    return 'event: grid\ndata: ' + base64.b64encode(message).decode('ascii') + '\n\n'
+
+
+# Instancia compartida entre la simulación (main.py) y la WebApp
+stream_hub = GridStreamHub()
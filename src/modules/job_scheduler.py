@@ -0,0 +1,340 @@
+"""
+Módulo de Planificación de Simulaciones (cola de trabajos y pool de procesos)
+
+Cada simulación lanzada desde la WebApp es un trabajo que entra en una cola FIFO.
+Un número acotado de ranuras (por defecto, núcleos - 1) consume la cola; cada
+ranura ejecuta el trabajo en un proceso propio con su propia instancia de SUMO en
+un puerto TraCI reservado para esa ranura (o libsumo, si se pide), de modo que dos
+usuarios concurrentes no comparten conexión ni ficheros de salida.
+
+Estados de un trabajo:
+    queued -> running -> finished | failed | cancelled
+
+Límites por trabajo (acotados por los del planificador):
+    max_runtime_s   tiempo de pared; al superarlo el proceso se termina
+    max_memory_mb   espacio de direcciones del proceso (RLIMIT_AS, solo POSIX)
+"""
+
+import glob
+import itertools
+import multiprocessing
+import os
+import shutil
+import sys
+import threading
+import time
+import traceback
+from collections import deque
+from dataclasses import dataclass, field
+from typing import Any, Callable, Dict, List, Optional
+
+from modules.shared_grid import SharedGridWriter, SharedGridReader, STATUS_FAILED
+
+QUEUED = 'queued'
+RUNNING = 'running'
+FINISHED = 'finished'
+FAILED = 'failed'
+CANCELLED = 'cancelled'
+TERMINAL_STATES = (FINISHED, FAILED, CANCELLED)
+
+# Ficheros que una simulación deja en su directorio de trabajo y que se publican
+# en el directorio de resultados común al terminar (los usa el panel web)
+RESULT_PATTERNS = ('pollution_grid_*', 'pollution_evolution.*', 'detailed_timing.log', 'receptors.csv', '*.mp4')
+RESULT_DIRS = ('tiles', 'evolution', 'puffs')
+
+
+@dataclass(eq=False)
+class Job:
+    """Estado de un trabajo de simulación."""
+    job_id: str
+    config: Dict[str, Any]
+    max_runtime_s: Optional[float] = None
+    max_memory_mb: Optional[int] = None
+    state: str = QUEUED
+    created_at: float = field(default_factory=time.time)
+    started_at: Optional[float] = None
+    finished_at: Optional[float] = None
+    port: Optional[int] = None
+    shared_name: Optional[str] = None
+    output_dir: Optional[str] = None
+    exit_code: Optional[int] = None
+    error: Optional[str] = None
+    cancel_requested: bool = False
+    process: Any = field(default=None, repr=False)
+    reader: Any = field(default=None, repr=False)
+    _owner: Any = field(default=None, repr=False)
+
+    def to_dict(self) -> Dict[str, Any]:
+        """Representación serializable (JSON) del trabajo."""
+        return {
+            'job_id': self.job_id,
+            'state': self.state,
+            'created_at': self.created_at,
+            'started_at': self.started_at,
+            'finished_at': self.finished_at,
+            'port': self.port,
+            'shared_memory': self.shared_name,
+            'output_dir': self.output_dir,
+            'exit_code': self.exit_code,
+            'error': self.error,
+            'limits': {'max_runtime_s': self.max_runtime_s, 'max_memory_mb': self.max_memory_mb},
+        }
+
+
+def _apply_limits(max_memory_mb: Optional[int]):
+    if max_memory_mb and sys.platform != 'win32':
+        import resource
+        limit = int(max_memory_mb) * 1024 * 1024
+        resource.setrlimit(resource.RLIMIT_AS, (limit, limit))
+
+
+def _job_entry(config: Dict[str, Any], output_dir: str, max_memory_mb: Optional[int]):
+    """
+    Punto de entrada del proceso de un trabajo. Se ejecuta en su propio directorio
+    para que los ficheros relativos de run_simulation no colisionen con otros trabajos.
+    """
+    _apply_limits(max_memory_mb)
+    os.chdir(output_dir)
+    if config.get('use_libsumo'):
+        # libsumo expone la misma API que traci, sin socket ni proceso SUMO aparte
+        try:
+            import libsumo
+            sys.modules['traci'] = libsumo
+        except ImportError:
+            pass
+    from main import run_simulation
+    run_simulation(config)
+
+
+class JobScheduler:
+    """
+    Cola de trabajos con un pool acotado de procesos trabajadores.
+
+    Args:
+        results_dir: Directorio común de resultados (y raíz de los directorios por trabajo)
+        max_workers: Simulaciones simultáneas como máximo
+        base_port: Primer puerto TraCI; la ranura k usa base_port + k
+        max_runtime_s / max_memory_mb: Límites por defecto y máximos por trabajo
+        on_tick: Llamada periódica (job) mientras un trabajo está en ejecución
+        on_finish: Llamada (job) cuando un trabajo termina, en cualquier estado final
+        retained_snapshots: Trabajos terminados cuya última instantánea se conserva en memoria
+        target: Función (config, output_dir, max_memory_mb) que ejecuta un trabajo en su proceso
+
+    Los errores de on_tick y on_finish se informan por stderr y no afectan ni al trabajo ni
+    a la ranura que lo ejecuta.
+    """
+
+    def __init__(self, results_dir: str, max_workers: Optional[int] = None, base_port: int = 8813,
+                 max_runtime_s: Optional[float] = None, max_memory_mb: Optional[int] = None,
+                 on_tick: Optional[Callable[[Job], None]] = None,
+                 on_finish: Optional[Callable[[Job], None]] = None,
+                 poll_interval: float = 0.05, retained_snapshots: int = 4,
+                 target: Callable[[Dict[str, Any], str, Optional[int]], None] = _job_entry):
+        self.results_dir = results_dir
+        self.max_workers = max_workers or max(1, (os.cpu_count() or 2) - 1)
+        self.base_port = base_port
+        self.max_runtime_s = max_runtime_s
+        self.max_memory_mb = max_memory_mb
+        self.on_tick = on_tick
+        self.on_finish = on_finish
+        self.poll_interval = poll_interval
+        self.retained_snapshots = retained_snapshots
+        self.target = target
+        self.jobs: Dict[str, Job] = {}
+        self._queue = deque()
+        self._cond = threading.Condition()
+        self._ids = itertools.count(1)
+        self._ctx = multiprocessing.get_context('spawn')
+        self._slots = [threading.Thread(target=self._slot_loop, args=(k,), daemon=True,
+                                        name=f'JobSlot-{k}') for k in range(self.max_workers)]
+        for t in self._slots:
+            t.start()
+
+    # --- API pública ---------------------------------------------------------
+
+    def submit(self, config: Dict[str, Any]) -> Job:
+        """Encola una simulación y devuelve su trabajo."""
+        job = Job(job_id=f"{int(time.time())}-{next(self._ids)}", config=dict(config),
+                  max_runtime_s=self._cap(config.get('max_runtime_s'), self.max_runtime_s),
+                  max_memory_mb=self._cap(config.get('max_memory_mb'), self.max_memory_mb))
+        with self._cond:
+            self.jobs[job.job_id] = job
+            self._queue.append(job)
+            self._cond.notify()
+        return job
+
+    def cancel(self, job_id: str) -> bool:
+        """
+        Cancela un trabajo en cola (se descarta) o en ejecución (se termina su proceso).
+        Devuelve False si el trabajo no existe o ya había terminado.
+        """
+        with self._cond:
+            job = self.jobs.get(job_id)
+            if job is None or job.state in TERMINAL_STATES:
+                return False
+            job.cancel_requested = True
+            if job.state == QUEUED:
+                self._queue.remove(job)
+                job.state = CANCELLED
+                job.finished_at = time.time()
+                finished = True
+            else:
+                finished = False
+        if finished:
+            self._notify(self.on_finish, job)
+        return True
+
+    def get(self, job_id: str) -> Optional[Job]:
+        return self.jobs.get(job_id)
+
+    def list(self) -> List[Job]:
+        with self._cond:
+            return sorted(self.jobs.values(), key=lambda j: j.created_at)
+
+    def latest_running(self) -> Optional[Job]:
+        running = [j for j in self.list() if j.state == RUNNING and j.reader is not None]
+        return running[-1] if running else None
+
+    def queue_position(self, job_id: str) -> Optional[int]:
+        with self._cond:
+            for pos, job in enumerate(self._queue):
+                if job.job_id == job_id:
+                    return pos
+        return None
+
+    # --- Implementación -------------------------------------------------------
+
+    @staticmethod
+    def _cap(requested, maximum):
+        if requested in (None, ''):
+            return maximum
+        requested = float(requested)
+        return requested if maximum is None else min(requested, maximum)
+
+    def _slot_loop(self, slot: int):
+        while True:
+            with self._cond:
+                while not self._queue:
+                    self._cond.wait()
+                job = self._queue.popleft()
+                job.state = RUNNING
+                job.started_at = time.time()
+            try:
+                self._run(job, slot)
+            except Exception:
+                job.state = FAILED
+                job.error = traceback.format_exc(limit=3)
+            job.finished_at = time.time()
+            try:
+                self._release(job)
+            except Exception:
+                traceback.print_exc()
+            self._notify(self.on_finish, job)
+
+    @staticmethod
+    def _notify(callback: Optional[Callable[[Job], None]], job: Job):
+        # Un fallo del llamante (SSE, persistencia...) no debe tumbar el trabajo ni la ranura
+        if callback is None:
+            return
+        try:
+            callback(job)
+        except Exception:
+            print(f"Error en {getattr(callback, '__name__', callback)} (trabajo {job.job_id}):", file=sys.stderr)
+            traceback.print_exc()
+
+    @staticmethod
+    def _stop(process):
+        process.terminate()
+        process.join(5)
+        if process.is_alive():
+            process.kill()
+            process.join()
+
+    def _prepare(self, job: Job, slot: int) -> Dict[str, Any]:
+        config = job.config
+        species_list = config.get('species_list') or ['NOx']
+        if isinstance(species_list, str):
+            species_list = [sp.strip() for sp in species_list.split(',') if sp.strip()]
+        config['species_list'] = species_list
+        config['grid_resolution'] = int(config.get('grid_resolution', 100))
+        res = config['grid_resolution']
+
+        job.port = self.base_port + slot
+        job.output_dir = os.path.join(self.results_dir, 'jobs', job.job_id)
+        os.makedirs(job.output_dir, exist_ok=True)
+        job._owner = SharedGridWriter.create(species_list, (res, res))
+        job.shared_name = job._owner.name
+        job.reader = SharedGridReader.attach(job.shared_name)
+
+        child_config = dict(config)
+        child_config.update({
+            'shared_memory': job.shared_name,
+            'traci_port': job.port,
+            'traci_label': f'job-{job.job_id}',
+            'headless': True,
+        })
+        if config.get('sumo_config') and not os.path.isabs(config['sumo_config']):
+            child_config['sumo_config'] = os.path.abspath(config['sumo_config'])
+        return child_config
+
+    def _run(self, job: Job, slot: int):
+        child_config = self._prepare(job, slot)
+        process = self._ctx.Process(target=self.target, name=f'SimulationJob-{job.job_id}',
+                                    args=(child_config, job.output_dir, job.max_memory_mb), daemon=True)
+        job.process = process
+        process.start()
+        deadline = job.started_at + job.max_runtime_s if job.max_runtime_s else None
+        try:
+            while process.is_alive():
+                if job.cancel_requested or (deadline and time.time() > deadline):
+                    break
+                self._notify(self.on_tick, job)
+                process.join(self.poll_interval)
+        finally:
+            # Ante cualquier salida (cancelación, límite o error) el proceso no sobrevive a la
+            # ranura: liberaría el puerto TraCI que va a usar el siguiente trabajo
+            if process.is_alive():
+                self._stop(process)
+            process.join()
+        job.exit_code = process.exitcode
+        if job.cancel_requested:
+            job.state = CANCELLED
+        elif deadline and time.time() > deadline and process.exitcode != 0:
+            job.state = FAILED
+            job.error = f"Tiempo máximo de ejecución superado ({job.max_runtime_s:.0f} s)"
+        elif process.exitcode == 0:
+            job.state = FINISHED
+            self._publish_results(job)
+        else:
+            job.state = FAILED
+            job.error = f"El proceso terminó con código {process.exitcode}"
+        self._notify(self.on_tick, job)  # última instantánea
+
+    def _publish_results(self, job: Job):
+        """Copia los resultados del trabajo al directorio común que consulta el panel web."""
+        for pattern in RESULT_PATTERNS:
+            for path in glob.glob(os.path.join(job.output_dir, pattern)):
+                shutil.copy2(path, self.results_dir)
+        for dirname in RESULT_DIRS:
+            path = os.path.join(job.output_dir, dirname)
+            if os.path.isdir(path):
+                shutil.copytree(path, os.path.join(self.results_dir, dirname), dirs_exist_ok=True)
+
+    def _release(self, job: Job):
+        # El lector del trabajo sigue disponible para consultas finales; el nombre del
+        # segmento se elimina ya (los mapeos existentes siguen siendo válidos)
+        if job._owner is not None:
+            if job.state != FINISHED:
+                # El hijo pudo morir (terminate/kill) a mitad de publish: el lector conservado
+                # no debe quedar con seq impar ni con el trabajo marcado como en ejecución
+                job._owner.abandon(STATUS_FAILED)
+            job._owner.close()
+            job._owner.shm.unlink()
+            job._owner = None
+        job.process = None
+        with self._cond:
+            done = [j for j in self.jobs.values() if j.state in TERMINAL_STATES and j.reader is not None]
+        done.sort(key=lambda j: j.finished_at or 0)
+        for old in done[:max(0, len(done) - self.retained_snapshots)]:
+            old.reader.close()
+            old.reader = None
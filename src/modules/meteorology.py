@@ -0,0 +1,253 @@
+"""
+Módulo de Meteorología Variable en el Tiempo
+
+Serie temporal de meteorología (viento, temperatura, humedad, precipitación, altura de
+mezcla, fotólisis del NO2 y clase de estabilidad) interpolada en cada paso de la simulación:
+    - MetSeries.from_csv / from_netcdf: fichero local con una columna 'time' (segundos o
+      fecha-hora) y las variables disponibles; el viento puede darse como u/v
+    - MetSeries.synthetic: perfiles diurnos sintéticos (sol, temperatura, humedad, viento)
+    - MetBuckets: cuantización con histéresis de los parámetros, para reconstruir lo que
+      depende de ellos (tasas de deposición, química, sigma de las bocanadas) solo cuando
+      un parámetro cambia de intervalo y no en cada paso
+
+La dirección del viento se interpola por componentes (sin saltos entre 359° y 1°). Si el
+fichero no trae clase de estabilidad se deduce con la tabla de Pasquill-Turner a partir del
+viento y la elevación solar.
+"""
+
+import math
+import os
+from typing import Any, Dict, Optional, Sequence, Set
+
+import numpy as np
+
+# Variables numéricas interpoladas
+MET_FIELDS = ('wind_speed', 'wind_direction', 'temperature', 'humidity', 'precipitation',
+              'mixing_height', 'j_no2')
+# Anchura de intervalo por parámetro: un cambio menor no invalida nada
+DEFAULT_QUANTUM = {'wind_speed': 0.25, 'wind_direction': 5.0, 'temperature': 1.0, 'humidity': 5.0,
+                   'precipitation': 0.25, 'mixing_height': 25.0, 'j_no2': 5e-4}
+DAY = 86400.0
+
+# Pasquill-Turner: (viento máximo m/s, clases con insolación fuerte, moderada, débil y de noche)
+PASQUILL = ((2.0, 'ABBF'), (3.0, 'BBCF'), (5.0, 'BCCE'), (6.0, 'CCDD'), (math.inf, 'CDDD'))
+
+
+def solar_elevation(seconds: float, day_of_year: int = 172, latitude: float = 40.4) -> float:
+    """Elevación solar (grados) a una hora solar dada en segundos desde medianoche."""
+    declination = math.radians(23.44) * math.sin(2.0 * math.pi * (284 + day_of_year) / 365.0)
+    hour_angle = math.radians(15.0 * ((seconds % DAY) / 3600.0 - 12.0))
+    lat = math.radians(latitude)
+    sin_elev = math.sin(lat) * math.sin(declination) + math.cos(lat) * math.cos(declination) * math.cos(hour_angle)
+    return math.degrees(math.asin(max(-1.0, min(1.0, sin_elev))))
+
+
+def pasquill_class(wind_speed: float, elevation: float) -> str:
+    """Clase de estabilidad (A-F) según el viento (m/s) y la elevación solar (grados)."""
+    if 0.0 < elevation <= 15.0:
+        return 'D'
+    column = 3 if elevation <= 0.0 else (0 if elevation > 60.0 else 1 if elevation > 35.0 else 2)
+    for limit, classes in PASQUILL:
+        if wind_speed < limit:
+            return classes[column]
+    return 'D'
+
+
+def photolysis_no2(elevation: float) -> float:
+    """Frecuencia de fotólisis del NO2 (1/s) con cielo despejado: l cos^m(z) exp(-n / cos(z))."""
+    cos_zenith = math.sin(math.radians(elevation))
+    if cos_zenith <= 0.0:
+        return 0.0
+    return 1.165e-2 * cos_zenith ** 0.244 * math.exp(-0.267 / cos_zenith)
+
+
+class MetSeries:
+    """
+    Serie temporal de meteorología con interpolación lineal.
+
+    Args:
+        times: Instantes de los registros (s), crecientes
+        columns: Variable -> valores por registro (subconjunto de MET_FIELDS)
+        stability: Clase de estabilidad por registro, o None para deducirla
+        period: Si no es None, la serie se repite con ese periodo (s); si no, se mantienen
+            los valores extremos fuera del intervalo
+        day_offset: Hora solar (s desde medianoche) del instante 0
+        day_of_year, latitude: Para la elevación solar
+    """
+
+    def __init__(self, times: Sequence[float], columns: Dict[str, Sequence[float]],
+                 stability: Optional[Sequence[str]] = None, period: Optional[float] = None,
+                 day_offset: float = 0.0, day_of_year: int = 172, latitude: float = 40.4):
+        self.times = np.asarray(times, dtype=np.float64)
+        if len(self.times) == 0 or np.any(np.diff(self.times) <= 0):
+            raise ValueError("La serie meteorológica necesita instantes estrictamente crecientes")
+        self.columns = {name: np.asarray(values, dtype=np.float64) for name, values in columns.items()
+                        if name in MET_FIELDS}
+        self.stability = None if stability is None else [str(s).strip().upper() for s in stability]
+        self.period = period
+        self.day_offset = float(day_offset)
+        self.day_of_year = int(day_of_year)
+        self.latitude = float(latitude)
+        # La dirección (grados desde el eje x hacia donde sopla, como config['wind_direction'])
+        # se interpola como vector unitario
+        if 'wind_direction' in self.columns:
+            rad = np.radians(self.columns['wind_direction'])
+            self._dir_cos, self._dir_sin = np.cos(rad), np.sin(rad)
+
+    @classmethod
+    def from_csv(cls, path: str, **kwargs) -> 'MetSeries':
+        """Lee un CSV con columna 'time' (segundos o fecha-hora) y las variables disponibles."""
+        import pandas as pd
+        frame = pd.read_csv(path)
+        frame.columns = [c.strip().lower() for c in frame.columns]
+        return cls._from_table({c: frame[c].to_numpy() for c in frame.columns}, **kwargs)
+
+    @classmethod
+    def from_netcdf(cls, path: str, **kwargs) -> 'MetSeries':
+        """Lee un NetCDF con dimensión 'time' (segundos) y variables con los mismos nombres que el CSV."""
+        try:
+            from netCDF4 import Dataset
+        except ImportError:
+            from scipy.io import netcdf_file as Dataset
+        dataset = Dataset(path, 'r')
+        try:
+            table = {name.lower(): np.array(var[:]).reshape(-1) for name, var in dataset.variables.items()}
+        finally:
+            dataset.close()
+        return cls._from_table(table, **kwargs)
+
+    @classmethod
+    def _from_table(cls, table: Dict[str, np.ndarray], **kwargs) -> 'MetSeries':
+        if 'time' not in table:
+            raise ValueError("La serie meteorológica necesita una columna 'time'")
+        times = table['time']
+        if not np.issubdtype(np.asarray(times).dtype, np.number):
+            import pandas as pd
+            stamps = pd.to_datetime(times)
+            midnight = stamps[0].normalize()
+            times = (stamps - midnight).total_seconds().to_numpy()
+            kwargs.setdefault('day_of_year', int(stamps[0].dayofyear))
+            kwargs.setdefault('day_offset', 0.0)
+        columns = {name: table[name] for name in MET_FIELDS if name in table}
+        if 'wind_speed' not in columns and 'u' in table and 'v' in table:
+            # Componentes (u, v) hacia donde sopla el viento, igual que wind_field
+            u, v = np.asarray(table['u'], dtype=np.float64), np.asarray(table['v'], dtype=np.float64)
+            columns['wind_speed'] = np.hypot(u, v)
+            columns['wind_direction'] = np.degrees(np.arctan2(v, u)) % 360.0
+        stability = table.get('stability_class')
+        return cls(times, columns, stability=stability, **kwargs)
+
+    @classmethod
+    def synthetic(cls, mean_wind: float = 3.0, wind_direction: float = 0.0, temperature=(12.0, 26.0),
+                  humidity=(35.0, 85.0), mixing_height=(200.0, 1200.0), day_of_year: int = 172,
+                  latitude: float = 40.4, step: float = 600.0) -> 'MetSeries':
+        """
+        Perfiles diurnos de 24 h (periódicos): el viento y la capa de mezcla crecen con el sol,
+        la temperatura alcanza el máximo a media tarde y la humedad varía en oposición.
+        """
+        times = np.arange(0.0, DAY + step, step)
+        elevation = np.array([solar_elevation(t, day_of_year, latitude) for t in times])
+        sun = np.clip(np.sin(np.radians(elevation)), 0.0, None)
+        sun_max = max(sun.max(), 1e-6)
+        # Máximo térmico hacia las 15 h y mínimo al amanecer
+        phase = np.cos(2.0 * math.pi * (times / DAY - 15.0 / 24.0))
+        t_min, t_max = temperature
+        h_min, h_max = humidity
+        columns = {
+            'temperature': t_min + (t_max - t_min) * 0.5 * (1.0 + phase),
+            'humidity': h_max - (h_max - h_min) * 0.5 * (1.0 + phase),
+            'wind_speed': mean_wind * (0.6 + 0.8 * sun / sun_max),
+            'wind_direction': (wind_direction + 20.0 * np.sin(2.0 * math.pi * times / DAY)) % 360.0,
+            'mixing_height': mixing_height[0] + (mixing_height[1] - mixing_height[0]) * sun / sun_max,
+            'j_no2': np.array([photolysis_no2(e) for e in elevation]),
+        }
+        return cls(times, columns, period=DAY, day_of_year=day_of_year, latitude=latitude)
+
+    @classmethod
+    def from_config(cls, config: Dict[str, Any]) -> Optional['MetSeries']:
+        """Serie de config['meteorology']: ruta .csv/.nc o 'synthetic'; None si no hay."""
+        source = config.get('meteorology')
+        if not source:
+            return None
+        kwargs = {'day_of_year': int(config.get('day_of_year', 172)), 'latitude': float(config.get('latitude', 40.4))}
+        if source == 'synthetic':
+            return cls.synthetic(mean_wind=float(config.get('wind_speed', 3.0)),
+                                 wind_direction=float(config.get('wind_direction', 0.0)), **kwargs)
+        extension = os.path.splitext(source)[1].lower()
+        if extension in ('.nc', '.nc4', '.cdf'):
+            return cls.from_netcdf(source, **kwargs)
+        return cls.from_csv(source, **kwargs)
+
+    def at(self, t: float) -> Dict[str, Any]:
+        """
+        Meteorología interpolada en el instante t (s). Incluye 'stability_class' (del
+        registro vigente o deducida) y, si la serie no la trae, 'j_no2' según el sol.
+        """
+        if self.period is not None:
+            t = self.times[0] + (t - self.times[0]) % self.period
+        state = {name: float(np.interp(t, self.times, values)) for name, values in self.columns.items()}
+        if 'wind_direction' in state:
+            c = np.interp(t, self.times, self._dir_cos)
+            s = np.interp(t, self.times, self._dir_sin)
+            state['wind_direction'] = math.degrees(math.atan2(s, c)) % 360.0
+        elevation = solar_elevation(self.day_offset + t, self.day_of_year, self.latitude)
+        if self.stability is not None:
+            index = int(np.clip(np.searchsorted(self.times, t, side='right') - 1, 0, len(self.times) - 1))
+            state['stability_class'] = self.stability[index]
+        elif 'wind_speed' in state:
+            state['stability_class'] = pasquill_class(state['wind_speed'], elevation)
+        if 'j_no2' not in state:
+            state['j_no2'] = photolysis_no2(elevation)
+        return state
+
+
+class MetBuckets:
+    """
+    Cuantización con histéresis de los parámetros meteorológicos.
+
+    Cada parámetro mantiene un valor representativo (centro de su intervalo) que solo cambia
+    cuando el valor real se aleja de él más de (0.5 + hysteresis) intervalos, así que una
+    variable que oscila en el borde de un intervalo no provoca reconstrucciones continuas.
+
+    Args:
+        quantum: Anchura de intervalo por parámetro (por defecto DEFAULT_QUANTUM)
+        hysteresis: Margen adicional, en fracción de intervalo, antes de cambiar
+    """
+
+    def __init__(self, quantum: Optional[Dict[str, float]] = None, hysteresis: float = 0.25):
+        self.quantum = dict(DEFAULT_QUANTUM)
+        if quantum:
+            self.quantum.update({name: float(value) for name, value in quantum.items()})
+        self.hysteresis = float(hysteresis)
+        self.held: Dict[str, Any] = {}
+        self.invalidations = 0
+
+    def _snap(self, name: str, value: float) -> float:
+        q = self.quantum.get(name, 0.0)
+        snapped = round(value / q) * q if q > 0 else value
+        return snapped % 360.0 if name == 'wind_direction' else snapped
+
+    def update(self, state: Dict[str, Any]) -> Set[str]:
+        """
+        Incorpora el estado de un paso y devuelve los parámetros cuyo valor representativo
+        ha cambiado (todos en la primera llamada).
+        """
+        changed = set()
+        for name, value in state.items():
+            held = self.held.get(name)
+            if name not in MET_FIELDS:
+                if value != held:
+                    self.held[name] = value
+                    changed.add(name)
+                continue
+            if held is not None:
+                diff = abs(value - held)
+                if name == 'wind_direction':
+                    diff = min(diff, 360.0 - diff)
+                if diff <= self.quantum.get(name, 0.0) * (0.5 + self.hysteresis):
+                    continue
+            self.held[name] = self._snap(name, value)
+            changed.add(name)
+        if changed:
+            self.invalidations += 1
+        return changed
@@ -0,0 +1,437 @@
+"""
+Módulo de Dispersión Lagrangiana por Bocanadas (puffs)
+
+Alternativa al transporte euleriano: cada vehículo emite en cada paso una bocanada con la
+masa emitida de cada especie. Las bocanadas se desplazan con el viento (uniforme o campo
+variable), su sigma crece con la distancia recorrida y solo se rasterizan sobre la malla
+cuando alguien la necesita (visualización, exportación). El coste escala con el número de
+emisores y de bocanadas vivas, no con el área de la malla.
+
+Almacenamiento en estructura de arrays (SoA) de capacidad fija con lista libre: emitir
+toma índices de la lista libre y las bocanadas que salen del dominio, se agotan o se fusionan
+devuelven su índice, así que no hay reubicaciones de memoria durante la simulación. Cuando
+hay demasiadas bocanadas vivas, las más antiguas se fusionan por celdas conservando masa,
+centro de masas y segundo momento.
+
+LazyPuffField evalúa el campo solo donde se consulta: receptores sueltos o teselas del mapa
+al zoom visible (con nivel de detalle: las bocanadas menores que un píxel se acumulan con un
+histograma), con una caché de teselas que se invalida al avanzar el paso.
+"""
+
+import math
+import os
+import sys
+import threading
+from collections import OrderedDict
+from typing import Dict, Optional, Sequence
+
+import numpy as np
+import scipy.ndimage
+from scipy.special import erf
+
+module_path = os.path.dirname(__file__)
+if module_path not in sys.path:
+    sys.path.append(module_path)
+try:
+    import cs_module
+except ImportError:
+    cs_module = None
+
+# Coeficiente 'a' de crecimiento horizontal por clase de estabilidad (ver CS.calculate_dispersion_coefficients)
+STABILITY_SIGMA_A = {'A': 0.22, 'B': 0.16, 'C': 0.11, 'D': 0.08, 'E': 0.06, 'F': 0.04}
+
+
+class PuffPool:
+    """
+    Conjunto de bocanadas activas en SoA con reciclado por lista libre.
+
+    Args:
+        species_list: Especies transportadas (una columna de masa por especie)
+        bounds: (x_min, x_max, y_min, y_max) del dominio en metros
+        capacity: Número máximo de bocanadas simultáneas
+        max_puffs: Umbral de bocanadas vivas a partir del cual se fusionan las antiguas
+        merge_age: Edad mínima (s) de una bocanada para poder fusionarse
+        merge_cell: Tamaño (m) de la celda de fusión
+        stability_class: Clase de estabilidad (A-F) para el crecimiento de sigma
+        sigma0: Sigma inicial (m) de una bocanada recién emitida
+        min_mass: Masa total por debajo de la cual una bocanada se descarta
+    """
+
+    def __init__(self, species_list: Sequence[str], bounds, capacity: int = 200000,
+                 max_puffs: int = 50000, merge_age: float = 60.0, merge_cell: float = 25.0,
+                 stability_class: str = 'D', sigma0: float = 2.0, min_mass: float = 1e-12):
+        self.species_list = list(species_list)
+        self.x_min, self.x_max, self.y_min, self.y_max = bounds
+        self.capacity = capacity
+        self.max_puffs = min(max_puffs, capacity)
+        self.merge_age = merge_age
+        self.merge_cell = merge_cell
+        self.sigma_a = STABILITY_SIGMA_A.get(stability_class, 0.10)
+        self.sigma0 = sigma0
+        self.min_mass = min_mass
+
+        self.x = np.zeros(capacity)
+        self.y = np.zeros(capacity)
+        self.sigma = np.zeros(capacity)
+        self.dist = np.zeros(capacity)
+        self.age = np.zeros(capacity)
+        self.mass = np.zeros((capacity, len(self.species_list)))
+        self.active = np.zeros(capacity, dtype=np.uint8)
+        # Lista libre como pila: los índices más bajos se reutilizan antes (mejor localidad)
+        self._free = np.arange(capacity - 1, -1, -1, dtype=np.intp)
+        self._n_free = capacity
+
+    @property
+    def count(self) -> int:
+        """Número de bocanadas activas."""
+        return self.capacity - self._n_free
+
+    def emit(self, xs: np.ndarray, ys: np.ndarray, masses: np.ndarray) -> np.ndarray:
+        """
+        Emite una bocanada por emisor.
+
+        Args:
+            xs, ys: Posiciones [m]
+            masses: Masa emitida por emisor y especie [m, S]
+
+        Returns:
+            Índices asignados (puede haber menos que emisores si el pool está lleno)
+        """
+        m = min(len(xs), self._n_free)
+        if m == 0:
+            return np.zeros(0, dtype=np.intp)
+        idx = self._free[self._n_free - m:self._n_free][::-1].copy()
+        self._n_free -= m
+        self.x[idx] = xs[:m]
+        self.y[idx] = ys[:m]
+        self.sigma[idx] = self.sigma0
+        self.dist[idx] = 0.0
+        self.age[idx] = 0.0
+        self.mass[idx] = masses[:m]
+        self.active[idx] = 1
+        return idx
+
+    def release(self, idx: np.ndarray):
+        """Devuelve bocanadas a la lista libre."""
+        idx = idx[self.active[idx] == 1]
+        self.active[idx] = 0
+        self.mass[idx] = 0.0
+        self._free[self._n_free:self._n_free + len(idx)] = idx
+        self._n_free += len(idx)
+
+    def advect(self, dt: float, wind_speed: float, wind_direction: float,
+               wind_field: Optional[np.ndarray] = None):
+        """Desplaza las bocanadas activas y hace crecer su sigma (núcleo C o NumPy)."""
+        if cs_module is not None and hasattr(cs_module, 'puff_advect'):
+            if wind_field is None:
+                cs_module.puff_advect(self.x, self.y, self.sigma, self.dist, self.age, self.active,
+                                      dt, wind_speed, wind_direction, self.sigma_a, self.sigma0)
+            else:
+                cs_module.puff_advect(self.x, self.y, self.sigma, self.dist, self.age, self.active,
+                                      dt, wind_speed, wind_direction, self.sigma_a, self.sigma0,
+                                      np.ascontiguousarray(wind_field, dtype=np.float64),
+                                      self.x_min, self.x_max, self.y_min, self.y_max)
+            return
+        idx = np.flatnonzero(self.active)
+        if wind_field is None:
+            u = np.full(len(idx), wind_speed * math.cos(wind_direction))
+            v = np.full(len(idx), wind_speed * math.sin(wind_direction))
+        else:
+            ny, nx = wind_field.shape[:2]
+            ci = np.clip((self.y[idx] - self.y_min) * ny / (self.y_max - self.y_min) - 0.5, 0, ny - 1)
+            cj = np.clip((self.x[idx] - self.x_min) * nx / (self.x_max - self.x_min) - 0.5, 0, nx - 1)
+            u = scipy.ndimage.map_coordinates(wind_field[..., 0], [ci, cj], order=1, mode='nearest')
+            v = scipy.ndimage.map_coordinates(wind_field[..., 1], [ci, cj], order=1, mode='nearest')
+        self.x[idx] += u * dt
+        self.y[idx] += v * dt
+        self.dist[idx] += np.hypot(u, v) * dt
+        self.age[idx] += dt
+        d = self.dist[idx]
+        self.sigma[idx] = self.sigma0 + self.sigma_a * d / np.sqrt(1.0 + 0.0001 * d)
+
+    def decay(self, factor: float):
+        """Aplica un decaimiento multiplicativo a la masa de todas las bocanadas."""
+        self.mass *= factor
+
+    def cull(self) -> int:
+        """
+        Libera las bocanadas que han salido del dominio (más de 4 sigma fuera) o cuya masa
+        es despreciable. Devuelve el número de bocanadas liberadas.
+        """
+        idx = np.flatnonzero(self.active)
+        margin = 4.0 * self.sigma[idx]
+        x, y = self.x[idx], self.y[idx]
+        gone = ((x < self.x_min - margin) | (x > self.x_max + margin) |
+                (y < self.y_min - margin) | (y > self.y_max + margin) |
+                (self.mass[idx].sum(axis=1) < self.min_mass))
+        self.release(idx[gone])
+        return int(gone.sum())
+
+    def merge(self) -> int:
+        """
+        Si hay más de max_puffs bocanadas vivas, fusiona por celdas de merge_cell metros las
+        de edad >= merge_age (si no basta, se rebaja la edad mínima a la mitad sucesivamente).
+        La bocanada resultante conserva la masa total, el centro de masas y el segundo
+        momento (sigma² = media ponderada de sigma² + dispersión de centros).
+
+        Returns:
+            Número de bocanadas eliminadas por la fusión
+        """
+        merged = 0
+        min_age = self.merge_age
+        while self.count > self.max_puffs:
+            merged += self._merge_older_than(min_age)
+            if min_age <= 0.0:
+                break
+            min_age = min_age / 2.0 if min_age > 1.0 else 0.0
+        return merged
+
+    def _merge_older_than(self, min_age: float) -> int:
+        idx = np.flatnonzero(self.active)
+        idx = idx[self.age[idx] >= min_age]
+        if len(idx) < 2:
+            return 0
+        w = self.mass[idx].sum(axis=1)
+        cx = np.floor((self.x[idx] - self.x_min) / self.merge_cell).astype(np.int64)
+        cy = np.floor((self.y[idx] - self.y_min) / self.merge_cell).astype(np.int64)
+        _, first, group = np.unique(cy * (1 << 32) + cx, return_index=True, return_inverse=True)
+        n_groups = len(first)
+        if n_groups == len(idx):
+            return 0
+        wsum = np.bincount(group, weights=w, minlength=n_groups)
+        wsafe = np.where(wsum > 0, wsum, 1.0)
+        mx = np.bincount(group, weights=w * self.x[idx], minlength=n_groups) / wsafe
+        my = np.bincount(group, weights=w * self.y[idx], minlength=n_groups) / wsafe
+        second = w * (self.sigma[idx] ** 2 + 0.5 * ((self.x[idx] - mx[group]) ** 2 + (self.y[idx] - my[group]) ** 2))
+        sig = np.sqrt(np.bincount(group, weights=second, minlength=n_groups) / wsafe)
+        mass = np.stack([np.bincount(group, weights=self.mass[idx, s], minlength=n_groups)
+                         for s in range(self.mass.shape[1])], axis=1)
+        dist = np.bincount(group, weights=w * self.dist[idx], minlength=n_groups) / wsafe
+        age = np.bincount(group, weights=w * self.age[idx], minlength=n_groups) / wsafe
+
+        keep = idx[first]
+        self.x[keep], self.y[keep], self.sigma[keep] = mx, my, sig
+        self.mass[keep], self.dist[keep], self.age[keep] = mass, dist, age
+        merged = np.setdiff1d(idx, keep, assume_unique=True)
+        self.release(merged)
+        return len(merged)
+
+    def state(self):
+        """Copias compactas (x, y, sigma, masa) de las bocanadas activas."""
+        idx = np.flatnonzero(self.active)
+        return self.x[idx], self.y[idx], self.sigma[idx], self.mass[idx]
+
+    def rasterize(self, shape) -> Dict[str, np.ndarray]:
+        """
+        Masa de todas las bocanadas activas integrada por celda sobre una malla [ny, nx]
+        para cada especie.
+        """
+        grids = np.zeros((len(self.species_list),) + tuple(shape))
+        rasterize_window(grids, *self.state(), (self.x_min, self.x_max, self.y_min, self.y_max))
+        return {sp: grids[s] for s, sp in enumerate(self.species_list)}
+
+
+def rasterize_window(grids: np.ndarray, x: np.ndarray, y: np.ndarray, sigma: np.ndarray,
+                     mass: np.ndarray, bounds, lod: bool = False):
+    """
+    Suma sobre grids [S, ny, nx] la masa de las bocanadas dadas integrada por celda de la
+    ventana bounds = (x_min, x_max, y_min, y_max). Solo se procesan las bocanadas cuyo
+    soporte (4 sigma) toca la ventana.
+
+    Con lod=True, las bocanadas mucho menores que un píxel (8 sigma por debajo del lado) se
+    depositan enteras en el píxel de su centro con bincount en lugar de integrarse con erf:
+    en zooms alejados casi todas lo son y el coste pasa a ser el de un histograma.
+    """
+    n_species, ny, nx = grids.shape
+    x_min, x_max, y_min, y_max = bounds
+    reach = 4.0 * sigma
+    hit = ((x + reach >= x_min) & (x - reach <= x_max) &
+           (y + reach >= y_min) & (y - reach <= y_max))
+    x, y, sigma, mass = x[hit], y[hit], sigma[hit], mass[hit]
+    if not len(x):
+        return
+    if lod:
+        cw, ch = (x_max - x_min) / nx, (y_max - y_min) / ny
+        small = 8.0 * sigma < min(cw, ch)
+        j = np.floor((x[small] - x_min) / cw).astype(np.intp)
+        i = np.floor((y[small] - y_min) / ch).astype(np.intp)
+        inside = (i >= 0) & (i < ny) & (j >= 0) & (j < nx)
+        flat = (i * nx + j)[inside]
+        for s in range(n_species):
+            grids[s] += np.bincount(flat, weights=mass[small, s][inside], minlength=ny * nx).reshape(ny, nx)
+        big = ~small
+        x, y, sigma, mass = x[big], y[big], sigma[big], mass[big]
+    if not len(x):
+        return
+    if cs_module is not None and hasattr(cs_module, 'puff_rasterize'):
+        cs_module.puff_rasterize(grids, np.ascontiguousarray(x), np.ascontiguousarray(y),
+                                 np.ascontiguousarray(sigma), np.ascontiguousarray(mass),
+                                 np.ones(len(x), dtype=np.uint8), x_min, x_max, y_min, y_max)
+    else:
+        _rasterize_py(grids, x, y, sigma, mass, bounds)
+
+
+def _rasterize_py(grids: np.ndarray, x: np.ndarray, y: np.ndarray, sigma: np.ndarray,
+                  mass: np.ndarray, bounds):
+    """Versión NumPy de cs_module.puff_rasterize (misma integración por celda)."""
+    _, ny, nx = grids.shape
+    x_min, x_max, y_min, y_max = bounds
+    xe = np.linspace(x_min, x_max, nx + 1)
+    ye = np.linspace(y_min, y_max, ny + 1)
+    cw, ch = xe[1] - xe[0], ye[1] - ye[0]
+    for k in range(len(x)):
+        s = max(sigma[k], 1e-9)
+        j0 = max(0, int(math.floor((x[k] - 4 * s - x_min) / cw)))
+        j1 = min(nx - 1, int(math.floor((x[k] + 4 * s - x_min) / cw)))
+        i0 = max(0, int(math.floor((y[k] - 4 * s - y_min) / ch)))
+        i1 = min(ny - 1, int(math.floor((y[k] + 4 * s - y_min) / ch)))
+        if j0 > j1 or i0 > i1:
+            continue
+        inv = 1.0 / (s * math.sqrt(2.0))
+        wx = 0.5 * np.diff(erf((xe[j0:j1 + 2] - x[k]) * inv))
+        wy = 0.5 * np.diff(erf((ye[i0:i1 + 2] - y[k]) * inv))
+        footprint = np.outer(wy, wx)
+        for sp in range(grids.shape[0]):
+            grids[sp, i0:i1 + 1, j0:j1 + 1] += mass[k, sp] * footprint
+
+
+def sample_points(xs: np.ndarray, ys: np.ndarray, x: np.ndarray, y: np.ndarray,
+                  sigma: np.ndarray, mass: np.ndarray, cell_area: float) -> np.ndarray:
+    """
+    Concentración [m, S] de las bocanadas en los puntos (xs, ys): densidad gaussiana por
+    cell_area, en las mismas unidades que una celda rasterizada (núcleo C o NumPy).
+    """
+    xs = np.ascontiguousarray(xs, dtype=np.float64)
+    ys = np.ascontiguousarray(ys, dtype=np.float64)
+    out = np.zeros((len(xs), mass.shape[1]))
+    if not len(xs) or not len(x):
+        return out
+    if cs_module is not None and hasattr(cs_module, 'puff_sample'):
+        cs_module.puff_sample(out, xs, ys, np.ascontiguousarray(x), np.ascontiguousarray(y),
+                              np.ascontiguousarray(sigma), np.ascontiguousarray(mass),
+                              np.ones(len(x), dtype=np.uint8), float(cell_area))
+        return out
+    s2 = np.maximum(sigma, 1e-9) ** 2
+    for p in range(len(xs)):
+        r2 = ((xs[p] - x) ** 2 + (ys[p] - y) ** 2) / s2
+        near = r2 <= 16.0
+        w = cell_area / (2.0 * math.pi * s2[near]) * np.exp(-0.5 * r2[near])
+        out[p] = w @ mass[near]
+    return out
+
+
+class LazyPuffField:
+    """
+    Evaluación bajo demanda del campo de bocanadas: en lugar de rasterizar la malla completa
+    en cada paso, se evalúa solo lo que alguien mira (receptores sueltos o teselas del mapa a
+    un zoom dado). Las teselas se guardan en una caché LRU que se vacía al cambiar de paso.
+
+    Las teselas siguen el esquema slippy map de modules/tile_pyramid.py (z=0 cubre todo el
+    dominio, la fila 0 está arriba) y sus valores se escalan a masa por celda de la malla de
+    simulación, de modo que la escala de colores no depende del zoom.
+
+    tile() y sample() pueden llamarse desde varios hilos (peticiones de la WebApp): leen un
+    estado coherente de las bocanadas y la caché de teselas está protegida por un cerrojo.
+
+    Args:
+        species_list: Especies de las bocanadas
+        bounds: (x_min, x_max, y_min, y_max) del dominio en metros
+        grid_shape: (ny, nx) de la malla de simulación (define el área de celda de referencia)
+        tile_size: Lado de la tesela en píxeles
+        max_tiles: Teselas como máximo en la caché
+    """
+
+    def __init__(self, species_list: Sequence[str], bounds, grid_shape, tile_size: int = 256,
+                 max_tiles: int = 512):
+        self.species_list = list(species_list)
+        self.bounds = tuple(float(b) for b in bounds)
+        self.grid_shape = tuple(int(n) for n in grid_shape)
+        self.tile_size = tile_size
+        self.max_tiles = max_tiles
+        x_min, x_max, y_min, y_max = self.bounds
+        self.cell_area = (x_max - x_min) * (y_max - y_min) / (self.grid_shape[0] * self.grid_shape[1])
+        self.step = None
+        self.x = self.y = self.sigma = np.zeros(0)
+        self.mass = np.zeros((0, len(self.species_list)))
+        self._tiles = OrderedDict()
+        self._lock = threading.Lock()
+        self.hits = 0
+        self.misses = 0
+
+    def update(self, step: int, x: np.ndarray, y: np.ndarray, sigma: np.ndarray, mass: np.ndarray):
+        """Sustituye el estado de las bocanadas; si cambia el paso, invalida las teselas."""
+        with self._lock:
+            if step != self.step:
+                self._tiles.clear()
+            self.step = step
+            self.x, self.y, self.sigma, self.mass = x, y, sigma, mass
+
+    def _state(self):
+        """(paso, x, y, sigma, masa) de una misma llamada a update."""
+        with self._lock:
+            return self.step, self.x, self.y, self.sigma, self.mass
+
+    def update_from_pool(self, pool: PuffPool, step: int):
+        self.update(step, *pool.state())
+
+    @property
+    def max_zoom(self) -> int:
+        """Zoom a partir del cual un píxel de tesela es menor que una celda de la malla."""
+        return max(0, math.ceil(math.log2(max(self.grid_shape) / self.tile_size))) + 2
+
+    def sample(self, xs, ys) -> Dict[str, np.ndarray]:
+        """Concentración de cada especie en los puntos (xs, ys) [m]."""
+        _, x, y, sigma, mass = self._state()
+        values = sample_points(np.atleast_1d(xs), np.atleast_1d(ys), x, y, sigma, mass, self.cell_area)
+        return {sp: values[:, s] for s, sp in enumerate(self.species_list)}
+
+    def tile(self, z: int, tx: int, ty: int) -> Optional[np.ndarray]:
+        """
+        Tesela (z, tx, ty) como float64 [S, tile_size, tile_size], o None si está fuera del
+        dominio. Se rasteriza solo con las bocanadas que la tocan y se cachea hasta el
+        siguiente paso.
+        """
+        n = 1 << z
+        if z < 0 or not (0 <= tx < n and 0 <= ty < n):
+            return None
+        key = (z, tx, ty)
+        with self._lock:
+            cached = self._tiles.get(key)
+            if cached is not None:
+                self._tiles.move_to_end(key)
+                self.hits += 1
+                return cached
+            self.misses += 1
+            step, x, y, sigma, mass = self.step, self.x, self.y, self.sigma, self.mass
+        x_min, x_max, y_min, y_max = self.bounds
+        w, h = (x_max - x_min) / n, (y_max - y_min) / n
+        # La fila 0 de teselas está arriba (y_max)
+        window = (x_min + tx * w, x_min + (tx + 1) * w, y_max - (ty + 1) * h, y_max - ty * h)
+        t = self.tile_size
+        grids = np.zeros((len(self.species_list), t, t))
+        rasterize_window(grids, x, y, sigma, mass, window, lod=True)
+        grids *= self.cell_area / (w * h / (t * t))
+        data = grids[:, ::-1, :]
+        with self._lock:
+            # Si el paso ha cambiado mientras se rasterizaba, la tesela no se cachea
+            if self.step == step:
+                self._tiles[key] = data
+                if len(self._tiles) > self.max_tiles:
+                    self._tiles.popitem(last=False)
+        return data
+
+    def save(self, path: str):
+        """Guarda el estado (paso y bocanadas) de forma atómica para que otro proceso lo lea."""
+        tmp = path + '.tmp'
+        with open(tmp, 'wb') as f:
+            np.savez(f, step=self.step if self.step is not None else -1, bounds=self.bounds,
+                     grid_shape=self.grid_shape, species=np.array(self.species_list),
+                     x=self.x, y=self.y, sigma=self.sigma, mass=self.mass)
+        os.replace(tmp, path)
+
+    @classmethod
+    def load(cls, path: str, **kwargs) -> 'LazyPuffField':
+        with np.load(path) as data:
+            field = cls([str(sp) for sp in data['species']], data['bounds'], data['grid_shape'], **kwargs)
+            field.update(int(data['step']), data['x'], data['y'], data['sigma'], data['mass'])
+        return field
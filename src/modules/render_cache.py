@@ -0,0 +1,214 @@
+"""
+Módulo de Renderizado con Caché para la WebApp
+
+Sustituye a la creación de una figura de matplotlib por petición:
+    - Colorea las mallas con una tabla de consulta (LUT) de 256 colores en NumPy.
+    - Codifica con Pillow (PNG con compresión rápida o WebP).
+    - Guarda las imágenes ya codificadas en una caché LRU indexada por
+      (huella del origen, especie, paso, colormap, formato, ...), de modo que las
+      peticiones repetidas se sirven sin recalcular nada.
+    - Construye la animación de evolución temporal dibujando solo el segmento nuevo
+      de cada curva sobre el fotograma anterior, en lugar de redibujar la gráfica
+      completa en cada paso, y la codifica con una paleta común.
+"""
+
+import hashlib
+import io
+import os
+import threading
+from collections import OrderedDict
+from functools import lru_cache
+from typing import Dict, Hashable, List, Optional, Sequence, Tuple
+
+import numpy as np
+
+
+@lru_cache(maxsize=32)
+def colormap_lut(name: str = 'hot') -> np.ndarray:
+    """LUT RGBA uint8 [256, 4] del colormap de matplotlib indicado."""
+    from matplotlib import colormaps
+    return (colormaps[name](np.linspace(0.0, 1.0, 256)) * 255 + 0.5).astype(np.uint8)
+
+
+def colorize(grid: np.ndarray, cmap: str = 'hot', vmin: Optional[float] = None,
+             vmax: Optional[float] = None, origin_lower: bool = True) -> np.ndarray:
+    """
+    Convierte una malla en una imagen RGBA uint8 mediante la LUT del colormap.
+    Los NaN quedan transparentes. Con origin_lower la fila 0 se pinta abajo (como imshow).
+    """
+    data = grid[::-1] if origin_lower else grid
+    nan_mask = np.isnan(data)
+    if vmin is None:
+        vmin = float(np.nanmin(data)) if data.size else 0.0
+    if vmax is None:
+        vmax = float(np.nanmax(data)) if data.size else 1.0
+    span = vmax - vmin if vmax > vmin else 1.0
+    index = np.clip((np.where(nan_mask, vmin, data) - vmin) * (255.0 / span), 0, 255).astype(np.uint8)
+    rgba = colormap_lut(cmap)[index]
+    if nan_mask.any():
+        rgba[nan_mask, 3] = 0
+    return rgba
+
+
+def encode_image(rgba: np.ndarray, fmt: str = 'png', scale: int = 1) -> bytes:
+    """
+    Codifica una imagen RGBA con Pillow. scale > 1 amplía con vecino más próximo
+    (mallas pequeñas se ven nítidas sin interpolar en el navegador).
+    """
+    from PIL import Image
+    image = Image.fromarray(rgba, 'RGBA')
+    if scale > 1:
+        image = image.resize((image.width * scale, image.height * scale), Image.NEAREST)
+    buf = io.BytesIO()
+    if fmt == 'webp':
+        image.save(buf, format='WEBP', lossless=True, method=0)
+    else:
+        image.save(buf, format='PNG', compress_level=1)
+    return buf.getvalue()
+
+
+def encode_gif(frames: Sequence[np.ndarray], duration: float) -> bytes:
+    """
+    Codifica fotogramas RGB como GIF animado con una paleta común. Como los
+    fotogramas de evolución son acumulativos, el último contiene todos los colores
+    y su paleta sirve para toda la animación (sin cuantizar cada fotograma por separado).
+    """
+    from PIL import Image
+    palette = Image.fromarray(frames[-1]).quantize(colors=64)
+    images = [Image.fromarray(f).quantize(palette=palette, dither=Image.Dither.NONE) for f in frames]
+    buf = io.BytesIO()
+    images[0].save(buf, format='GIF', save_all=True, append_images=images[1:],
+                   duration=max(20, int(1000 * duration / len(frames))), loop=0)
+    return buf.getvalue()
+
+
+def file_fingerprint(path: str) -> str:
+    """Huella barata de un fichero (ruta, tamaño y fecha de modificación)."""
+    st = os.stat(path)
+    return hashlib.sha1(f"{os.path.abspath(path)}:{st.st_size}:{st.st_mtime_ns}".encode()).hexdigest()
+
+
+class RenderCache:
+    """
+    Caché LRU de imágenes codificadas y de mallas ya leídas de CSV.
+
+    Args:
+        max_images: Número máximo de imágenes en caché
+        max_grids: Número máximo de mallas CSV parseadas en caché
+    """
+
+    def __init__(self, max_images: int = 512, max_grids: int = 32):
+        self.max_images = max_images
+        self.max_grids = max_grids
+        self._images: 'OrderedDict[Hashable, Tuple[bytes, dict]]' = OrderedDict()
+        self._grids: 'OrderedDict[str, np.ndarray]' = OrderedDict()
+        self._lock = threading.Lock()
+        self.hits = 0
+        self.misses = 0
+
+    @staticmethod
+    def _get(store: OrderedDict, key):
+        value = store.get(key)
+        if value is not None:
+            store.move_to_end(key)
+        return value
+
+    @staticmethod
+    def _put(store: OrderedDict, key, value, limit: int):
+        store[key] = value
+        store.move_to_end(key)
+        while len(store) > limit:
+            store.popitem(last=False)
+
+    def load_csv(self, path: str) -> np.ndarray:
+        """Lee una malla CSV, reutilizando la versión parseada si el fichero no ha cambiado."""
+        key = file_fingerprint(path)
+        with self._lock:
+            grid = self._get(self._grids, key)
+        if grid is None:
+            grid = np.loadtxt(path, delimiter=',', ndmin=2)
+            grid.flags.writeable = False
+            with self._lock:
+                self._put(self._grids, key, grid, self.max_grids)
+        return grid
+
+    def get_or_build(self, key: Hashable, build_fn):
+        """Devuelve el valor en caché para key o lo construye con build_fn() y lo guarda."""
+        with self._lock:
+            cached = self._get(self._images, key)
+            if cached is not None:
+                self.hits += 1
+                return cached
+            self.misses += 1
+        value = build_fn()
+        with self._lock:
+            self._put(self._images, key, value, self.max_images)
+        return value
+
+    def render(self, key: Hashable, grid_fn, cmap: str = 'hot', fmt: str = 'png', scale: int = 1,
+               vmin: Optional[float] = None, vmax: Optional[float] = None,
+               origin_lower: bool = True) -> Tuple[bytes, dict]:
+        """
+        Devuelve (bytes de la imagen, metadatos con el rango de color) para la clave dada.
+        grid_fn() solo se llama si la imagen no está en caché.
+        """
+        def build():
+            grid = grid_fn()
+            lo = float(np.nanmin(grid)) if vmin is None else vmin
+            hi = float(np.nanmax(grid)) if vmax is None else vmax
+            data = encode_image(colorize(grid, cmap, lo, hi, origin_lower), fmt, scale)
+            return data, {'vmin': lo, 'vmax': hi}
+
+        return self.get_or_build((key, cmap, fmt, scale, vmin, vmax, origin_lower), build)
+
+
+def render_evolution_frames(steps: Sequence[int], series: Dict[str, Sequence[float]],
+                            size: Tuple[int, int] = (700, 400)) -> List[np.ndarray]:
+    """
+    Fotogramas RGB de la evolución temporal de varias especies.
+
+    Los ejes, etiquetas y leyenda se dibujan una sola vez con los límites finales;
+    cada fotograma nuevo solo añade el último segmento de cada curva sobre el
+    anterior (blitting incremental de Agg), por lo que el coste por fotograma es
+    constante en lugar de proporcional a la longitud de la serie.
+    """
+    from matplotlib.figure import Figure
+    from matplotlib.backends.backend_agg import FigureCanvasAgg
+    from matplotlib.lines import Line2D
+
+    dpi = 100
+    fig = Figure(figsize=(size[0] / dpi, size[1] / dpi), dpi=dpi)
+    canvas = FigureCanvasAgg(fig)
+    ax = fig.add_subplot(111)
+    names = list(series)
+    colors = {sp: f"C{i % 10}" for i, sp in enumerate(names)}
+    all_values = np.concatenate([np.asarray(series[sp], dtype=float) for sp in names]) if names else np.zeros(1)
+    if len(steps) > 1:
+        ax.set_xlim(steps[0], steps[-1])
+    lo, hi = float(np.nanmin(all_values)), float(np.nanmax(all_values))
+    pad = (hi - lo) * 0.05 or 1e-12
+    ax.set_ylim(lo - pad, hi + pad)
+    ax.set_xlabel('Paso temporal')
+    ax.set_ylabel('Concentración media')
+    ax.set_title('Evolución temporal de especies')
+    ax.legend(handles=[Line2D([], [], color=colors[sp], label=sp) for sp in names], loc='upper left')
+    fig.tight_layout()
+    canvas.draw()
+
+    segments = {sp: Line2D([], [], color=colors[sp], linewidth=1.5, animated=True) for sp in names}
+    for line in segments.values():
+        ax.add_line(line)
+    frames = []
+    for i in range(len(steps)):
+        for sp in names:
+            values = series[sp]
+            if i < len(values):
+                j = max(0, i - 1)
+                segments[sp].set_data([steps[j], steps[i]], [values[j], values[i]])
+                ax.draw_artist(segments[sp])
+        frames.append(np.asarray(canvas.buffer_rgba())[..., :3].copy())
+    return frames
+
+
+# Instancia compartida por los handlers de la WebApp
+render_cache = RenderCache()
@@ -0,0 +1,219 @@
+"""
+Módulo de Memoria Compartida entre Simulación y WebApp
+
+La simulación se ejecuta en un proceso trabajador y publica en un segmento de
+memoria compartida con nombre las mallas de todas las especies, sus estadísticas
+y el paso actual. La WebApp lee instantáneas consistentes sin copiar datos y sin
+bloquear a la simulación gracias a un seqlock:
+
+    - El escritor incrementa el contador de secuencia (queda impar), escribe y
+      lo vuelve a incrementar (queda par).
+    - El lector toma el contador, trabaja sobre las vistas NumPy del segmento y
+      comprueba al final que el contador es par y no ha cambiado; si no, reintenta.
+
+Disposición del segmento (little-endian, alineado a 8 bytes):
+    cabecera   64 bytes (ver HEADER_FORMAT)
+    nombres    n_species * NAME_SIZE bytes ASCII
+    stats      float64 [n_species, N_STATS]  (media, máximo, total)
+    mallas     float64 [n_species, ny, nx]
+"""
+
+import os
+import struct
+import time
+from itertools import count
+from multiprocessing import shared_memory
+from typing import Callable, Dict, List, Optional, Tuple
+
+import numpy as np
+
+MAGIC = 0x43534731  # 'CSG1'
+HEADER_FORMAT = '<IIQqIIIII'  # magic, versión, seq, paso, ny, nx, n_especies, n_stats, estado
+HEADER_SIZE = 64
+NAME_SIZE = 16
+STATS_FIELDS = ('mean', 'max', 'total')
+N_STATS = len(STATS_FIELDS)
+
+STATUS_STARTING = 0
+STATUS_RUNNING = 1
+STATUS_FINISHED = 2
+STATUS_FAILED = 3
+STATUS_NAMES = {STATUS_STARTING: 'starting', STATUS_RUNNING: 'running',
+                STATUS_FINISHED: 'finished', STATUS_FAILED: 'failed'}
+
+_SEQ_OFFSET = 8
+_STEP_OFFSET = 16
+_STATUS_OFFSET = 40
+
+_name_counter = count()
+
+
+def segment_size(n_species: int, ny: int, nx: int) -> int:
+    """Tamaño en bytes del segmento para n_species mallas de ny x nx."""
+    names = -(-n_species * NAME_SIZE // 8) * 8
+    return HEADER_SIZE + names + 8 * n_species * N_STATS + 8 * n_species * ny * nx
+
+
+def new_segment_name() -> str:
+    """Nombre único para un segmento nuevo (proceso + contador)."""
+    return f"cs_sim_{os.getpid()}_{next(_name_counter)}"
+
+
+class _SharedGridBase:
+    """Vistas NumPy sobre un segmento ya creado."""
+
+    def __init__(self, shm: shared_memory.SharedMemory):
+        self.shm = shm
+        self.name = shm.name
+        buf = shm.buf
+        magic, _, _, _, ny, nx, n_species, n_stats, _ = struct.unpack_from(HEADER_FORMAT, buf)
+        if magic != MAGIC or n_stats != N_STATS:
+            raise ValueError(f"El segmento {shm.name} no es una malla compartida válida")
+        self.ny, self.nx, self.n_species = ny, nx, n_species
+        names_size = -(-n_species * NAME_SIZE // 8) * 8
+        raw = bytes(buf[HEADER_SIZE:HEADER_SIZE + n_species * NAME_SIZE])
+        self.species_list = [raw[i * NAME_SIZE:(i + 1) * NAME_SIZE].rstrip(b'\0').decode('ascii')
+                             for i in range(n_species)]
+        self.index = {sp: i for i, sp in enumerate(self.species_list)}
+        offset = HEADER_SIZE + names_size
+        self._header = np.ndarray((HEADER_SIZE // 8,), dtype='<u8', buffer=buf)
+        self.stats = np.ndarray((n_species, N_STATS), dtype='<f8', buffer=buf, offset=offset)
+        offset += 8 * n_species * N_STATS
+        self.grids = np.ndarray((n_species, ny, nx), dtype='<f8', buffer=buf, offset=offset)
+
+    @property
+    def seq(self) -> int:
+        return int(self._header[_SEQ_OFFSET // 8])
+
+    @property
+    def step(self) -> int:
+        return struct.unpack_from('<q', self.shm.buf, _STEP_OFFSET)[0]
+
+    @property
+    def status(self) -> int:
+        return struct.unpack_from('<I', self.shm.buf, _STATUS_OFFSET)[0]
+
+    def close(self):
+        # Liberar las vistas antes de cerrar el mmap subyacente
+        self._header = self.stats = self.grids = None
+        self.shm.close()
+
+
+class SharedGridWriter(_SharedGridBase):
+    """
+    Lado de la simulación: crea (o se adjunta a) el segmento y publica cada paso.
+    """
+
+    @classmethod
+    def create(cls, species_list: List[str], shape: Tuple[int, int], name: Optional[str] = None):
+        """
+        Crea e inicializa un segmento nuevo. Quien lo crea es responsable de unlink().
+        """
+        ny, nx = shape
+        n = len(species_list)
+        shm = shared_memory.SharedMemory(name=name or new_segment_name(), create=True,
+                                         size=segment_size(n, ny, nx))
+        shm.buf[:HEADER_SIZE] = b'\0' * HEADER_SIZE
+        struct.pack_into(HEADER_FORMAT, shm.buf, 0, MAGIC, 1, 0, -1, ny, nx, n, N_STATS, STATUS_STARTING)
+        for i, sp in enumerate(species_list):
+            encoded = sp.encode('ascii')[:NAME_SIZE]
+            start = HEADER_SIZE + i * NAME_SIZE
+            shm.buf[start:start + NAME_SIZE] = encoded.ljust(NAME_SIZE, b'\0')
+        return cls(shm)
+
+    @classmethod
+    def attach(cls, name: str):
+        """Se adjunta a un segmento creado por otro proceso (p. ej. la WebApp)."""
+        return cls(_attach(name))
+
+    def publish(self, step: int, grids: Dict[str, np.ndarray]):
+        """
+        Copia las mallas y sus estadísticas al segmento bajo el seqlock.
+        Las especies que no existan en el segmento se ignoran.
+        """
+        seq = self.seq
+        self._header[_SEQ_OFFSET // 8] = seq + 1  # impar: escritura en curso
+        for sp, grid in grids.items():
+            i = self.index.get(sp)
+            if i is None or grid.shape != (self.ny, self.nx):
+                continue
+            self.grids[i] = grid
+            self.stats[i, 0] = grid.mean()
+            self.stats[i, 1] = grid.max()
+            self.stats[i, 2] = grid.sum()
+        struct.pack_into('<q', self.shm.buf, _STEP_OFFSET, step)
+        struct.pack_into('<I', self.shm.buf, _STATUS_OFFSET, STATUS_RUNNING)
+        self._header[_SEQ_OFFSET // 8] = seq + 2  # par: instantánea consistente
+
+    def set_status(self, status: int):
+        struct.pack_into('<I', self.shm.buf, _STATUS_OFFSET, status)
+
+    def abandon(self, status: int = STATUS_FAILED):
+        """
+        Cierra el seqlock de un escritor que ya no existe (p. ej. un proceso terminado a mitad
+        de publish, que deja seq impar y haría fallar todas las lecturas con TimeoutError).
+        Fija el estado y deja seq par; la última instantánea puede estar incompleta, lo que
+        indica el estado.
+        """
+        seq = self.seq
+        if not seq & 1:
+            seq += 1
+            self._header[_SEQ_OFFSET // 8] = seq
+        self.set_status(status)
+        self._header[_SEQ_OFFSET // 8] = seq + 1
+
+
+class SharedGridReader(_SharedGridBase):
+    """
+    Lado de la WebApp: lecturas consistentes sin bloquear al escritor.
+    """
+
+    @classmethod
+    def attach(cls, name: str):
+        return cls(_attach(name))
+
+    def read(self, fn: Callable[['SharedGridReader'], object], retries: int = 100):
+        """
+        Ejecuta fn(self) sobre las vistas del segmento (sin copias) y devuelve su
+        resultado solo si ninguna escritura se ha solapado con la lectura.
+
+        fn no debe conservar referencias a las vistas: debe devolver datos derivados
+        (estadísticas, una malla cuantizada, una copia...).
+        """
+        for _ in range(retries):
+            before = self.seq
+            if before & 1:
+                time.sleep(0)
+                continue
+            result = fn(self)
+            if self.seq == before:
+                return result
+        raise TimeoutError(f"No se pudo obtener una instantánea consistente de {self.name}")
+
+    def snapshot(self, species: Optional[str] = None) -> Tuple[int, Dict[str, np.ndarray]]:
+        """Copia consistente de (paso, {especie: malla}) para una o todas las especies."""
+        names = [species] if species is not None else self.species_list
+
+        def copy(r):
+            return r.step, {sp: r.grids[r.index[sp]].copy() for sp in names}
+        return self.read(copy)
+
+    def stats_snapshot(self) -> Dict[str, object]:
+        """Paso, estado y estadísticas por especie en un diccionario serializable."""
+        def collect(r):
+            return {
+                'step': r.step,
+                'status': STATUS_NAMES.get(r.status, 'unknown'),
+                'species': {sp: dict(zip(STATS_FIELDS, map(float, r.stats[i])))
+                            for sp, i in r.index.items()},
+            }
+        return self.read(collect)
+
+
+def _attach(name: str) -> shared_memory.SharedMemory:
+    try:
+        # Python >= 3.13: no registrar el segmento en el resource_tracker del
+        # proceso que solo se adjunta (lo elimina quien lo creó)
+        return shared_memory.SharedMemory(name=name, track=False)
+    except TypeError:
+        return shared_memory.SharedMemory(name=name)
@@ -0,0 +1,261 @@
+"""
+Módulo de Cañones Urbanos (street canyons) a partir de la geometría de SUMO
+
+Preprocesa la red (osm.net.xml[.gz]) y las huellas de edificios (osm.poly.xml[.gz]), leídas
+con modules/sumo_geometry.py (streaming y caché binaria), en un índice compacto de cañones por tramo recto de calle:
+    - Anchura entre fachadas y altura media de los edificios a cada lado (relación H/W)
+    - Orientación del eje de la calle
+    - Mapa celda -> cañón sobre la malla de simulación
+
+Con ese índice, la concentración en receptores dentro de un cañón se evalúa con un modelo
+OSPM simplificado (núcleo C canyon_concentration, con versión NumPy equivalente): pluma
+directa de la calle más recirculación del vórtice según el lado del receptor respecto al
+viento. Así se obtiene la exposición a pie de calle sin resolver el flujo en 3D.
+"""
+
+import math
+import os
+import sys
+import xml.etree.ElementTree as ET
+from typing import Optional, Sequence
+
+import numpy as np
+from scipy.spatial import cKDTree
+
+from modules.sumo_geometry import (BuildingFootprints, NetworkGeometry, load_buildings, load_network,
+                                   parse_buildings, parse_network)
+
+module_path = os.path.dirname(__file__)
+if module_path not in sys.path:
+    sys.path.append(module_path)
+try:
+    import cs_module
+except ImportError:
+    cs_module = None
+
+
+def ospm_factor(width, height, orientation, offset, wind_speed: float, wind_direction: float,
+                sigma_wt: float = 0.25) -> np.ndarray:
+    """Versión NumPy de ospm_factor en cs_module.c (concentración = factor * q)."""
+    h0, z0, alpha, lam = 2.0, 0.6, 0.1, 0.1
+    ut = max(wind_speed, 0.5)
+    us = np.maximum(ut * math.log(h0 / z0) / np.log(np.maximum(height, h0 + 0.1) / z0), 0.2)
+    sw = np.sqrt((alpha * us) ** 2 + sigma_wt ** 2)
+    sv = math.sqrt((lam * ut) ** 2 + sigma_wt ** 2)
+    norm = math.sqrt(2.0 / math.pi) / (width * sw)
+
+    cross = math.cos(wind_direction) * -np.sin(orientation) + math.sin(wind_direction) * np.cos(orientation)
+    s = np.abs(cross)
+    lr = np.minimum(width, 2.0 * height)
+    lt = np.where(lr > 2e-3, 0.5 * lr, 1e-3)
+    recirc = lr / (width * sv * lt)
+    direct_lee = norm * np.log((h0 + sw * lr / us) / h0)
+    direct_wind = np.where(width > lr, norm * np.log((h0 + sw * np.maximum(width - lr, 0.0) / us) / h0), 0.0)
+    perp = np.where(offset * cross < 0.0, direct_lee + recirc, direct_wind + recirc)
+    parallel = norm * np.log((h0 + sw * width / us) / h0)
+    return s * perp + (1.0 - s) * parallel
+
+
+class CanyonIndex:
+    """
+    Índice de cañones por tramo de calle y mapa celda -> cañón sobre la malla.
+
+    Atributos por tramo: x0, y0, x1, y1, width (entre fachadas), height (media de ambos
+    lados), orientation, length, edge y canyon (True si hay edificios a ambos lados y
+    H/W >= min_aspect). cell_canyon [ny, nx] guarda el tramo de cañón de cada celda (-1 si
+    ninguno).
+    """
+
+    FIELDS = ('x0', 'y0', 'x1', 'y1', 'width', 'height', 'orientation', 'length', 'edge', 'canyon')
+
+    def __init__(self, bounds, grid_shape, edge_ids: Sequence[str], **arrays):
+        self.bounds = tuple(float(b) for b in bounds)
+        self.grid_shape = tuple(int(n) for n in grid_shape)
+        self.edge_ids = list(edge_ids)
+        for name in self.FIELDS + ('cell_canyon',):
+            setattr(self, name, arrays[name])
+
+    @property
+    def n_canyons(self) -> int:
+        return int(np.count_nonzero(self.canyon))
+
+    @classmethod
+    def build(cls, net: NetworkGeometry, buildings: BuildingFootprints, bounds, grid_shape,
+              max_half_width: float = 40.0, min_aspect: float = 0.3) -> 'CanyonIndex':
+        """
+        Calcula la sección de cada tramo lanzando desde su punto medio un rayo perpendicular
+        a cada lado hasta la primera fachada (a menos de max_half_width metros), y rasteriza
+        los cañones sobre la malla.
+        """
+        dx, dy = net.x1 - net.x0, net.y1 - net.y0
+        length = np.hypot(dx, dy)
+        orientation = np.arctan2(dy, dx)
+        n = len(length)
+        mx, my = 0.5 * (net.x0 + net.x1), 0.5 * (net.y0 + net.y1)
+        nxv, nyv = -np.sin(orientation), np.cos(orientation)  # Normal izquierda
+
+        dist = np.full((2, n), np.inf)
+        hgt = np.zeros((2, n))
+        if buildings.count and n:
+            bx0, by0, bx1, by1, bpoly = buildings.edges()
+            ex, ey = bx1 - bx0, by1 - by0
+            tree = cKDTree(np.column_stack([0.5 * (bx0 + bx1), 0.5 * (by0 + by1)]))
+            radius = max_half_width + 0.5 * float(np.hypot(ex, ey).max())
+            for k, near in enumerate(tree.query_ball_point(np.column_stack([mx, my]), radius)):
+                if not near:
+                    continue
+                near = np.asarray(near)
+                ax, ay = bx0[near] - mx[k], by0[near] - my[k]
+                for side, sign in enumerate((1.0, -1.0)):
+                    rx, ry = sign * nxv[k], sign * nyv[k]
+                    den = rx * ey[near] - ry * ex[near]
+                    with np.errstate(divide='ignore', invalid='ignore'):
+                        t = (ax * ey[near] - ay * ex[near]) / den
+                        u = (ax * ry - ay * rx) / den
+                    ok = (np.abs(den) > 1e-12) & (t > 0.0) & (t <= max_half_width) & (u >= 0.0) & (u <= 1.0)
+                    if ok.any():
+                        j = np.argmin(np.where(ok, t, np.inf))
+                        dist[side, k] = t[j]
+                        hgt[side, k] = buildings.height[bpoly[near[j]]]
+
+        both = np.isfinite(dist).all(axis=0)
+        width = np.where(both, dist.sum(axis=0), 2.0 * max_half_width)
+        width = np.maximum(width, net.edge_width[net.edge] if n else width)
+        height = np.where(both, hgt.mean(axis=0), 0.0)
+        canyon = both & (height / width >= min_aspect)
+        arrays = dict(x0=net.x0, y0=net.y0, x1=net.x1, y1=net.y1, width=width, height=height,
+                      orientation=orientation, length=length, edge=net.edge, canyon=canyon)
+        arrays['cell_canyon'] = cls._rasterize(arrays, bounds, grid_shape)
+        return cls(bounds, grid_shape, net.edge_ids, **arrays)
+
+    @staticmethod
+    def _rasterize(a, bounds, grid_shape) -> np.ndarray:
+        """Asigna a cada celda el tramo de cañón más cercano cuyo eje está a menos de W/2."""
+        ny, nx = grid_shape
+        x_min, x_max, y_min, y_max = bounds
+        cw, ch = (x_max - x_min) / nx, (y_max - y_min) / ny
+        cell = np.full((ny, nx), -1, dtype=np.int32)
+        best = np.full((ny, nx), np.inf)
+        for k in np.flatnonzero(a['canyon']):
+            half = 0.5 * a['width'][k]
+            j0 = max(0, int((min(a['x0'][k], a['x1'][k]) - half - x_min) // cw))
+            j1 = min(nx - 1, int((max(a['x0'][k], a['x1'][k]) + half - x_min) // cw))
+            i0 = max(0, int((min(a['y0'][k], a['y1'][k]) - half - y_min) // ch))
+            i1 = min(ny - 1, int((max(a['y0'][k], a['y1'][k]) + half - y_min) // ch))
+            if j0 > j1 or i0 > i1:
+                continue
+            px = x_min + (np.arange(j0, j1 + 1) + 0.5) * cw
+            py = y_min + (np.arange(i0, i1 + 1) + 0.5) * ch
+            d = _segment_distance(px[None, :], py[:, None], a['x0'][k], a['y0'][k], a['x1'][k], a['y1'][k])
+            window = best[i0:i1 + 1, j0:j1 + 1]
+            closer = (d <= half) & (d < window)
+            window[closer] = d[closer]
+            cell[i0:i1 + 1, j0:j1 + 1][closer] = k
+        return cell
+
+    def locate(self, xs, ys):
+        """
+        Tramo de cañón (-1 si ninguno) y distancia con signo al eje (> 0 a la izquierda) de
+        cada punto.
+        """
+        xs, ys = np.atleast_1d(np.asarray(xs, dtype=np.float64)), np.atleast_1d(np.asarray(ys, dtype=np.float64))
+        ny, nx = self.grid_shape
+        x_min, x_max, y_min, y_max = self.bounds
+        j = ((xs - x_min) / (x_max - x_min) * nx).astype(np.intp)
+        i = ((ys - y_min) / (y_max - y_min) * ny).astype(np.intp)
+        inside = (i >= 0) & (i < ny) & (j >= 0) & (j < nx)
+        seg = np.full(len(xs), -1, dtype=np.int32)
+        seg[inside] = self.cell_canyon[i[inside], j[inside]]
+        if not len(self.length):
+            return seg, np.zeros(len(xs))
+        k = np.maximum(seg, 0)
+        offset = ((xs - self.x0[k]) * -np.sin(self.orientation[k]) +
+                  (ys - self.y0[k]) * np.cos(self.orientation[k]))
+        return seg, np.where(seg >= 0, offset, 0.0)
+
+    def line_sources(self, xs, ys, rates: np.ndarray) -> np.ndarray:
+        """
+        Emisión lineal q [tramos, S] (masa / m / s) de cada tramo a partir de emisores
+        puntuales (posiciones y tasas [m, S]); los emisores fuera de cañones no cuentan.
+        """
+        seg, _ = self.locate(xs, ys)
+        inside = seg >= 0
+        n = len(self.length)
+        q = np.zeros((n, rates.shape[1]))
+        for s in range(rates.shape[1]):
+            q[:, s] = np.bincount(seg[inside], weights=rates[inside, s], minlength=n)
+        return q / np.maximum(self.length, 1.0)[:, None]
+
+    def concentration(self, xs, ys, q: np.ndarray, wind_speed: float, wind_direction: float,
+                      sigma_wt: float = 0.25) -> np.ndarray:
+        """
+        Concentración de calle [m, S] en los receptores (0 fuera de cañones), con el núcleo
+        C si está disponible.
+        """
+        seg, offset = self.locate(xs, ys)
+        q = np.ascontiguousarray(q, dtype=np.float64)
+        out = np.zeros((len(seg), q.shape[1]))
+        if cs_module is not None and hasattr(cs_module, 'canyon_concentration'):
+            cs_module.canyon_concentration(out, seg, np.ascontiguousarray(offset),
+                                           np.ascontiguousarray(self.width, dtype=np.float64),
+                                           np.ascontiguousarray(self.height, dtype=np.float64),
+                                           np.ascontiguousarray(self.orientation, dtype=np.float64),
+                                           q, float(wind_speed), float(wind_direction), float(sigma_wt))
+            return out
+        inside = seg >= 0
+        k = seg[inside]
+        f = ospm_factor(self.width[k], self.height[k], self.orientation[k], offset[inside],
+                        wind_speed, wind_direction, sigma_wt)
+        out[inside] = f[:, None] * q[k]
+        return out
+
+    def save(self, path: str):
+        with open(path, 'wb') as f:
+            np.savez(f, bounds=self.bounds, grid_shape=self.grid_shape, edge_ids=np.array(self.edge_ids),
+                     **{name: getattr(self, name) for name in self.FIELDS + ('cell_canyon',)})
+
+    @classmethod
+    def load(cls, path: str) -> 'CanyonIndex':
+        with np.load(path) as data:
+            arrays = {name: data[name] for name in cls.FIELDS + ('cell_canyon',)}
+            return cls(data['bounds'], data['grid_shape'], [str(e) for e in data['edge_ids']], **arrays)
+
+
+def _segment_distance(px, py, x0, y0, x1, y1):
+    """Distancia de los puntos (px, py) al segmento (x0, y0)-(x1, y1)."""
+    dx, dy = x1 - x0, y1 - y0
+    l2 = dx * dx + dy * dy
+    t = np.clip(((px - x0) * dx + (py - y0) * dy) / l2, 0.0, 1.0) if l2 > 0 else 0.0
+    return np.hypot(px - (x0 + t * dx), py - (y0 + t * dy))
+
+
+def sumo_inputs(sumo_config: str):
+    """Rutas de la red y del primer fichero de polígonos referenciados por un .sumocfg."""
+    if not sumo_config or not os.path.exists(sumo_config):
+        return None, None
+    base = os.path.dirname(os.path.abspath(sumo_config))
+    root = ET.parse(sumo_config).getroot()
+    net = root.find('.//net-file')
+    additional = root.find('.//additional-files')
+    net_file = os.path.join(base, net.get('value')) if net is not None else None
+    poly_file = None
+    if additional is not None:
+        for name in additional.get('value', '').replace(',', ' ').split():
+            if 'poly' in os.path.basename(name):
+                poly_file = os.path.join(base, name)
+                break
+    return net_file, poly_file
+
+
+def build_canyon_index(net_file: str, poly_file: Optional[str], bounds, grid_shape,
+                       cache_dir: Optional[str] = None, **kwargs) -> Optional[CanyonIndex]:
+    """
+    Construye el índice a partir de los ficheros de SUMO (None si falta alguno). La caché de
+    geometría se guarda por defecto junto a la red, así que la comparten todos los trabajos.
+    """
+    if not net_file or not os.path.exists(net_file) or not poly_file or not os.path.exists(poly_file):
+        return None
+    if cache_dir is None:
+        cache_dir = os.path.join(os.path.dirname(os.path.abspath(net_file)), '.geometry_cache')
+    return CanyonIndex.build(load_network(net_file, cache_dir), load_buildings(poly_file, cache_dir),
+                             bounds, grid_shape, **kwargs)
@@ -0,0 +1,291 @@
+"""
+Módulo de Geometría de SUMO: lectura en streaming y caché binaria
+
+Lee la red (net.xml[.gz]) y los polígonos de edificios (poly.xml[.gz]) con el analizador
+SAX de expat (en C, por bloques y sin construir el árbol DOM), de modo que la memoria no
+crece con el tamaño del fichero más allá de los arrays resultantes. Todas las formas se
+guardan en formato plano: coordenadas concatenadas float64 [N, 2] y desplazamientos int64
+[P + 1] por polilínea o polígono.
+
+Los arrays se guardan en una caché binaria (un .npy por array) cuya clave es el hash del
+contenido del fichero (y los parámetros de lectura); los arranques posteriores la abren con
+memmap en milisegundos:
+    <caché>/<tipo>-<hash>-<params>/meta.json     tipo y versión del formato
+    <caché>/<tipo>-<hash>-<params>/<array>.npy   un fichero por array
+"""
+
+import gzip
+import hashlib
+import json
+import os
+import shutil
+import xml.parsers.expat
+from dataclasses import dataclass
+from typing import List
+
+import numpy as np
+
+DEFAULT_LANE_WIDTH = 3.2        # m (valor por defecto de SUMO)
+DEFAULT_BUILDING_HEIGHT = 15.0  # m
+LEVEL_HEIGHT = 3.0              # m por planta (building:levels)
+CACHE_VERSION = 1
+READ_BLOCK = 1 << 20
+
+
+def _open_xml(path: str):
+    """Abre un XML de SUMO, comprimido o no."""
+    return gzip.open(path, 'rb') if path.endswith('.gz') else open(path, 'rb')
+
+
+def _parse_shapes(shapes: List[str]):
+    """
+    Convierte una lista de formas 'x1,y1 x2,y2 ...' en coordenadas planas [N, 2] y
+    desplazamientos [P + 1], con una sola conversión de texto a float para todas.
+    """
+    counts = np.array([len(s.split()) for s in shapes], dtype=np.int64)
+    offsets = np.zeros(len(shapes) + 1, dtype=np.int64)
+    np.cumsum(counts, out=offsets[1:])
+    if not shapes:
+        return np.zeros((0, 2)), offsets
+    values = np.array(' '.join(shapes).replace(',', ' ').split(), dtype=np.float64)
+    if len(values) != 2 * offsets[-1]:
+        # Formas con z (x,y,z): se descarta la tercera coordenada punto a punto
+        values = np.array([v for s in shapes for pt in s.split() for v in pt.split(',')[:2]], dtype=np.float64)
+    return values.reshape(-1, 2), offsets
+
+
+def _run_parser(path: str, start, end=None):
+    parser = xml.parsers.expat.ParserCreate()
+    parser.buffer_text = True
+    parser.StartElementHandler = start
+    if end is not None:
+        parser.EndElementHandler = end
+    with _open_xml(path) as f:
+        while True:
+            block = f.read(READ_BLOCK)
+            parser.Parse(block, not block)
+            if not block:
+                break
+
+
+@dataclass
+class NetworkGeometry:
+    """
+    Calles de la red como polilíneas (una por calle) y sus tramos rectos, más las formas de
+    los carriles.
+    """
+    edge_ids: List[str]
+    edge_coords: np.ndarray   # float64 [N, 2]
+    edge_offsets: np.ndarray  # int64 [E + 1]
+    edge_width: np.ndarray    # Anchura de la calzada de cada calle (m)
+    lane_coords: np.ndarray   # float64 [M, 2]
+    lane_offsets: np.ndarray  # int64 [L + 1]
+    lane_edge: np.ndarray     # Calle de cada carril (int32 [L])
+    lane_width: np.ndarray    # float64 [L]
+
+    def __post_init__(self):
+        # Tramos rectos: pares de puntos consecutivos dentro de cada polilínea
+        n = len(self.edge_coords)
+        starts = np.ones(n, dtype=bool)
+        starts[self.edge_offsets[1:] - 1] = False
+        a = np.flatnonzero(starts)
+        self.x0, self.y0 = self.edge_coords[a, 0], self.edge_coords[a, 1]
+        self.x1, self.y1 = self.edge_coords[a + 1, 0], self.edge_coords[a + 1, 1]
+        self.edge = (np.searchsorted(self.edge_offsets, a, side='right') - 1).astype(np.int32)
+
+    ARRAYS = ('edge_coords', 'edge_offsets', 'edge_width', 'lane_coords', 'lane_offsets', 'lane_edge', 'lane_width')
+
+
+@dataclass
+class BuildingFootprints:
+    """Polígonos de edificios en formato plano (coordenadas concatenadas + desplazamientos)."""
+    coords: np.ndarray   # float64 [N, 2]
+    offsets: np.ndarray  # int64 [P + 1]
+    height: np.ndarray   # float64 [P]
+
+    ARRAYS = ('coords', 'offsets', 'height')
+
+    @property
+    def count(self) -> int:
+        return len(self.height)
+
+    def edges(self):
+        """Lados de todos los polígonos (cerrados): x0, y0, x1, y1 y el índice del polígono."""
+        starts, ends = self.offsets[:-1], self.offsets[1:]
+        poly = np.repeat(np.arange(self.count), ends - starts)
+        a = np.arange(len(self.coords))
+        # Siguiente vértice dentro del polígono (el último enlaza con el primero)
+        b = a + 1
+        b[ends - 1] = starts
+        return (self.coords[a, 0], self.coords[a, 1], self.coords[b, 0], self.coords[b, 1], poly)
+
+
+def parse_network(path: str, lane_width: float = DEFAULT_LANE_WIDTH) -> NetworkGeometry:
+    """
+    Lee en streaming las calles de una red SUMO. La forma de cada calle es la suya, la de su
+    primer carril o, si no hay ninguna, la recta entre los nodos de origen y destino. Las
+    calles internas de los cruces se omiten.
+    """
+    nodes = {}
+    edges = []      # [id, from, to, forma o None, anchura acumulada]
+    lanes = []      # (calle, forma, anchura)
+    current = None
+
+    def start(name, attrs):
+        nonlocal current
+        if name == 'lane':
+            if current is not None:
+                width = float(attrs.get('width', lane_width))
+                current[4] += width
+                shape = attrs.get('shape')
+                if shape:
+                    if current[3] is None:
+                        current[3] = shape
+                    lanes.append((len(edges) - 1, shape, width))
+        elif name == 'edge':
+            if attrs.get('function') == 'internal':
+                current = None
+            else:
+                current = [attrs.get('id'), attrs.get('from'), attrs.get('to'), attrs.get('shape'), 0.0]
+                edges.append(current)
+        elif name in ('junction', 'node'):
+            if 'x' in attrs:
+                nodes[attrs.get('id')] = f"{attrs['x']},{attrs['y']}"
+
+    def end(name):
+        nonlocal current
+        if name == 'edge':
+            current = None
+
+    _run_parser(path, start, end)
+
+    keep, shapes = [], []
+    for k, (edge_id, src, dst, shape, _) in enumerate(edges):
+        if shape is None and src in nodes and dst in nodes:
+            shape = f"{nodes[src]} {nodes[dst]}"
+        if shape is not None and len(shape.split()) >= 2:
+            keep.append(k)
+            shapes.append(shape)
+    remap = np.full(len(edges) + 1, -1, dtype=np.int32)
+    remap[keep] = np.arange(len(keep), dtype=np.int32)
+    edge_coords, edge_offsets = _parse_shapes(shapes)
+    lanes = [lane for lane in lanes if remap[lane[0]] >= 0]
+    lane_coords, lane_offsets = _parse_shapes([lane[1] for lane in lanes])
+    return NetworkGeometry([edges[k][0] for k in keep], edge_coords, edge_offsets,
+                           np.array([edges[k][4] or lane_width for k in keep], dtype=np.float64),
+                           lane_coords, lane_offsets,
+                           remap[np.array([lane[0] for lane in lanes], dtype=np.intp)].astype(np.int32),
+                           np.array([lane[2] for lane in lanes], dtype=np.float64))
+
+
+def parse_buildings(path: str, default_height: float = DEFAULT_BUILDING_HEIGHT) -> BuildingFootprints:
+    """
+    Lee en streaming los polígonos de tipo edificio (type que empieza por 'building') de un
+    fichero de polígonos SUMO. La altura sale de los parámetros 'height' o 'building:levels'
+    si existen.
+    """
+    shapes, heights = [], []
+    explicit = set()  # Polígonos con 'height' (tiene prioridad sobre 'building:levels')
+    current = None
+
+    def start(name, attrs):
+        nonlocal current
+        if name == 'poly':
+            current = None
+            if attrs.get('type', '').startswith('building') and attrs.get('shape'):
+                shapes.append(attrs['shape'])
+                heights.append(default_height)
+                current = len(heights) - 1
+        elif name == 'param' and current is not None:
+            key = attrs.get('key')
+            try:
+                if key == 'height':
+                    heights[current] = float(attrs.get('value', '').split()[0])
+                    explicit.add(current)
+                elif key == 'building:levels' and current not in explicit:
+                    heights[current] = LEVEL_HEIGHT * float(attrs.get('value'))
+            except (ValueError, IndexError):
+                pass
+
+    _run_parser(path, start)
+
+    coords, offsets = _parse_shapes(shapes)
+    # Se elimina el vértice de cierre repetido y se descartan los polígonos degenerados
+    ends = offsets[1:] - 1
+    closed = np.zeros(len(heights), dtype=bool)
+    sizes = np.diff(offsets)
+    valid = sizes > 1
+    closed[valid] = np.all(np.isclose(coords[offsets[:-1][valid]], coords[ends[valid]]), axis=1)
+    drop = np.zeros(len(coords), dtype=bool)
+    drop[ends[closed]] = True
+    sizes = sizes - closed
+    keep_poly = sizes >= 3
+    drop |= np.repeat(~keep_poly, np.diff(offsets))
+    new_offsets = np.zeros(int(keep_poly.sum()) + 1, dtype=np.int64)
+    np.cumsum(sizes[keep_poly], out=new_offsets[1:])
+    return BuildingFootprints(coords[~drop], new_offsets, np.array(heights, dtype=np.float64)[keep_poly])
+
+
+def file_hash(path: str) -> str:
+    """Hash del contenido del fichero (BLAKE2b de 128 bits, leído por bloques)."""
+    h = hashlib.blake2b(digest_size=16)
+    with open(path, 'rb') as f:
+        for block in iter(lambda: f.read(READ_BLOCK), b''):
+            h.update(block)
+    return h.hexdigest()
+
+
+def _cache_path(cache_dir: str, path: str, kind: str, params: str) -> str:
+    return os.path.join(cache_dir, f"{kind}-{file_hash(path)}-{hashlib.md5(params.encode()).hexdigest()[:8]}")
+
+
+def _save(entry: str, kind: str, obj, ids=None):
+    tmp = entry + '.tmp'
+    shutil.rmtree(tmp, ignore_errors=True)
+    os.makedirs(tmp)
+    for name in obj.ARRAYS:
+        np.save(os.path.join(tmp, f'{name}.npy'), getattr(obj, name))
+    if ids is not None:
+        np.save(os.path.join(tmp, 'ids.npy'), np.array(ids, dtype=str))
+    with open(os.path.join(tmp, 'meta.json'), 'w', encoding='utf-8') as f:
+        json.dump({'kind': kind, 'version': CACHE_VERSION}, f)
+    shutil.rmtree(entry, ignore_errors=True)
+    os.replace(tmp, entry)
+
+
+def _load(entry: str, kind: str, names):
+    try:
+        with open(os.path.join(entry, 'meta.json'), 'r', encoding='utf-8') as f:
+            meta = json.load(f)
+        if meta.get('kind') != kind or meta.get('version') != CACHE_VERSION:
+            return None
+        return {name: np.load(os.path.join(entry, f'{name}.npy'), mmap_mode='r') for name in names}
+    except (OSError, ValueError):
+        return None
+
+
+def load_network(path: str, cache_dir: str = '.geometry_cache',
+                 lane_width: float = DEFAULT_LANE_WIDTH) -> NetworkGeometry:
+    """Red de SUMO desde la caché binaria (memmap) o, si no existe, leída y cacheada."""
+    entry = _cache_path(cache_dir, path, 'net', f'{lane_width}')
+    arrays = _load(entry, 'net', NetworkGeometry.ARRAYS + ('ids',))
+    if arrays is not None:
+        ids = arrays.pop('ids')
+        return NetworkGeometry([str(i) for i in ids], **arrays)
+    net = parse_network(path, lane_width)
+    os.makedirs(cache_dir, exist_ok=True)
+    _save(entry, 'net', net, net.edge_ids)
+    return net
+
+
+def load_buildings(path: str, cache_dir: str = '.geometry_cache',
+                   default_height: float = DEFAULT_BUILDING_HEIGHT) -> BuildingFootprints:
+    """Edificios desde la caché binaria (memmap) o, si no existe, leídos y cacheados."""
+    entry = _cache_path(cache_dir, path, 'poly', f'{default_height}')
+    arrays = _load(entry, 'poly', BuildingFootprints.ARRAYS)
+    if arrays is not None:
+        return BuildingFootprints(**arrays)
+    buildings = parse_buildings(path, default_height)
+    os.makedirs(cache_dir, exist_ok=True)
+    _save(entry, 'poly', buildings)
+    return buildings
@@ -0,0 +1,164 @@
+"""
+Módulo de Pirámide de Teselas (slippy map) para mallas de contaminación
+
+Construye a partir de cada instantánea de una especie una pirámide multirresolución
+de teselas de 256x256 con mínimo, media y máximo por nivel, al estilo de los mapas
+web (z=0 es una única tesela que cubre todo el dominio; cada nivel duplica la
+resolución). Así un visor de mapas solo descarga las teselas visibles al zoom actual.
+
+Disposición en disco (una carpeta por especie):
+    <raíz>/<especie>/meta.json      paso, forma, zoom máximo y rango por estadístico
+    <raíz>/<especie>/level_<z>.npy  float32 [3, 256*2^z, 256*2^z] (min, media, max)
+
+Los niveles se abren con memmap: al escribir una nueva instantánea solo se tocan las
+teselas que han cambiado, y al servir una tesela solo se lee su ventana.
+"""
+
+import json
+import math
+import os
+from typing import Dict, Optional, Tuple
+
+import numpy as np
+
+TILE_SIZE = 256
+STATS = ('min', 'mean', 'max')
+
+
+def max_zoom(shape: Tuple[int, int], tile: int = TILE_SIZE) -> int:
+    """Nivel de zoom en el que una celda de la malla ocupa al menos un píxel."""
+    return max(0, math.ceil(math.log2(max(shape) / tile))) if max(shape) > tile else 0
+
+
+def build_levels(grid: np.ndarray, tile: int = TILE_SIZE) -> Dict[int, np.ndarray]:
+    """
+    Construye todos los niveles de la pirámide (mip-mapping 2x2 de min/media/max).
+
+    La fila 0 de la malla corresponde a y_min, mientras que en un slippy map la fila 0
+    de teselas está arriba, así que la malla se invierte verticalmente. Las celdas de
+    relleno hasta el tamaño de la pirámide quedan a NaN (transparentes al renderizar).
+
+    Returns:
+        Diccionario z -> array float32 [3, 256*2^z, 256*2^z]
+    """
+    ny, nx = grid.shape
+    zmax = max_zoom(grid.shape, tile)
+    size = tile << zmax
+    mn = np.full((size, size), np.nan, dtype=np.float32)
+    mn[:ny, :nx] = grid[::-1]
+    mx = mn.copy()
+    total = np.nan_to_num(mn)
+    count = np.zeros((size, size), dtype=np.float32)
+    count[:ny, :nx] = 1.0
+
+    levels = {}
+    for z in range(zmax, -1, -1):
+        with np.errstate(invalid='ignore', divide='ignore'):
+            mean = np.where(count > 0, total / count, np.nan).astype(np.float32)
+        levels[z] = np.stack([mn, mean, mx])
+        if z == 0:
+            break
+        # Reducción 2x2 hacia el nivel más grueso (fmin/fmax ignoran los NaN del relleno)
+        mn = np.fmin(np.fmin(mn[0::2, 0::2], mn[1::2, 0::2]), np.fmin(mn[0::2, 1::2], mn[1::2, 1::2]))
+        mx = np.fmax(np.fmax(mx[0::2, 0::2], mx[1::2, 0::2]), np.fmax(mx[0::2, 1::2], mx[1::2, 1::2]))
+        total = total[0::2, 0::2] + total[1::2, 0::2] + total[0::2, 1::2] + total[1::2, 1::2]
+        count = count[0::2, 0::2] + count[1::2, 0::2] + count[0::2, 1::2] + count[1::2, 1::2]
+    return levels
+
+
+class TilePyramidWriter:
+    """
+    Escribe de forma incremental la pirámide de una especie en disco.
+
+    Args:
+        root: Carpeta raíz de las pirámides (p. ej. 'tiles')
+        species: Nombre de la especie
+    """
+
+    def __init__(self, root: str, species: str, tile: int = TILE_SIZE):
+        self.root = root
+        self.species = species
+        self.tile = tile
+        self.path = os.path.join(root, species)
+        os.makedirs(self.path, exist_ok=True)
+        self._levels: Dict[int, np.memmap] = {}
+        self._shape = None
+
+    def _open_level(self, z: int, shape) -> np.memmap:
+        path = os.path.join(self.path, f'level_{z}.npy')
+        if os.path.exists(path):
+            level = np.load(path, mmap_mode='r+')
+            if level.shape == shape and level.dtype == np.float32:
+                return level
+        return np.lib.format.open_memmap(path, mode='w+', dtype=np.float32, shape=shape)
+
+    def write(self, grid: np.ndarray, step: int) -> int:
+        """
+        Actualiza la pirámide con una nueva instantánea.
+
+        Returns:
+            Número de teselas reescritas (las no modificadas no se tocan)
+        """
+        levels = build_levels(grid, self.tile)
+        if self._shape != grid.shape:
+            self._levels = {z: self._open_level(z, data.shape) for z, data in levels.items()}
+            self._shape = grid.shape
+        t = self.tile
+        written = 0
+        for z, data in levels.items():
+            out = self._levels[z]
+            n = 1 << z
+            for ty in range(n):
+                for tx in range(n):
+                    window = (slice(None), slice(ty * t, (ty + 1) * t), slice(tx * t, (tx + 1) * t))
+                    if not np.array_equal(out[window], data[window], equal_nan=True):
+                        out[window] = data[window]
+                        written += 1
+            out.flush()
+        self._write_meta(grid.shape, step, levels)
+        return written
+
+    def _write_meta(self, shape, step: int, levels: Dict[int, np.ndarray]):
+        finest = levels[max(levels)]
+        meta = {
+            'species': self.species,
+            'step': int(step),
+            'shape': list(shape),
+            'tile_size': self.tile,
+            'max_zoom': max(levels),
+            'range': {stat: [float(np.nanmin(finest[i])), float(np.nanmax(finest[i]))]
+                      for i, stat in enumerate(STATS)},
+        }
+        tmp = os.path.join(self.path, 'meta.json.tmp')
+        with open(tmp, 'w', encoding='utf-8') as f:
+            json.dump(meta, f)
+        os.replace(tmp, os.path.join(self.path, 'meta.json'))
+
+
+class TilePyramidReader:
+    """Lectura de teselas individuales de la pirámide de una especie."""
+
+    def __init__(self, root: str, species: str):
+        self.path = os.path.join(root, species)
+
+    def meta(self) -> Optional[dict]:
+        path = os.path.join(self.path, 'meta.json')
+        if not os.path.exists(path):
+            return None
+        with open(path, 'r', encoding='utf-8') as f:
+            return json.load(f)
+
+    def tile(self, z: int, x: int, y: int, stat: str = 'mean') -> Optional[np.ndarray]:
+        """
+        Devuelve la tesela (z, x, y) del estadístico pedido como float32 [256, 256],
+        o None si está fuera de la pirámide.
+        """
+        meta = self.meta()
+        if meta is None or stat not in STATS or not 0 <= z <= meta['max_zoom']:
+            return None
+        n = 1 << z
+        if not (0 <= x < n and 0 <= y < n):
+            return None
+        t = meta['tile_size']
+        level = np.load(os.path.join(self.path, f'level_{z}.npy'), mmap_mode='r')
+        return np.array(level[STATS.index(stat), y * t:(y + 1) * t, x * t:(x + 1) * t])
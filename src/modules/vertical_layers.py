@@ -0,0 +1,110 @@
+"""
+Módulo de Capas Verticales (2.5D)
+
+Concentración a varias alturas de receptor (aceras, balcones, fachadas) sin una CFD 3D:
+    - gaussian_layers_py: pluma gaussiana de los vehículos evaluada en L alturas con los
+      términos horizontales compartidos y reflexión en el suelo; versión NumPy del núcleo
+      cs_module.update_pollution_layers
+    - vertical_exchange_py: difusión turbulenta entre capas (Kz) con Euler implícito y flujo
+      nulo en suelo y cima; versión NumPy de cs_module.vertical_exchange
+
+Las pilas de capas tienen forma [L, ny, nx], de modo que cada capa es una malla 2D contigua
+que los núcleos de transporte pueden modificar sin copias.
+"""
+
+import math
+from typing import Optional, Sequence
+
+import numpy as np
+
+# Clase de estabilidad -> (a, b) de sigma_y = a x (1 + 1e-4 x)^-1/2 (igual que cs_module.c)
+STABILITY_PARAMS = {
+    'A': (0.22, 0.20), 'B': (0.16, 0.12), 'C': (0.11, 0.08),
+    'D': (0.08, 0.06), 'E': (0.06, 0.03), 'F': (0.04, 0.016),
+}
+# Difusividad vertical típica junto al suelo urbano (m²/s) por clase de estabilidad
+STABILITY_KZ = {'A': 5.0, 'B': 3.0, 'C': 1.5, 'D': 1.0, 'E': 0.3, 'F': 0.1}
+WINDOW = 100.0      # Semiancho de la ventana de cálculo por vehículo (m)
+MAX_DISTANCE = 300.0
+MIN_WIND = 0.5      # Viento mínimo en el denominador de la pluma (m/s)
+
+
+def layer_heights(n_layers: int, thickness: float = 3.0) -> np.ndarray:
+    """Centros de n_layers capas de espesor uniforme desde el suelo (m)."""
+    return (np.arange(n_layers) + 0.5) * float(thickness)
+
+
+def vertical_diffusivity(stability_class: str, wind_speed: float = 3.0) -> float:
+    """Kz (m²/s) de la clase de estabilidad, escalado con el viento respecto a 3 m/s."""
+    return STABILITY_KZ.get(stability_class, 1.0) * max(wind_speed, MIN_WIND) / 3.0
+
+
+def gaussian_layers_py(grids: np.ndarray, sources: np.ndarray, heights: Sequence[float], wind_speed: float,
+                       wind_direction: float, stability_class: str, bounds, obstacles: Optional[np.ndarray] = None):
+    """
+    Versión NumPy de cs_module.update_pollution_layers: suma en grids [L, ny, nx] la pluma
+    de cada fuente (x, y, emisión, altura efectiva) en las alturas dadas. obstacles es la
+    máscara booleana [ny, nx] o None.
+    """
+    n_layers, ny, nx = grids.shape
+    x_min, x_max, y_min, y_max = bounds
+    cw, ch = (x_max - x_min) / nx, (y_max - y_min) / ny
+    a, b = STABILITY_PARAMS.get(stability_class, (0.10, 0.05))
+    z = np.asarray(heights, dtype=np.float64).reshape(-1, 1, 1)
+    u = max(wind_speed, MIN_WIND)
+    receptor_y = y_min + (np.arange(ny) + 0.5) * ch
+    for x, y, q, h in np.asarray(sources, dtype=np.float64).reshape(-1, 4):
+        rows = np.nonzero(np.abs(receptor_y - y) <= WINDOW)[0]
+        j_min = int(max(0.0, (x - x_min - WINDOW) / cw))
+        j_max = int(min(float(nx), (x - x_min + WINDOW) / cw))
+        if not len(rows) or j_max <= j_min:
+            continue
+        dx = (x_min + (np.arange(j_min, j_max) + 0.5) * cw - x)[None, :]
+        dy = (receptor_y[rows] - y)[:, None]
+        d2 = dx * dx + dy * dy
+        valid = (d2 >= 1.0) & (d2 <= MAX_DISTANCE ** 2)
+        if obstacles is not None:
+            valid &= ~obstacles[rows[0]:rows[-1] + 1, j_min:j_max]
+        distance = np.sqrt(d2)
+        angle = np.abs(np.arctan2(dy, dx) - wind_direction)
+        angle = np.where(angle > math.pi, 2.0 * math.pi - angle, angle)
+        shrink = (1.0 + 0.0001 * distance) ** -0.5
+        sigma_y = np.where(valid, a * distance * shrink, 1.0)
+        sigma_z = np.where(valid, b * distance * shrink, 1.0)
+        horizontal = np.where(valid, q / (2.0 * math.pi * u) * np.exp(-0.5 * (angle / sigma_y) ** 2)
+                              / (sigma_y * sigma_z), 0.0)
+        inv = 0.5 / sigma_z ** 2
+        vertical = np.exp(-(z - h) ** 2 * inv) + np.exp(-(z + h) ** 2 * inv)
+        grids[:, rows[0]:rows[-1] + 1, j_min:j_max] += horizontal * vertical
+
+
+def vertical_exchange_py(grids: np.ndarray, heights: Sequence[float], kz: float, dt: float):
+    """
+    Versión NumPy de cs_module.vertical_exchange: difusión implícita entre las capas de
+    grids [L, ny, nx] (in situ), conservando sum_k c_k dz_k.
+    """
+    z = np.asarray(heights, dtype=np.float64)
+    n_layers = len(z)
+    if np.any(np.diff(z) <= 0):
+        raise ValueError("heights debe ser estrictamente creciente")
+    if n_layers < 2 or kz <= 0.0 or dt <= 0.0:
+        return
+    interfaces = np.concatenate(([0.0], 0.5 * (z[:-1] + z[1:])))
+    top = z[-1] + (z[-1] - interfaces[-1])
+    dz = np.diff(np.append(interfaces, top))
+    lower = np.zeros(n_layers)
+    upper = np.zeros(n_layers)
+    lower[1:] = -dt * kz / (dz[1:] * np.diff(z))
+    upper[:-1] = -dt * kz / (dz[:-1] * np.diff(z))
+    cprime = np.zeros(n_layers)
+    inv = np.zeros(n_layers)
+    for l in range(n_layers):
+        denom = 1.0 - lower[l] - upper[l] - (lower[l] * cprime[l - 1] if l > 0 else 0.0)
+        inv[l] = 1.0 / denom
+        cprime[l] = upper[l] * inv[l]
+    for l in range(n_layers):
+        if l > 0:
+            grids[l] -= lower[l] * grids[l - 1]
+        grids[l] *= inv[l]
+    for l in range(n_layers - 2, -1, -1):
+        grids[l] -= cprime[l] * grids[l + 1]
@@ -1,58 +1,3 @@
-import matplotlib.pyplot as plt
-import numpy as np
-import io
-import imageio.v2 as imageio
-import json
-from flask import send_file
-
-# --- NUEVO: Animación temporal de la evolución de especies (GIF) ---
-@app.route('/evolution_gif')
-def evolution_gif():
-    """
-    Devuelve un GIF animado de la evolución temporal de una o varias especies.
-    Parámetros GET:
-        species: lista separada por comas (opcional, por defecto todas)
-        duration: duración total en segundos (opcional, por defecto 5)
-    """
-
-    evo_path = os.path.join(RESULTS_DIR, 'pollution_evolution.json')
-    if not os.path.exists(evo_path):
-        return "No evolution data", 404
-    with open(evo_path, 'r', encoding='utf-8') as f:
-        evo_data = json.load(f)
-    steps = evo_data.get('steps', [])
-    species_data = evo_data.get('species', {})
-    # Selección de especies
-    req_species = request.args.get('species')
-    if req_species:
-        sel_species = [s for s in req_species.split(',') if s in species_data]
-        if not sel_species:
-            sel_species = list(species_data.keys())
-    else:
-        sel_species = list(species_data.keys())
-    # Duración total
-    duration = float(request.args.get('duration', 5))
-    n_frames = len(steps)
-    images = []
-    for i in range(n_frames):
-        plt.figure(figsize=(7,4))
-        for sp in sel_species:
-            vals = species_data[sp][:i+1]
-            plt.plot(steps[:i+1], vals, label=sp)
-        plt.xlabel('Paso temporal')
-        plt.ylabel('Concentración media')
-        plt.title('Evolución temporal de especies')
-        plt.legend()
-        plt.tight_layout()
-        buf = io.BytesIO()
-        plt.savefig(buf, format='png')
-        plt.close()
-        buf.seek(0)
-        images.append(imageio.imread(buf))
-    gif_buf = io.BytesIO()
-    imageio.mimsave(gif_buf, images, format='GIF', duration=duration/n_frames)
-    gif_buf.seek(0)
-    return send_file(gif_buf, mimetype='image/gif', as_attachment=True, download_name='evolution.gif')
 """
 WebApp avanzada para simulación y análisis técnico de contaminación urbana.
 Permite lanzar simulaciones, subir archivos, guardar configuraciones, analizar resultados y monitorizar recursos.
@@ -68,6 +13,8 @@ from werkzeug.utils import secure_filename
 from webapp_memory import memory
 import time
 import json
+import io
+import imageio.v2 as imageio
 
 app = Flask(__name__)
 
@@ -94,34 +41,168 @@ def index():
     configs = memory.get_configs()[::-1][:10]  # Últimas 10 configuraciones
     return render_template('index.html', configs=configs)
 
+# --- Cola de simulaciones: pool acotado de procesos trabajadores ---
+# Cada trabajo tiene su propio proceso, instancia de SUMO, puerto TraCI, directorio de
+# salida y segmento de memoria compartida; los handlers leen instantáneas consistentes
+# sin bloquear a la simulación (ver modules/job_scheduler.py y modules/shared_grid.py).
+MAX_CONCURRENT_SIMULATIONS = int(os.environ.get('MAX_CONCURRENT_SIMULATIONS', 0)) or None
+MAX_JOB_RUNTIME_S = float(os.environ.get('MAX_JOB_RUNTIME_S', 4 * 3600))
+MAX_JOB_MEMORY_MB = int(os.environ.get('MAX_JOB_MEMORY_MB', 0)) or None
+
+_scheduler = None
+_scheduler_lock = threading.Lock()
+_job_usage = {}  # job_id -> {'last_seq', 'peak_rss_MB'}
+
+
+def get_scheduler():
+    """Planificador de la WebApp (se crea al primer uso, no al importar el módulo)."""
+    global _scheduler
+    with _scheduler_lock:
+        if _scheduler is None:
+            from modules.job_scheduler import JobScheduler
+            _scheduler = JobScheduler(RESULTS_DIR, max_workers=MAX_CONCURRENT_SIMULATIONS,
+                                      max_runtime_s=MAX_JOB_RUNTIME_S, max_memory_mb=MAX_JOB_MEMORY_MB,
+                                      on_tick=_on_job_tick, on_finish=_on_job_finish)
+        return _scheduler
+
+
+def live_reader(job_id=None):
+    """Lector de memoria compartida del trabajo indicado o del último en ejecución (o None)."""
+    if _scheduler is None:
+        return None
+    job = _scheduler.get(job_id) if job_id else _scheduler.latest_running()
+    return job.reader if job is not None else None
+
+
+def _snapshot_unavailable(reader):
+    """Respuesta 503 cuando no se obtiene una instantánea consistente del segmento."""
+    return jsonify({'error': f'Instantánea no disponible en {reader.name}; reintente'}), 503
+
+
+def _stream_key(job_id, species):
+    return f"{job_id}/{species}"
+
+
+def _on_job_tick(job):
+    """
+    Reenvía al hub de streaming (SSE) cada nueva instantánea y registra el pico de memoria.
+    """
+    from modules.grid_stream import stream_hub
+    usage = _job_usage.setdefault(job.job_id, {'last_seq': -1, 'peak_rss_MB': 0})
+    if job.process is not None and job.process.pid:
+        try:
+            rss = psutil.Process(job.process.pid).memory_info().rss // 1024 // 1024
+            usage['peak_rss_MB'] = max(usage['peak_rss_MB'], rss)
+        except psutil.Error:
+            pass
+    seq = job.reader.seq
+    if seq != usage['last_seq'] and not seq & 1 and stream_hub.has_subscribers():
+        step, grids = job.reader.snapshot()
+        for sp, grid in grids.items():
+            stream_hub.publish(_stream_key(job.job_id, sp), step, grid)
+    usage['last_seq'] = seq
+
+
+def _on_job_finish(job):
+    usage = _job_usage.pop(job.job_id, {})
+    stats = {
+        'job_id': job.job_id,
+        'state': job.state,
+        'exit_code': job.exit_code,
+        'peak_rss_MB': usage.get('peak_rss_MB'),
+        'duration_sec': (job.finished_at - job.started_at) if job.started_at else 0.0,
+        'queued_sec': (job.started_at or job.finished_at) - job.created_at,
+    }
+    memory.save_config(job.config, stats=stats)
+
+
+def _config_from_request():
+    """
+    Configuración del formulario/JSON con los tipos y claves que espera run_simulation.
+    """
+    config = request.json if request.is_json else request.form.to_dict()
+    species_list = config.get('species_list') or ['NOx']
+    if isinstance(species_list, str):
+        species_list = [sp.strip() for sp in species_list.split(',') if sp.strip()]
+    config['species_list'] = species_list
+    for key in ('grid_resolution', 'total_steps', 'update_interval'):
+        if key in config:
+            config[key] = int(config[key])
+    for key in ('wind_speed', 'wind_direction', 'emission_factor', 'temperature', 'diffusion_coeff',
+                'humidity', 'chimney_height', 'deposition_rate'):
+        if key in config:
+            config[key] = float(config[key])
+    parameters = dict(config.get('parameters') or {})
+    parameters.setdefault('total_steps', config.get('total_steps', 1000))
+    parameters.setdefault('update_interval', config.get('update_interval', 10))
+    config['parameters'] = parameters
+    config.setdefault('record_simulation', False)
+    config.setdefault('output_file', '')
+    return config
+
+
 @app.route('/run_simulation', methods=['POST'])
 def run_simulation_api():
     """
-    Lanza una simulación en un hilo, guarda la configuración y monitoriza recursos.
+    Encola una simulación en el pool de trabajadores y guarda la configuración.
+    El trabajo publica mallas, estadísticas y paso en memoria compartida (ver /jobs y /live).
     """
-    from main import run_simulation
-    config = request.json if request.is_json else request.form.to_dict()
+    config = _config_from_request()
     # Guardar configuración antes de lanzar
     memory.save_config(config)
-    def run_and_save():
-        # Medir recursos antes y después
-        cpu_start = psutil.cpu_percent(interval=None)
-        mem_start = psutil.virtual_memory().used
-        t0 = time.time()
-        run_simulation(config)
-        t1 = time.time()
-        cpu_end = psutil.cpu_percent(interval=None)
-        mem_end = psutil.virtual_memory().used
-        stats = {
-            'cpu_percent_start': cpu_start,
-            'cpu_percent_end': cpu_end,
-            'mem_used_start_MB': mem_start // 1024 // 1024,
-            'mem_used_end_MB': mem_end // 1024 // 1024,
-            'duration_sec': t1 - t0
-        }
-        memory.save_config(config, stats=stats)
-    threading.Thread(target=run_and_save).start()
-    return jsonify({'status': 'Simulación lanzada'})
+    scheduler = get_scheduler()
+    job = scheduler.submit(config)
+    return jsonify({'status': 'Simulación en cola', 'job_id': job.job_id,
+                    'queue_position': scheduler.queue_position(job.job_id)})
+
+@app.route('/jobs')
+def list_jobs():
+    """
+    Lista todos los trabajos de simulación con su estado.
+    """
+    return jsonify({'jobs': [job.to_dict() for job in get_scheduler().list()],
+                    'max_workers': get_scheduler().max_workers})
+
+@app.route('/jobs/<job_id>')
+def job_detail(job_id):
+    """
+    Estado de un trabajo; si está en ejecución incluye paso y estadísticas en vivo.
+    """
+    scheduler = get_scheduler()
+    job = scheduler.get(job_id)
+    if job is None:
+        return jsonify({'error': 'Trabajo no encontrado'}), 404
+    data = job.to_dict()
+    data['queue_position'] = scheduler.queue_position(job_id)
+    if job.reader is not None:
+        try:
+            data['live'] = job.reader.stats_snapshot()
+        except TimeoutError:
+            return _snapshot_unavailable(job.reader)
+    return jsonify(data)
+
+@app.route('/jobs/<job_id>/cancel', methods=['POST'])
+def cancel_job(job_id):
+    """
+    Cancela un trabajo en cola o en ejecución.
+    """
+    if not get_scheduler().cancel(job_id):
+        return jsonify({'error': 'El trabajo no existe o ya ha terminado'}), 404
+    return jsonify({'status': 'Cancelación solicitada', 'job_id': job_id})
+
+@app.route('/live')
+def live():
+    """
+    Paso, estado y estadísticas por especie de una simulación (?job=<id>, por defecto la
+    última en ejecución), leídos de memoria compartida.
+    """
+    reader = live_reader(request.args.get('job'))
+    if reader is None:
+        return jsonify({'error': 'No hay ninguna simulación en curso'}), 404
+    try:
+        return jsonify(reader.stats_snapshot())
+    except TimeoutError:
+        return _snapshot_unavailable(reader)
 
 @app.route('/results')
 def list_results():
@@ -141,27 +222,195 @@ def download_file(filename):
         return "Archivo no encontrado", 404
     return send_file(path, as_attachment=True)
 
+# --- Renderizado de imágenes: LUT en NumPy + Pillow, con caché (ver modules/render_cache.py) ---
+IMAGE_MIMETYPES = {'png': 'image/png', 'webp': 'image/webp'}
+
+
+def _image_args():
+    """Parámetros GET comunes de las imágenes: cmap, format (png|webp) y scale."""
+    fmt = request.args.get('format', 'png')
+    if fmt not in IMAGE_MIMETYPES:
+        fmt = 'png'
+    scale = min(max(int(request.args.get('scale', 4)), 1), 16)
+    return request.args.get('cmap', 'hot'), fmt, scale
+
+
+def _send_image(data, meta, fmt, max_age=0):
+    """Respuesta con la imagen codificada; el rango de la escala de color va en cabeceras."""
+    response = send_file(io.BytesIO(data), mimetype=IMAGE_MIMETYPES[fmt], max_age=max_age)
+    response.headers['X-Value-Min'] = repr(meta['vmin'])
+    response.headers['X-Value-Max'] = repr(meta['vmax'])
+    return response
+
+
 @app.route('/heatmap/<species>/<step>')
 def heatmap(species, step):
     """
-    Devuelve un heatmap PNG de la concentración de una especie en un paso dado.
+    Devuelve un heatmap de la concentración de una especie en un paso dado.
+    Parámetros GET opcionales: cmap (por defecto hot), format (png|webp), scale (píxeles por celda).
     """
-    import matplotlib.pyplot as plt
-    grid_path = os.path.join(RESULTS_DIR, f'pollution_grid_{species}_{step}.csv')
+    from modules.render_cache import render_cache, file_fingerprint
+    grid_path = os.path.join(RESULTS_DIR, secure_filename(f'pollution_grid_{species}_{step}.csv'))
     if not os.path.exists(grid_path):
         return "Grid no encontrado", 404
-    grid = np.loadtxt(grid_path, delimiter=',')
-    import io
-    buf = io.BytesIO()
-    plt.figure(figsize=(6,5))
-    plt.imshow(grid, cmap='hot', origin='lower')
-    plt.colorbar(label='Concentración')
-    plt.title(f'Heatmap {species} (step {step})')
-    plt.tight_layout()
-    plt.savefig(buf, format='png')
-    plt.close()
-    buf.seek(0)
-    return send_file(buf, mimetype='image/png')
+    cmap, fmt, scale = _image_args()
+    key = (file_fingerprint(grid_path), species, step)
+    data, meta = render_cache.render(key, lambda: render_cache.load_csv(grid_path), cmap, fmt, scale)
+    return _send_image(data, meta, fmt, max_age=3600)
+
+# --- NUEVO: Streaming en vivo de la malla (SSE con deltas binarios por teselas) ---
+@app.route('/stream/<species>')
+def stream(species):
+    """
+    Canal Server-Sent Events con la malla de la especie indicada durante la simulación.
+    Cada evento 'grid' lleva un mensaje binario en base64 (ver modules/grid_stream.py):
+    primero un keyframe y después solo las teselas que han cambiado, cuantizadas a uint8
+    y comprimidas. El navegador reconstruye y pinta la malla en un canvas.
+    Parámetro GET opcional job=<id>; por defecto, la última simulación en ejecución.
+    """
+    from flask import Response, stream_with_context
+    from modules.grid_stream import stream_hub, sse_event
+
+    job_id = request.args.get('job')
+    if not job_id:
+        job = get_scheduler().latest_running()
+        if job is None:
+            return "No hay ninguna simulación en curso", 404
+        job_id = job.job_id
+    key = _stream_key(job_id, species)
+
+    def events():
+        for message in stream_hub.subscribe(key):
+            yield sse_event(message)
+
+    headers = {'Cache-Control': 'no-cache', 'X-Accel-Buffering': 'no'}
+    return Response(stream_with_context(events()), mimetype='text/event-stream', headers=headers)
+
+# --- NUEVO: Pirámide de teselas (slippy map) para dominios grandes ---
+def _tiles_root():
+    job_id = request.args.get('job')
+    if job_id:
+        return os.path.join(RESULTS_DIR, 'jobs', secure_filename(job_id), 'tiles')
+    return os.path.join(RESULTS_DIR, 'tiles')
+
+@app.route('/tiles/<species>/meta.json')
+def tiles_meta(species):
+    """
+    Metadatos de la pirámide de una especie: paso, forma, zoom máximo y rangos.
+    """
+    from modules.tile_pyramid import TilePyramidReader
+    meta = TilePyramidReader(_tiles_root(), secure_filename(species)).meta()
+    if meta is None:
+        return jsonify({'error': 'No hay teselas para la especie'}), 404
+    return jsonify(meta)
+
+@app.route('/tiles/<species>/<int:z>/<int:x>/<int:y>.png')
+def tile(species, z, x, y):
+    """
+    Devuelve una tesela PNG de 256x256 de la pirámide de la especie.
+    Parámetros GET: stat=min|mean|max (por defecto mean), cmap (por defecto hot), job.
+    """
+    from modules.render_cache import render_cache
+    from modules.tile_pyramid import TilePyramidReader
+    stat = request.args.get('stat', 'mean')
+    root = _tiles_root()
+    reader = TilePyramidReader(root, secure_filename(species))
+    meta = reader.meta()
+    if meta is None:
+        return "Tesela no encontrada", 404
+    data = reader.tile(z, x, y, stat)
+    if data is None:
+        return "Tesela no encontrada", 404
+    vmin, vmax = meta['range'][stat]
+    key = ('tile', root, species, meta['step'], z, x, y, stat)
+    png, _ = render_cache.render(key, lambda: data, request.args.get('cmap', 'hot'), 'png',
+                                 vmin=vmin, vmax=vmax, origin_lower=False)
+    return send_file(io.BytesIO(png), mimetype='image/png', max_age=0)
+
+# --- Motor de bocanadas: teselas y receptores evaluados bajo demanda (sin malla completa) ---
+_puff_fields = {}
+_puff_fields_lock = threading.Lock()
+
+def _puff_field():
+    """
+    Campo de bocanadas del trabajo indicado (?job=<id>) o de los resultados publicados, o None.
+    Un campo publicado no se modifica nunca: si el fichero cambia se carga uno nuevo y se sustituye
+    la entrada, y las peticiones en curso terminan con el anterior. Su caché de teselas se
+    conserva mientras el fichero no cambie.
+    """
+    from modules.puff_engine import LazyPuffField
+    from modules.render_cache import file_fingerprint
+    job_id = request.args.get('job')
+    root = os.path.join(RESULTS_DIR, 'jobs', secure_filename(job_id)) if job_id else RESULTS_DIR
+    path = os.path.join(root, 'puffs', 'latest.npz')
+    if not os.path.exists(path):
+        return None
+    fingerprint = file_fingerprint(path)
+    with _puff_fields_lock:
+        cached = _puff_fields.get(path)
+    if cached is not None and cached[0] == fingerprint:
+        return cached[1]
+    field = LazyPuffField.load(path)
+    field.fingerprint = fingerprint  # Clave de sus teselas en render_cache
+    with _puff_fields_lock:
+        cached = _puff_fields.get(path)
+        if cached is None or cached[0] != fingerprint:
+            cached = (fingerprint, field)
+            _puff_fields[path] = cached
+        return cached[1]
+
+def _puff_range(field, species):
+    """Escala de color de las teselas: máximo de la tesela z=0 (cacheada con el paso)."""
+    data = field.tile(0, 0, 0)
+    return 0.0, float(data[field.species_list.index(species)].max())
+
+@app.route('/puffs/meta.json')
+def puffs_meta():
+    """Metadatos del campo de bocanadas: paso, especies, límites, zoom máximo y rangos."""
+    field = _puff_field()
+    if field is None:
+        return jsonify({'error': 'No hay bocanadas publicadas'}), 404
+    return jsonify({'step': field.step, 'species': field.species_list, 'bounds': list(field.bounds),
+                    'tile_size': field.tile_size, 'max_zoom': field.max_zoom, 'puffs': int(len(field.x)),
+                    'range': {sp: _puff_range(field, sp) for sp in field.species_list}})
+
+@app.route('/puffs/<species>/<int:z>/<int:x>/<int:y>.png')
+def puff_tile(species, z, x, y):
+    """
+    Tesela PNG evaluada bajo demanda a partir de las bocanadas (solo las que la tocan).
+    Parámetros GET: cmap (por defecto hot), vmax (por defecto el máximo a z=0), job.
+    """
+    from modules.render_cache import render_cache
+    field = _puff_field()
+    if field is None or species not in field.species_list or z > field.max_zoom:
+        return "Tesela no encontrada", 404
+    data = field.tile(z, x, y)
+    if data is None:
+        return "Tesela no encontrada", 404
+    vmin, vmax = _puff_range(field, species)
+    vmax = request.args.get('vmax', vmax, type=float)
+    key = ('puff_tile', field.fingerprint, species, z, x, y, vmax)
+    png, _ = render_cache.render(key, lambda: data[field.species_list.index(species)],
+                                 request.args.get('cmap', 'hot'), 'png',
+                                 vmin=vmin, vmax=vmax, origin_lower=False)
+    return send_file(io.BytesIO(png), mimetype='image/png', max_age=0)
+
+@app.route('/receptors')
+def receptors():
+    """
+    Concentración de cada especie en los puntos pedidos (?x=..&y=.., repetibles) a partir
+    de las bocanadas, sin rasterizar la malla.
+    """
+    field = _puff_field()
+    if field is None:
+        return jsonify({'error': 'No hay bocanadas publicadas'}), 404
+    xs = request.args.getlist('x', type=float)
+    ys = request.args.getlist('y', type=float)
+    if not xs or len(xs) != len(ys):
+        return jsonify({'error': 'Se necesitan tantos x como y'}), 400
+    values = field.sample(np.array(xs), np.array(ys))
+    return jsonify({'step': field.step, 'x': xs, 'y': ys,
+                    'values': {sp: v.tolist() for sp, v in values.items()}})
 
 # --- NUEVO: Subida de archivos para escenarios y configuraciones ---
 @app.route('/upload', methods=['POST'])
@@ -253,88 +502,156 @@ def analysis():
 def frame(species):
     """
     Devuelve el heatmap actual de la especie indicada como imagen PNG (para visualización en tiempo real).
+    Si hay una simulación en curso se lee la instantánea de memoria compartida; si no,
+    el último CSV exportado.
     """
-    import matplotlib.pyplot as plt
-    import io
-    import numpy as np
+    from modules.render_cache import render_cache, file_fingerprint
+    cmap, fmt, scale = _image_args()
+    reader = live_reader(request.args.get('job'))
+    if reader is not None and species in reader.index:
+        # Paso y malla de la misma instantánea: una publicación entre dos lecturas
+        # guardaría en caché la malla de un paso con la clave (y X-Step) de otro
+        try:
+            step, grids = reader.snapshot(species)
+        except TimeoutError:
+            return _snapshot_unavailable(reader)
+        key = ('live', reader.name, species, step)
+        grid_fn = lambda: grids[species]
+    else:
+        # Buscar el último archivo CSV de la especie (más reciente)
+        files = [f for f in os.listdir(RESULTS_DIR) if f.startswith(f'pollution_grid_{species}_') and f.endswith('.csv')]
+        if not files:
+            return "No hay datos aún", 404
+        # Seleccionar el de mayor step
+        files.sort(key=lambda x: int(x.split('_')[-1].split('.')[0]), reverse=True)
+        step = files[0].split("_")[-1].split(".")[0]
+        grid_path = os.path.join(RESULTS_DIR, files[0])
+        key = (file_fingerprint(grid_path), species, step)
+        grid_fn = lambda: render_cache.load_csv(grid_path)
+    data, meta = render_cache.render(key, grid_fn, cmap, fmt, scale)
+    response = _send_image(data, meta, fmt)
+    response.headers['X-Step'] = str(step)
+    return response
+
 # --- NUEVO: Evolución temporal de una especie (media por paso) ---
+def _evolution_store():
+    """Almacén de evolución del trabajo indicado (?job=<id>) o de los resultados publicados."""
+    from modules.evolution_store import EvolutionStore
+    job_id = request.args.get('job')
+    if job_id:
+        return EvolutionStore(os.path.join(RESULTS_DIR, 'jobs', secure_filename(job_id), 'evolution'))
+    return EvolutionStore(os.path.join(RESULTS_DIR, 'evolution'))
+
+
+def _evolution_query_args():
+    """Parámetros GET de consulta: start, stop (pasos inclusivos), stride y metric (mean|max|total)."""
+    start = request.args.get('start', type=int)
+    stop = request.args.get('stop', type=int)
+    stride = request.args.get('stride', 1, type=int)
+    return start, stop, stride, request.args.get('metric', 'mean')
+
+
+def _evolution_json(start=None, stop=None, stride=1):
+    """Evolución exportada al final de la simulación (pollution_evolution.json), o None."""
+    evo_path = os.path.join(RESULTS_DIR, 'pollution_evolution.json')
+    if not os.path.exists(evo_path):
+        return None
+    with open(evo_path, 'r', encoding='utf-8') as f:
+        evo_data = json.load(f)
+    steps = evo_data.get('steps', [])
+    keep = [i for i, st in enumerate(steps)
+            if (start is None or st >= start) and (stop is None or st <= stop)][::max(1, stride)]
+    return {sp: {'steps': [steps[i] for i in keep], 'values': [vals[i] for i in keep]}
+            for sp, vals in evo_data.get('species', {}).items()}
+
+
 @app.route('/evolution/<species>')
 def evolution(species):
     """
     Devuelve la evolución temporal (media por paso) de la especie indicada en formato JSON.
+    Se consulta el almacén indexado que escribe la simulación, por lo que el coste es
+    proporcional al resultado. Parámetros GET opcionales: start, stop, stride, metric, job.
     """
-    # Buscar todos los archivos CSV de la especie
-    files = [f for f in os.listdir(RESULTS_DIR) if f.startswith(f'pollution_grid_{species}_') and f.endswith('.csv')]
-    if not files:
+    start, stop, stride, metric = _evolution_query_args()
+    series = _evolution_store().query(species, start, stop, stride, metric)
+    if series is None and metric == 'mean' and not request.args.get('job'):
+        series = (_evolution_json(start, stop, stride) or {}).get(species)
+    if series is None:
         return jsonify({'error': 'No hay datos para la especie'}), 404
-    # Ordenar por step
-    files.sort(key=lambda x: int(x.split('_')[-1].split('.')[0]))
-    evolution = []
-    steps = []
-    for f in files:
-        grid = np.loadtxt(os.path.join(RESULTS_DIR, f), delimiter=',')
-        mean_val = float(np.mean(grid))
-        step = int(f.split('_')[-1].split('.')[0])
-        evolution.append(mean_val)
-        steps.append(step)
-    return jsonify({'species': species, 'steps': steps, 'values': evolution})
-
-
-# --- NUEVO: Comparativa de evolución temporal de todas las especies (usando JSON si existe) ---
+    return jsonify({'species': species, 'steps': series['steps'], 'values': series['values']})
+
+
+# --- NUEVO: Comparativa de evolución temporal de todas las especies ---
 @app.route('/compare')
 def compare():
     """
-    Devuelve la evolución temporal de todas las especies detectadas (media por paso) para comparación.
-    Si existe pollution_evolution.json, lo usa para máxima eficiencia.
+    Devuelve la evolución temporal de todas las especies (media por paso) para comparación.
+    Usa el almacén indexado; si no existe (resultados antiguos), pollution_evolution.json.
+    Parámetros GET opcionales: start, stop, stride, metric, job.
     """
-    import json
-    evo_path = os.path.join(RESULTS_DIR, 'pollution_evolution.json')
-    if os.path.exists(evo_path):
-        with open(evo_path, 'r', encoding='utf-8') as f:
-            evo_data = json.load(f)
-        steps = evo_data.get('steps', [])
-        species_data = evo_data.get('species', {})
-        data = {}
-        for sp, vals in species_data.items():
-            data[sp] = {'steps': steps, 'values': vals}
-        return jsonify(data)
-    # Fallback: reconstruir desde CSVs (antiguo)
-    files = [f for f in os.listdir(RESULTS_DIR) if f.startswith('pollution_grid_') and f.endswith('.csv')]
-    if not files:
+    start, stop, stride, metric = _evolution_query_args()
+    store = _evolution_store()
+    if store.exists():
+        data = store.query_all(start, stop, stride, metric)
+    elif metric == 'mean' and not request.args.get('job'):
+        data = _evolution_json(start, stop, stride)
+    else:
+        data = None
+    if not data:
         return jsonify({'error': 'No hay datos'}), 404
-    species_set = set(f.split('_')[2] for f in files)
-    data = {}
-    for species in species_set:
-        sp_files = [f for f in files if f.split('_')[2] == species]
-        sp_files.sort(key=lambda x: int(x.split('_')[-1].split('.')[0]))
-        values = []
-        steps = []
-        for f in sp_files:
-            grid = np.loadtxt(os.path.join(RESULTS_DIR, f), delimiter=',')
-            mean_val = float(np.mean(grid))
-            step = int(f.split('_')[-1].split('.')[0])
-            values.append(mean_val)
-            steps.append(step)
-        data[species] = {'steps': steps, 'values': values}
     return jsonify(data)
-    # Buscar el último archivo CSV de la especie (más reciente)
-    files = [f for f in os.listdir(RESULTS_DIR) if f.startswith(f'pollution_grid_{species}_') and f.endswith('.csv')]
-    if not files:
-        return "No hay datos aún", 404
-    # Seleccionar el de mayor step
-    files.sort(key=lambda x: int(x.split('_')[-1].split('.')[0]), reverse=True)
-    grid_path = os.path.join(RESULTS_DIR, files[0])
-    grid = np.loadtxt(grid_path, delimiter=',')
-    buf = io.BytesIO()
-    plt.figure(figsize=(6,5))
-    plt.imshow(grid, cmap='hot', origin='lower')
-    plt.colorbar(label='Concentración')
-    plt.title(f'Heatmap {species} (step {files[0].split("_")[-1].split(".")[0]})')
-    plt.tight_layout()
-    plt.savefig(buf, format='png')
-    plt.close()
-    buf.seek(0)
-    return send_file(buf, mimetype='image/png')
+
+# --- NUEVO: Animación temporal de la evolución de especies (GIF) ---
+@app.route('/evolution_gif')
+def evolution_gif():
+    """
+    Devuelve un GIF animado de la evolución temporal de una o varias especies.
+    Parámetros GET:
+        species: lista separada por comas (opcional, por defecto todas)
+        duration: duración total en segundos (opcional, por defecto 5)
+        format: gif (por defecto) o mp4
+    Los fotogramas se dibujan de forma incremental (solo el segmento nuevo de cada curva)
+    y la animación se guarda en caché hasta que cambie pollution_evolution.json.
+    """
+    from modules.render_cache import render_cache, render_evolution_frames, encode_gif, file_fingerprint
+
+    evo_path = os.path.join(RESULTS_DIR, 'pollution_evolution.json')
+    if not os.path.exists(evo_path):
+        return "No evolution data", 404
+    with open(evo_path, 'r', encoding='utf-8') as f:
+        evo_data = json.load(f)
+    steps = evo_data.get('steps', [])
+    species_data = evo_data.get('species', {})
+    if not steps:
+        return "No evolution data", 404
+    # Selección de especies
+    req_species = request.args.get('species')
+    if req_species:
+        sel_species = [s for s in req_species.split(',') if s in species_data]
+        if not sel_species:
+            sel_species = list(species_data.keys())
+    else:
+        sel_species = list(species_data.keys())
+    # Duración total
+    duration = float(request.args.get('duration', 5))
+    fmt = 'mp4' if request.args.get('format') == 'mp4' else 'gif'
+    key = ('evolution', file_fingerprint(evo_path), tuple(sel_species), duration, fmt)
+
+    def encode():
+        frames = render_evolution_frames(steps, {sp: species_data[sp] for sp in sel_species})
+        if fmt == 'gif':
+            return encode_gif(frames, duration)
+        buf = io.BytesIO()
+        imageio.mimsave(buf, frames, format='FFMPEG', extension='.mp4',
+                        fps=max(1.0, len(frames) / duration))
+        return buf.getvalue()
+
+    try:
+        data = render_cache.get_or_build(key, encode)
+    except ImportError:
+        return "Exportación MP4 no disponible (requiere imageio[ffmpeg])", 501
+    mimetype = 'video/mp4' if fmt == 'mp4' else 'image/gif'
+    return send_file(io.BytesIO(data), mimetype=mimetype, as_attachment=True, download_name=f'evolution.{fmt}')
 
 if __name__ == '__main__':
     # Ejecutar la WebApp en modo debug para desarrollo